@@ -0,0 +1,436 @@
+/*
+ * @file apic.c
+ * @version 0.0.2
+ * Local APIC and IOAPIC interrupt delivery
+ */
+
+#include "apic.h"
+#include "clock.h"
+#include "paging.h"
+
+typedef unsigned long long uint64_t;
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+// Local APIC registers, as byte offsets
+#define LAPIC_ID            0x020
+#define LAPIC_TPR           0x080
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LVT_MASKED       0x10000
+#define TIMER_DIVIDE_16  0x3
+
+#define MSR_APIC_BASE    0x1B
+#define APIC_BASE_ENABLE (1 << 11)
+
+// IOAPIC registers, through the select/window pair
+#define IOAPIC_SELECT      0x00
+#define IOAPIC_WINDOW      0x10
+#define IOAPIC_ID          0x00
+#define IOAPIC_VERSION     0x01
+#define IOAPIC_REDIRECT(n) (0x10 + 2 * (n))
+
+#define REDIRECT_ACTIVE_LOW (1 << 13)
+#define REDIRECT_LEVEL      (1 << 15)
+#define REDIRECT_MASKED     (1 << 16)
+
+// Interrupt flags as the MADT and the MP table both encode them; 0 in
+// either field means "as the bus does it", edge and active high for ISA
+#define INTI_POLARITY    0x3
+#define INTI_ACTIVE_LOW  0x3
+#define INTI_TRIGGER     0xC
+#define INTI_LEVEL       0xC
+
+// MADT entry types
+#define MADT_IOAPIC   1
+#define MADT_OVERRIDE 2
+
+// MP configuration table entry types
+#define MP_PROCESSOR 0
+#define MP_BUS       1
+#define MP_IOAPIC    2
+#define MP_INTERRUPT 3
+
+// CPUID leaf 1, EDX
+#define CPUID_APIC (1 << 9)
+
+// 10ms against the clock to find the local APIC timer's rate
+#define CALIBRATE_US 10000
+
+#define ISA_IRQS    16
+#define MAX_IOAPICS 4
+
+typedef struct {
+    uint8_t id;
+    uint32_t address;
+    uint32_t gsi_base;  // First global system interrupt it takes
+    uint32_t count;     // Redirection entries
+} IOApic;
+
+static IOApic ioapics[MAX_IOAPICS];
+static uint32_t ioapic_count = 0;
+
+static volatile uint32_t *lapic = NULL;
+static uint32_t lapic_address = 0;
+static uint32_t boot_cpu = 0;  // Local APIC ID everything is sent to
+
+// Where each ISA IRQ comes in, and how, after overrides
+static uint32_t isa_gsi[ISA_IRQS];
+static uint16_t isa_flags[ISA_IRQS];
+
+// MP tables in PIC mode put the IMCR in front of the local APIC
+static int imcr_present = 0;
+
+// Local APIC timer ticks per nanosecond, as a fraction of 2^32
+static uint32_t timer_mult = 0;
+
+uint32_t apic_eoi_register = 0;
+
+static inline void outb(unsigned short port, unsigned char val) {
+    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline unsigned char inb(unsigned short port) {
+    unsigned char ret;
+    __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+}
+
+static uint32_t ioapic_read(const IOApic *io, uint32_t reg) {
+    volatile uint32_t *base = (volatile uint32_t*)io->address;
+    base[IOAPIC_SELECT / 4] = reg;
+    return base[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(const IOApic *io, uint32_t reg, uint32_t value) {
+    volatile uint32_t *base = (volatile uint32_t*)io->address;
+    base[IOAPIC_SELECT / 4] = reg;
+    base[IOAPIC_WINDOW / 4] = value;
+}
+
+/// TABLES
+
+// Memory is identity mapped. The empty asm hides the constant address,
+// which the compiler would otherwise take for an out-of-bounds pointer.
+static const uint8_t* physical(uint32_t address) {
+    const uint8_t *p = (const uint8_t*)address;
+    __asm__("" : "+r"(p));
+    return p;
+}
+
+// Firmware tables are packed, so fields are read a byte at a time
+static uint16_t read16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t read32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int signature(const uint8_t *p, const char *sig) {
+    for (uint32_t i = 0; sig[i]; i++) {
+        if (p[i] != (uint8_t)sig[i]) return 0;
+    }
+    return 1;
+}
+
+static int checksum(const uint8_t *p, uint32_t length) {
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += p[i];
+    }
+    return sum == 0;
+}
+
+// A structure on a 16-byte boundary, by signature and checksum
+static const uint8_t* scan(uint32_t start, uint32_t length, const char *sig, uint32_t size) {
+    for (uint32_t at = start & ~15u; at + size <= start + length; at += 16) {
+        const uint8_t *p = physical(at);
+        if (signature(p, sig) && checksum(p, size)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// The first KB of the EBDA, the last KB of base memory, then the BIOS
+// area; where both the RSDP and the MP floating pointer may be
+static const uint8_t* scan_bios(const char *sig, uint32_t size) {
+    // BIOS data area: the EBDA's segment, then base memory in KB
+    uint32_t ebda = (uint32_t)read16(physical(0x40E)) << 4;
+    uint32_t base_kb = read16(physical(0x413));
+    const uint8_t *p = NULL;
+
+    if (ebda) p = scan(ebda, 1024, sig, size);
+    if (!p && base_kb) p = scan(base_kb * 1024 - 1024, 1024, sig, size);
+    if (!p) p = scan(0xE0000, 0x20000, sig, size);
+    return p;
+}
+
+static void add_ioapic(uint8_t id, uint32_t address, uint32_t gsi_base) {
+    if (ioapic_count == MAX_IOAPICS) return;
+
+    paging_map_uncached(address, 4096);
+    IOApic *io = &ioapics[ioapic_count++];
+    io->id = id;
+    io->address = address;
+    io->gsi_base = gsi_base;
+    io->count = ((ioapic_read(io, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+}
+
+static IOApic* ioapic_by_id(uint8_t id) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        if (ioapics[i].id == id) return &ioapics[i];
+    }
+    return NULL;
+}
+
+static IOApic* ioapic_for(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        IOApic *io = &ioapics[i];
+        if (gsi >= io->gsi_base && gsi - io->gsi_base < io->count) return io;
+    }
+    return NULL;
+}
+
+// RSDP, then the RSDT, then its "APIC" table
+static const uint8_t* acpi_find_madt(void) {
+    const uint8_t *rsdp = scan_bios("RSD PTR ", 20);
+    if (!rsdp) return NULL;
+
+    const uint8_t *rsdt = physical(read32(rsdp + 16));
+    if (!rsdt || !signature(rsdt, "RSDT") || !checksum(rsdt, read32(rsdt + 4))) {
+        return NULL;
+    }
+
+    uint32_t entries = (read32(rsdt + 4) - 36) / 4;
+    for (uint32_t i = 0; i < entries; i++) {
+        const uint8_t *table = physical(read32(rsdt + 36 + i * 4));
+        if (table && signature(table, "APIC") && checksum(table, read32(table + 4))) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+static void parse_madt(const uint8_t *madt) {
+    uint32_t length = read32(madt + 4);
+    lapic_address = read32(madt + 36);
+
+    for (uint32_t at = 44; at + 2 <= length; ) {
+        const uint8_t *entry = madt + at;
+        if (entry[1] < 2) break;
+
+        if (entry[0] == MADT_IOAPIC) {
+            add_ioapic(entry[2], read32(entry + 4), read32(entry + 8));
+        } else if (entry[0] == MADT_OVERRIDE && entry[2] == 0 && entry[3] < ISA_IRQS) {
+            isa_gsi[entry[3]] = read32(entry + 4);
+            isa_flags[entry[3]] = read16(entry + 8);
+        }
+        at += entry[1];
+    }
+}
+
+// MP floating pointer, then its configuration table. IOAPICs there have
+// no interrupt base of their own; they take consecutive ranges in order.
+static int parse_mp(void) {
+    const uint8_t *mp = scan_bios("_MP_", 16);
+    if (!mp) return -1;
+
+    imcr_present = mp[12] & 0x80;
+    const uint8_t *config = physical(read32(mp + 4));
+    if (!config) {
+        // One of the default configurations: fixed addresses, ISA
+        // interrupts straight onto the first pins
+        lapic_address = 0xFEE00000;
+        add_ioapic(0, 0xFEC00000, 0);
+        ioapics[0].id = (ioapic_read(&ioapics[0], IOAPIC_ID) >> 24) & 0x0F;
+        return 0;
+    }
+    if (!signature(config, "PCMP") || !checksum(config, read16(config + 4))) {
+        return -1;
+    }
+
+    lapic_address = read32(config + 0x24);
+    uint32_t count = read16(config + 0x22);
+    uint8_t isa_buses[32] = {0};  // One bit per bus ID
+    uint32_t gsi = 0;
+
+    const uint8_t *entry = config + 0x2C;
+    for (uint32_t i = 0; i < count; i++) {
+        if (entry[0] == MP_BUS && signature(entry + 2, "ISA")) {
+            isa_buses[entry[1] / 8] |= (uint8_t)(1 << (entry[1] % 8));
+        } else if (entry[0] == MP_IOAPIC && (entry[3] & 1)) {
+            add_ioapic(entry[1], read32(entry + 4), gsi);
+            gsi += ioapics[ioapic_count - 1].count;
+        }
+        entry += entry[0] == MP_PROCESSOR ? 20 : 8;
+    }
+
+    // Bus entries come before interrupt entries, but a second pass
+    // doesn't depend on it
+    entry = config + 0x2C;
+    for (uint32_t i = 0; i < count; i++) {
+        if (entry[0] == MP_INTERRUPT && entry[1] == 0 &&
+            (isa_buses[entry[4] / 8] & (1 << (entry[4] % 8))) && entry[5] < ISA_IRQS) {
+            IOApic *io = ioapic_by_id(entry[6]);
+            if (io) {
+                isa_gsi[entry[5]] = io->gsi_base + entry[7];
+                isa_flags[entry[5]] = read16(entry + 2);
+            }
+        }
+        entry += entry[0] == MP_PROCESSOR ? 20 : 8;
+    }
+    return 0;
+}
+
+/// API
+
+int apic_init(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    if (!(d & CPUID_APIC)) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < ISA_IRQS; i++) {
+        isa_gsi[i] = i;
+        isa_flags[i] = 0;
+    }
+    ioapic_count = 0;
+    lapic_address = 0;
+
+    const uint8_t *madt = acpi_find_madt();
+    if (madt) {
+        parse_madt(madt);
+    } else if (parse_mp() != 0) {
+        return -1;
+    }
+    if (!lapic_address || !ioapic_count) {
+        return -1;
+    }
+
+    // Enabled globally (the BIOS normally leaves it so), then in software
+    // with the spurious vector; TPR 0 lets every priority through
+    paging_map_uncached(lapic_address, 4096);
+    lapic = (volatile uint32_t*)lapic_address;
+    wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    boot_cpu = lapic_read(LAPIC_ID) >> 24;
+
+    // Every pin masked until something routes to it
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        for (uint32_t pin = 0; pin < ioapics[i].count; pin++) {
+            ioapic_write(&ioapics[i], IOAPIC_REDIRECT(pin), REDIRECT_MASKED);
+        }
+    }
+
+    // The 8259s stay remapped, so anything spurious from them lands on
+    // the IRQ vectors, but masked; the IMCR takes them off the LINT0 path
+    outb(0x21, 0xFF);
+    outb(0xA1, 0xFF);
+
+    // An interrupt they took but never saw acknowledged would hold back
+    // everything of lower priority if they were ever used again; OCW3
+    // 0x0B reads the in-service register
+    outb(0xA0, 0x0B);
+    if (inb(0xA0)) outb(0xA0, 0x20);
+    outb(0x20, 0x0B);
+    if (inb(0x20)) outb(0x20, 0x20);
+    if (imcr_present) {
+        outb(0x22, 0x70);
+        outb(0x23, 0x01);
+    }
+
+    apic_eoi_register = lapic_address + LAPIC_EOI;
+
+    // Timer and keyboard, on the vectors pic_init gave them
+    apic_route_irq(0, 0x20);
+    apic_route_irq(1, 0x21);
+
+    // The IOAPIC pin is edge-triggered, and a scancode that came in under
+    // the 8259 keeps IRQ1 high, so no edge would ever come again. Empty
+    // the controller's output buffer so the next byte raises a fresh one.
+    while (inb(0x64) & 0x01) {
+        inb(0x60);
+    }
+    return 0;
+}
+
+// An ISA IRQ (or a global system interrupt past them) to vector on the
+// boot CPU, fixed delivery, physical destination
+void apic_route_irq(uint8_t irq, uint8_t vector) {
+    uint32_t gsi = irq < ISA_IRQS ? isa_gsi[irq] : irq;
+    uint16_t flags = irq < ISA_IRQS ? isa_flags[irq] : 0;
+    IOApic *io = ioapic_for(gsi);
+    if (!io) return;
+
+    uint32_t low = vector;
+    if ((flags & INTI_POLARITY) == INTI_ACTIVE_LOW) low |= REDIRECT_ACTIVE_LOW;
+    if ((flags & INTI_TRIGGER) == INTI_LEVEL) low |= REDIRECT_LEVEL;
+
+    uint32_t pin = gsi - io->gsi_base;
+    ioapic_write(io, IOAPIC_REDIRECT(pin) + 1, boot_cpu << 24);
+    ioapic_write(io, IOAPIC_REDIRECT(pin), low);
+}
+
+int apic_timer_init(uint8_t vector) {
+    if (!lapic || !clock_hz()) {
+        return -1;
+    }
+
+    // Count down from the top for a while, masked
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | vector);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    udelay(CALIBRATE_US);
+    uint32_t ticks = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    // Under one tick per nanosecond, or the fraction doesn't fit
+    if (!ticks || ticks >= CALIBRATE_US * 1000) {
+        return -1;
+    }
+
+    // Rounded up, so the interrupt never comes early
+    timer_mult = (uint32_t)clock_div64((uint64_t)ticks << 32, CALIBRATE_US * 1000) + 1;
+    lapic_write(LAPIC_LVT_TIMER, vector);  // One-shot, unmasked
+    return 0;
+}
+
+void apic_timer_oneshot(uint32_t ns) {
+    if (ns > APIC_TIMER_MAX_NS) ns = APIC_TIMER_MAX_NS;
+    uint32_t ticks = ns ? (uint32_t)(((uint64_t)ns * timer_mult) >> 32) + 1 : 0;
+    lapic_write(LAPIC_TIMER_INITIAL, ticks);
+}
@@ -0,0 +1,38 @@
+/*
+ * @file apic.h
+ * @version 0.0.1
+ * Local APIC and IOAPIC interrupt delivery
+ *
+ * apic_init finds the interrupt controllers in the ACPI MADT, or failing
+ * that the MP configuration table, routes the ISA interrupts the kernel
+ * handles through the IOAPIC to the boot CPU, and masks the 8259s. From
+ * then on the IRQ stubs acknowledge with a write to the local APIC's EOI
+ * register rather than the 8259's port. Without an APIC, or without
+ * tables describing one, nothing changes and the 8259 stays in charge.
+ */
+
+#ifndef APIC_H
+#define APIC_H
+
+typedef unsigned char uint8_t;
+typedef unsigned short uint16_t;
+typedef unsigned int uint32_t;
+
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+// Longest one-shot apic_timer_oneshot takes
+#define APIC_TIMER_MAX_NS 1000000000u
+
+// Address of the local APIC's EOI register, or 0 while the 8259 is used;
+// read by the IRQ stubs in interrupts.asm
+extern uint32_t apic_eoi_register;
+
+int apic_init(void);  // 0, or -1 if the 8259 stays in charge
+void apic_route_irq(uint8_t irq, uint8_t vector);
+
+// The local APIC timer, one-shot on the timer's vector. Calibrated
+// against the clock, so it needs clock_init first.
+int apic_timer_init(uint8_t vector);  // 0, or -1 without a local APIC or clock
+void apic_timer_oneshot(uint32_t ns); // 0 stops it
+
+#endif // APIC_H
@@ -1,6 +1,10 @@
 [BITS 16]
 [ORG 0x7C00]
 
+KERNEL_SEGMENT equ 0x1000   ; Loaded straight to 0x10000, where it is linked
+KERNEL_MAX     equ 896      ; Sectors up to 0x80000, short of the stack
+LBA_CHUNK      equ 64       ; 32KB per read, so none crosses a 64KB boundary
+
 start:
     ; Setup segments and stack
     xor ax, ax
@@ -8,16 +12,106 @@ start:
     mov es, ax
     mov ss, ax
     mov sp, 0x7C00
-
-    ; Load kernel to 0x1000 (50 sectors starting at sector 2)
-    mov ah, 0x02            ; BIOS read
-    mov al, 50              ; Sector count (INCREASED)
-    mov ch, 0               ; Cylinder 0
-    mov cl, 2               ; Start sector 2
-    mov dh, 0               ; Head 0
-    mov bx, 0x1000          ; Load address
+    mov [boot_drive], dl
+    cmp word [kernel_sectors], KERNEL_MAX
+    ja error
+
+    ; Load kernel_sectors sectors from sector 2 (LBA 1). With the EDD
+    ; extensions by LBA in chunks, otherwise a sector at a time by CHS
+    ; with the drive's geometry, so track boundaries don't matter.
+    mov ah, 0x41
+    mov bx, 0x55AA
+    int 0x13
+    jc chs
+    cmp bx, 0xAA55
+    jne chs
+    test cl, 1              ; Packet interface
+    jz chs
+
+lba:
+    mov cx, [kernel_sectors]
+.next:
+    test cx, cx
+    jz loaded
+    mov ax, LBA_CHUNK
+    cmp cx, ax
+    jae .read
+    mov ax, cx
+.read:
+    mov [dap_count], ax
+    push cx
+    mov ah, 0x42
+    mov dl, [boot_drive]
+    mov si, dap
+    int 0x13
+    pop cx
+    jc error
+    mov ax, [dap_count]
+    sub cx, ax
+    add [dap_lba], ax
+    add word [dap_segment], LBA_CHUNK * 512 / 16
+    jmp .next
+
+chs:
+    mov ah, 0x08            ; Geometry
+    mov dl, [boot_drive]
+    xor di, di
     int 0x13
+    jc error
+    and cx, 0x3F
+    mov [sectors_per_track], cx
+    mov dl, dh
+    xor dh, dh
+    inc dx
+    mov [heads], dx
+    mov si, 1               ; LBA of the next sector
+.next:
+    cmp si, [kernel_sectors]
+    ja loaded
+    mov ax, si
+    xor dx, dx
+    div word [sectors_per_track]
+    mov cl, dl
+    inc cl                  ; Sector, from 1
+    xor dx, dx
+    div word [heads]        ; Cylinder in ax, head in dx
+    mov ch, al
+    shl ah, 6               ; Cylinder bits 8-9 go in bits 6-7 of cl
+    or cl, ah
+    mov dh, dl
+    mov dl, [boot_drive]
+    mov es, [dap_segment]
+    xor bx, bx
+    mov di, 3               ; Tries; floppies may need the motor to spin up
+.read:
+    mov ax, 0x0201
+    int 0x13
+    jnc .done
+    xor ah, ah              ; Reset the drive and go again
+    int 0x13
+    dec di
+    jnz .read
+    jmp error
+.done:
+    inc si
+    add word [dap_segment], 512 / 16
+    jmp .next
+
+error:
+    mov si, load_error
+.print:
+    lodsb
+    test al, al
+    jz .halt
+    mov ah, 0x0E
+    int 0x10
+    jmp .print
+.halt:
+    cli
+    hlt
+    jmp .halt
 
+loaded:
     ; Enter protected mode
     cli
     lgdt [gdt_desc]
@@ -35,12 +129,6 @@ pm:
     mov ss, ax
     mov esp, 0x90000
 
-    ; Copy kernel from 0x1000 to 0x10000
-    mov esi, 0x1000
-    mov edi, 0x10000
-    mov ecx, 6400           ; 50*512/4 dwords (INCREASED)
-    rep movsd
-
     jmp 0x10000
 
 [BITS 16]
@@ -54,7 +142,27 @@ gdt_desc:
     dw $ - gdt - 1
     dd gdt
 
-times 510-($-$$) db 0
+; Disk address packet for int 13h AH=42h
+dap:
+    db 16, 0
+dap_count:
+    dw 0
+dap_offset:
+    dw 0
+dap_segment:
+    dw KERNEL_SEGMENT
+dap_lba:
+    dq 1
+
+boot_drive:        db 0
+sectors_per_track: dw 0
+heads:             dw 0
+load_error:        db "Kernel load failed", 0
+
+; Patched in by the build with kernel.bin's size in sectors
+times 508-($-$$) db 0
+kernel_sectors:
+    dw 0
 dw 0xAA55
 
 ;; [BITS 16]
@@ -0,0 +1,153 @@
+/*
+ * @file clock.c
+ * @version 0.0.2
+ * Monotonic clock from the TSC, calibrated against PIT channel 2
+ */
+
+#include "clock.h"
+
+#define PIT_HZ 1193182
+
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND  0x43
+#define PIT_GATE     0x61   // Bit 0 gates channel 2, bit 1 drives the speaker
+#define PIT_OUT2     0x20   // Channel 2's output, read back through port 0x61
+
+// Channel 2, low then high byte, mode 0 (one-shot), binary
+#define PIT_ONESHOT2 0xB0
+
+// 20ms per calibration run; the shortest of a few wins, since anything
+// that gets in the way (an SMI, a slow emulated port) only adds cycles
+#define CALIBRATE_US   20000
+#define CALIBRATE_RUNS 3
+
+// CPUID leaf 1, EDX
+#define CPUID_TSC (1 << 4)
+
+static uint64_t tsc_hz = 0;
+static uint64_t tsc_boot = 0;
+
+// ns = cycles * mult >> shift, with mult fitting in 32 bits; shift goes
+// past 32 only for a TSC faster than 4GHz
+static uint32_t ns_mult = 0;
+static uint32_t ns_shift = 0;
+
+static inline void outb(unsigned short port, unsigned char val) {
+    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline unsigned char inb(unsigned short port) {
+    unsigned char ret;
+    __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t clock_div64(uint64_t n, uint32_t d) {
+    uint32_t hi = (uint32_t)(n >> 32);
+    uint32_t lo = (uint32_t)n;
+    uint32_t q_hi = hi / d;
+    uint32_t r = hi % d;
+    uint32_t q_lo;
+    __asm__("divl %2" : "=a"(q_lo), "+d"(r) : "rm"(d), "a"(lo));
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+// PIT ticks in us microseconds, for us up to 54925 (a 16-bit count)
+static uint32_t pit_ticks(uint32_t us) {
+    uint32_t ticks = (uint32_t)clock_div64((uint64_t)us * PIT_HZ, 1000000);
+    return ticks ? ticks : 1;
+}
+
+// Count ticks down on channel 2 and wait for its output to go high
+static void pit_wait(uint32_t ticks) {
+    outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);
+    outb(PIT_COMMAND, PIT_ONESHOT2);
+    outb(PIT_CHANNEL2, ticks & 0xFF);
+    outb(PIT_CHANNEL2, (ticks >> 8) & 0xFF);
+    while (!(inb(PIT_GATE) & PIT_OUT2)) {
+        __asm__ volatile("pause");
+    }
+}
+
+int clock_init(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    if (!(d & CPUID_TSC)) {
+        return -1;
+    }
+
+    uint32_t ticks = pit_ticks(CALIBRATE_US);
+    uint64_t best = ~0ull;
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        uint64_t start = rdtsc();
+        pit_wait(ticks);
+        uint64_t cycles = rdtsc() - start;
+        if (cycles < best) best = cycles;
+    }
+    tsc_hz = clock_div64(best * PIT_HZ, ticks);
+
+    // The largest shift whose multiplier still fits gives the most
+    // precision; 10^9 << 32 still fits in 64 bits. A frequency past 32
+    // bits is divided down first, and the shift makes up for it.
+    uint32_t extra = 0;
+    while (tsc_hz >> extra > 0xFFFFFFFFull) extra++;
+    uint32_t hz = (uint32_t)(tsc_hz >> extra);
+    ns_shift = 32;
+    while (ns_shift > 0 && clock_div64(1000000000ull << ns_shift, hz) > 0xFFFFFFFFull) {
+        ns_shift--;
+    }
+    ns_mult = (uint32_t)clock_div64(1000000000ull << ns_shift, hz);
+    ns_shift += extra;
+
+    tsc_boot = rdtsc();
+    return 0;
+}
+
+uint64_t clock_hz(void) {
+    return tsc_hz;
+}
+
+uint64_t clock_cycles(void) {
+    return tsc_hz ? rdtsc() : 0;
+}
+
+uint64_t clock_ns(void) {
+    if (!tsc_hz) {
+        return 0;
+    }
+
+    // The 96-bit product, shifted, from two 32x32 multiplies
+    uint64_t cycles = rdtsc() - tsc_boot;
+    uint64_t high = (uint64_t)(uint32_t)(cycles >> 32) * ns_mult;
+    uint64_t low = (uint64_t)(uint32_t)cycles * ns_mult;
+    if (ns_shift >= 32) {
+        return (high + (low >> 32)) >> (ns_shift - 32);
+    }
+    return (high << (32 - ns_shift)) + (low >> ns_shift);
+}
+
+void udelay(uint32_t us) {
+    if (tsc_hz) {
+        uint64_t end = clock_ns() + (uint64_t)us * 1000;
+        while (clock_ns() < end) {
+            __asm__ volatile("pause");
+        }
+        return;
+    }
+
+    while (us) {
+        uint32_t step = us > 50000 ? 50000 : us;
+        pit_wait(pit_ticks(step));
+        us -= step;
+    }
+}
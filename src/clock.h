@@ -0,0 +1,33 @@
+/*
+ * @file clock.h
+ * @version 0.0.3
+ * Monotonic clock from the TSC, calibrated against PIT channel 2
+ *
+ * clock_init counts TSC cycles across a fixed number of PIT ticks on
+ * channel 2, which has its own gate and leaves the channel 0 interrupt
+ * alone. After that clock_ns is a cycle count since boot scaled by a
+ * 32-bit multiplier, so reading it costs one rdtsc and two multiplies.
+ * Without a TSC the clock stays at 0 and udelay polls the PIT instead.
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#if __STDC_HOSTED__
+#include <stdint.h>  // monad.c is built on the host too
+#else
+typedef unsigned int uint32_t;
+typedef unsigned long long uint64_t;
+#endif
+
+int clock_init(void);           // 0, or -1 if the CPU has no TSC
+uint64_t clock_hz(void);        // TSC frequency; 0 before clock_init
+uint64_t clock_cycles(void);    // Raw TSC
+uint64_t clock_ns(void);        // Nanoseconds since clock_init
+void udelay(uint32_t us);       // Busy-wait at least us microseconds
+
+// 64 by 32 bit division in two divl steps; there is no libgcc for the
+// compiler's own 64-bit division
+uint64_t clock_div64(uint64_t n, uint32_t d);
+
+#endif // CLOCK_H
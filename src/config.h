@@ -0,0 +1,17 @@
+/*
+ * @file config.h
+ * @version 0.0.1
+ * Build-time kernel configuration
+ *
+ * Set from meson options (meson configure -Dframebuffer=true); the
+ * defaults here are for a build without them.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#ifndef USE_FRAMEBUFFER
+#define USE_FRAMEBUFFER 0  // 0 = VGA text mode, 1 = VESA framebuffer
+#endif
+
+#endif // CONFIG_H
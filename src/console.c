@@ -0,0 +1,221 @@
+/*
+ * @file console.c
+ * @version 0.0.2
+ * Buffered VGA text console
+ */
+
+#include "console.h"
+#include "cursor.h"
+
+#define HISTORY_MASK (CONSOLE_HISTORY - 1)
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+// Ring of rows; screen line y is history[(top + y) & HISTORY_MASK].
+// VGA memory catches up on flush.
+static uint16_t history[CONSOLE_HISTORY][VGA_WIDTH];
+static uint32_t top = 0;        // Rows scrolled off so far
+
+// Changed columns per screen line, [dirty_start, dirty_end); clean when
+// start >= end. Spans move up with their lines when the console scrolls.
+static uint8_t dirty_start[VGA_HEIGHT];
+static uint8_t dirty_end[VGA_HEIGHT];
+
+static uint32_t pending_scroll = 0;  // Lines scrolled since the last flush
+static uint32_t view = 0;            // Lines paged back, 0 shows the live screen
+static int view_changed = 0;
+
+uint32_t console_origin = 0;
+
+static uint8_t console_color = VGA_COLOR_WHITE | (VGA_COLOR_BLACK << 4);
+
+static inline uint16_t *line(uint32_t y) {
+    return history[(top + y) & HISTORY_MASK];
+}
+
+static void mark_dirty(uint32_t y, uint32_t x0, uint32_t x1) {
+    if (x0 < dirty_start[y]) dirty_start[y] = (uint8_t)x0;
+    if (x1 > dirty_end[y]) dirty_end[y] = (uint8_t)x1;
+}
+
+static void mark_all_dirty(void) {
+    for (uint32_t y = 0; y < VGA_HEIGHT; y++) {
+        dirty_start[y] = 0;
+        dirty_end[y] = VGA_WIDTH;
+    }
+}
+
+static void blank_line(uint16_t *row) {
+    uint16_t blank = vga_entry(' ', console_color);
+    for (uint32_t x = 0; x < VGA_WIDTH; x++) {
+        row[x] = blank;
+    }
+}
+
+// The flush and the blink timer both touch the cell under the cursor
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    if (flags & 0x200) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+static void set_start_address(uint32_t cell) {
+    outb(0x3D4, 0x0C);
+    outb(0x3D5, (uint8_t)(cell >> 8));
+    outb(0x3D4, 0x0D);
+    outb(0x3D5, (uint8_t)cell);
+}
+
+void console_init(void) {
+    top = 0;
+    pending_scroll = 0;
+    view = 0;
+    console_origin = 0;
+    set_start_address(0);
+    console_clear();
+}
+
+void console_clear(void) {
+    for (uint32_t y = 0; y < VGA_HEIGHT; y++) {
+        blank_line(line(y));
+    }
+    mark_all_dirty();
+}
+
+void console_scroll(void) {
+    top++;
+    blank_line(line(VGA_HEIGHT - 1));
+
+    for (uint32_t y = 0; y + 1 < VGA_HEIGHT; y++) {
+        dirty_start[y] = dirty_start[y + 1];
+        dirty_end[y] = dirty_end[y + 1];
+    }
+    dirty_start[VGA_HEIGHT - 1] = 0;
+    dirty_end[VGA_HEIGHT - 1] = VGA_WIDTH;
+
+    pending_scroll++;
+}
+
+void console_put_at(char c, uint8_t color, uint32_t x, uint32_t y) {
+    // Output always shows the live screen
+    if (view) console_page(-(int)view);
+
+    line(y)[x] = vga_entry(c, color);
+    mark_dirty(y, x, x + 1);
+}
+
+static void newline(void) {
+    cursor_x = 0;
+    cursor_y++;
+    if (cursor_y >= VGA_HEIGHT) {
+        cursor_y = VGA_HEIGHT - 1;
+        console_scroll();
+    }
+}
+
+void console_putchar(char c) {
+    if (c == '\n') {
+        newline();
+        return;
+    }
+
+    if (c == '\b') {
+        if (cursor_x > 0) {
+            cursor_x--;
+            console_put_at(' ', console_color, cursor_x, cursor_y);
+        }
+        return;
+    }
+
+    console_put_at(c, console_color, cursor_x, cursor_y);
+    cursor_x++;
+    if (cursor_x >= VGA_WIDTH) {
+        newline();
+    }
+}
+
+void console_page(int rows) {
+    // Rows above the screen that are still in the ring
+    uint32_t kept = top < CONSOLE_HISTORY - VGA_HEIGHT ? top : CONSOLE_HISTORY - VGA_HEIGHT;
+
+    int target = (int)view + rows;
+    if (target < 0) target = 0;
+    if ((uint32_t)target > kept) target = (int)kept;
+
+    if ((uint32_t)target != view) {
+        view = (uint32_t)target;
+        view_changed = 1;
+    }
+}
+
+void console_flush(void) {
+    uint32_t flags = irq_save();
+
+    // Put back the cell under the cursor while the origin is still the
+    // one it was saved at; the dirty spans then overwrite it if it changed
+    cursor_restore_char();
+
+    // A scroll is a start address change; at the end of the text window
+    // the screen starts over at the top and is drawn in full
+    if (pending_scroll) {
+        console_origin += pending_scroll * VGA_WIDTH;
+        if (console_origin + VGA_HEIGHT * VGA_WIDTH > VGA_TEXT_ROWS * VGA_WIDTH) {
+            console_origin = 0;
+            mark_all_dirty();
+        }
+        set_start_address(console_origin);
+        pending_scroll = 0;
+    }
+
+    uint16_t *screen = VGA_MEMORY + console_origin;
+
+    if (view) {
+        // Paged back: draw the old lines over the screen, no cursor
+        if (view_changed) {
+            for (uint32_t y = 0; y < VGA_HEIGHT; y++) {
+                const uint16_t *row = history[(top - view + y) & HISTORY_MASK];
+                for (uint32_t x = 0; x < VGA_WIDTH; x++) {
+                    screen[y * VGA_WIDTH + x] = row[x];
+                }
+            }
+            mark_all_dirty();  // For the way back
+            view_changed = 0;
+        }
+        cursor_hide();
+        irq_restore(flags);
+        return;
+    }
+
+    // Back from the scrollback: the whole screen is redrawn, then the
+    // cursor comes back over the new cells
+    int returning = view_changed;
+    if (returning) {
+        mark_all_dirty();
+        view_changed = 0;
+    }
+
+    for (uint32_t y = 0; y < VGA_HEIGHT; y++) {
+        const uint16_t *row = line(y);
+        uint32_t end = dirty_end[y];
+        for (uint32_t x = dirty_start[y]; x < end; x++) {
+            screen[y * VGA_WIDTH + x] = row[x];
+        }
+        dirty_start[y] = VGA_WIDTH;
+        dirty_end[y] = 0;
+    }
+
+    if (returning) {
+        cursor_show();
+    } else {
+        cursor_reset_blink();
+    }
+    irq_restore(flags);
+}
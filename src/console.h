@@ -0,0 +1,37 @@
+/*
+ * @file console.h
+ * @version 0.0.2
+ * Buffered VGA text console
+ *
+ * Writes go to rows in RAM at the cursor position, and scrolling happens
+ * there too. console_flush copies only the spans that changed to VGA
+ * memory and redraws the cursor once, so printing a long result costs one
+ * pass over the screen at most.
+ *
+ * The 32KB text window holds VGA_TEXT_ROWS rows. The screen shows
+ * VGA_HEIGHT of them from the CRTC start address, so scrolling moves the
+ * start address down a row instead of copying the screen; only when it
+ * reaches the end of the window is the screen redrawn at the top. Rows
+ * that scroll off stay in RAM and can be paged back with console_page.
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "vga.h"
+
+#define CONSOLE_HISTORY 1024                      // Rows kept in RAM, power of two
+#define VGA_TEXT_ROWS   (0x8000 / 2 / VGA_WIDTH)  // 204 rows in the text window
+
+// First VGA memory cell shown on screen
+extern uint32_t console_origin;
+
+void console_init(void);
+void console_clear(void);
+void console_scroll(void);
+void console_putchar(char c);
+void console_put_at(char c, uint8_t color, uint32_t x, uint32_t y);
+void console_page(int rows);  // Positive pages back through the scrollback
+void console_flush(void);
+
+#endif // CONSOLE_H
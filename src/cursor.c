@@ -1,32 +1,50 @@
 /*
  * @file cursor.c
- * @version 0.0.3
- * Software cursor with blinking
+ * @version 0.0.5
+ * Text cursor with blinking
  */
 
 #include "cursor.h"
+#include "console.h"
+#include "timer.h"
 
 // Port I/O
 static inline void outb(uint16_t port, uint8_t val) {
     __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
 }
 
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+// CRTC registers
+#define CRTC_INDEX          0x3D4
+#define CRTC_DATA           0x3D5
+#define CRTC_MAX_SCAN_LINE  0x09
+#define CRTC_CURSOR_START   0x0A  // Bit 5 turns the cursor off
+#define CRTC_CURSOR_END     0x0B
+#define CRTC_CURSOR_HIGH    0x0E
+#define CRTC_CURSOR_LOW     0x0F
+#define CURSOR_DISABLE      0x20
+
 // Global cursor position
 uint32_t cursor_x = 0;
 uint32_t cursor_y = 0;
 
 // Cursor state
+static CursorBackend backend = CURSOR_HARDWARE;
 static CursorStyle current_style = CURSOR_BLOCK;
 static int cursor_visible = 1;
 static int cursor_blink_visible = 1;
 
-// Blink timing: 500ms visible, 500ms hidden (assuming ~18.2 Hz timer)
-// At 18.2 Hz, 500ms ≈ 9 ticks
-#define BLINK_TICKS 9
+// Blink timing: 500ms visible, 500ms hidden
+#define BLINK_NS 500000000ull
 
-// Blink counter and limits
+// Blink timer and limits; the timer is only pending while blinking
+static Timer blink_timer;
 static uint32_t blink_count = 0;          // Number of complete blinks so far
-static uint32_t blink_tick_counter = 0;   // Ticks since last blink toggle
 static uint32_t blink_toggle_count = 0;   // Number of state toggles (2 toggles = 1 complete blink)
 static int blink_cursor_mode = 1;
 static int blink_cursor_blinks = 10;
@@ -37,10 +55,53 @@ static uint32_t saved_x = 0;
 static uint32_t saved_y = 0;
 static int char_saved = 0;
 
+// What the CRTC was last given, so unchanged values are not written again
+static uint32_t hardware_position = 0xFFFFFFFF;
+static uint8_t hardware_start = 0xFF;
+static uint8_t hardware_end = 0xFF;
+static uint8_t cell_last_line = 15;  // Scan lines per character cell, less one
+
+static uint8_t crtc_read(uint8_t index) {
+    outb(CRTC_INDEX, index);
+    return inb(CRTC_DATA);
+}
+
+static void crtc_write(uint8_t index, uint8_t value) {
+    outb(CRTC_INDEX, index);
+    outb(CRTC_DATA, value);
+}
+
+// Shape and position for the adapter, as port writes only when they change
+static void hardware_update(void) {
+    uint8_t start = current_style == CURSOR_UNDERLINE ? cell_last_line - 1 : 0;
+    uint8_t end = cell_last_line;
+    if (!cursor_visible || current_style == CURSOR_HIDDEN) {
+        start = CURSOR_DISABLE;
+    }
+
+    if (start != hardware_start) {
+        crtc_write(CRTC_CURSOR_START, (crtc_read(CRTC_CURSOR_START) & 0xC0) | start);
+        hardware_start = start;
+    }
+    if (end != hardware_end) {
+        crtc_write(CRTC_CURSOR_END, (crtc_read(CRTC_CURSOR_END) & 0xE0) | end);
+        hardware_end = end;
+    }
+
+    uint32_t position = console_origin + cursor_y * VGA_WIDTH + cursor_x;
+    if (position != hardware_position) {
+        crtc_write(CRTC_CURSOR_HIGH, (uint8_t)(position >> 8));
+        crtc_write(CRTC_CURSOR_LOW, (uint8_t)position);
+        hardware_position = position;
+    }
+}
+
+static void cursor_blink(void *data);
+
 // Restore character at saved position
 static void restore_saved_char(void) {
     if (char_saved) {
-        uint32_t pos = saved_y * VGA_WIDTH + saved_x;
+        uint32_t pos = console_origin + saved_y * VGA_WIDTH + saved_x;
         VGA_MEMORY[pos] = saved_char;
         char_saved = 0;
     }
@@ -51,16 +112,31 @@ void cursor_init(void) {
     cursor_y = 0;
     char_saved = 0;
     cursor_blink_visible = 1;
-    blink_tick_counter = 0;
     blink_count = 0;
 
-    // Disable hardware cursor
-    outb(0x3D4, 0x0A);
-    outb(0x3D5, 0x20);  // Bit 5 = disable cursor
+    hardware_position = 0xFFFFFFFF;
+    hardware_start = 0xFF;
+    hardware_end = 0xFF;
+    cell_last_line = crtc_read(CRTC_MAX_SCAN_LINE) & 0x1F;
 
+    cursor_set_backend(backend);
     cursor_set_style(CURSOR_BLOCK);
 }
 
+void cursor_set_backend(CursorBackend b) {
+    restore_saved_char();
+    backend = b;
+
+    if (backend == CURSOR_SOFTWARE) {
+        // Disable hardware cursor
+        crtc_write(CRTC_CURSOR_START, CURSOR_DISABLE);
+        hardware_start = 0xFF;
+    } else {
+        timer_cancel(&blink_timer);
+    }
+    cursor_reset_blink();
+}
+
 void cursor_set_position(uint32_t x, uint32_t y) {
     // Restore character at old position
     restore_saved_char();
@@ -106,14 +182,29 @@ void cursor_set_style(CursorStyle style) {
 }
 
 void cursor_reset_blink(void) {
-    blink_tick_counter = 0;
+    if (backend == CURSOR_HARDWARE) {
+        // The adapter keeps its own blink phase
+        cursor_update();
+        return;
+    }
+
     blink_toggle_count = 0;       // Reset toggle count on keypress (Emacs behavior)
     cursor_blink_visible = 1;     // Show cursor immediately
     cursor_update();
+
+    // A full half period visible before the first toggle
+    if (blink_cursor_mode) {
+        timer_after(&blink_timer, BLINK_NS, cursor_blink, 0);
+    }
 }
 
 void cursor_update(void) {
-    uint32_t pos = cursor_y * VGA_WIDTH + cursor_x;
+    if (backend == CURSOR_HARDWARE) {
+        hardware_update();
+        return;
+    }
+
+    uint32_t pos = console_origin + cursor_y * VGA_WIDTH + cursor_x;
 
     if (!cursor_visible || current_style == CURSOR_HIDDEN) {
         // Restore character if hidden
@@ -149,7 +240,10 @@ void cursor_update(void) {
     }
 }
 
-void cursor_tick(void) {
+// Blink timer callback, every BLINK_NS while blinking
+static void cursor_blink(void *data) {
+    (void)data;
+    if (backend == CURSOR_HARDWARE) return;  // The adapter blinks it
     if (!cursor_visible || current_style == CURSOR_HIDDEN) return;
 
     // Check if blinking is disabled
@@ -164,7 +258,7 @@ void cursor_tick(void) {
 
     // Check if we've exceeded max blinks (0 = infinite)
     // One complete blink = 2 toggles (visible->hidden->visible)
-    if (blink_cursor_blinks > 0 && blink_toggle_count >= (blink_cursor_blinks * 2)) {
+    if (blink_cursor_blinks > 0 && blink_toggle_count >= (uint32_t)blink_cursor_blinks * 2) {
         // Stop blinking, keep cursor visible
         if (!cursor_blink_visible) {
             cursor_blink_visible = 1;
@@ -173,13 +267,10 @@ void cursor_tick(void) {
         return;
     }
 
-    blink_tick_counter++;
-    if (blink_tick_counter >= BLINK_TICKS) {
-        blink_tick_counter = 0;
-        cursor_blink_visible = !cursor_blink_visible;
-        blink_toggle_count++;  // Count each state change
-        cursor_update();
-    }
+    cursor_blink_visible = !cursor_blink_visible;
+    blink_toggle_count++;  // Count each state change
+    cursor_update();
+    timer_after(&blink_timer, BLINK_NS, cursor_blink, 0);
 }
 
 void cursor_show(void) {
@@ -192,6 +283,10 @@ void cursor_hide(void) {
     // Restore character before hiding
     restore_saved_char();
     cursor_visible = 0;
+    timer_cancel(&blink_timer);
+    if (backend == CURSOR_HARDWARE) {
+        hardware_update();
+    }
 }
 
 void cursor_restore_char(void) {
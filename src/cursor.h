@@ -1,7 +1,13 @@
 /*
  * @file cursor.h
- * @version 0.0.3
- * Software cursor with blinking
+ * @version 0.0.5
+ * Text cursor with blinking
+ *
+ * The hardware backend (the default) hands position and shape to the VGA
+ * CRTC and lets the adapter blink the cursor, so drawing never touches
+ * the cell under it and no timer is needed. The software backend inverts
+ * that cell instead and blinks it from a 500ms timer, which also lets it
+ * stop blinking after a while and restart on every flush.
  */
 
 #ifndef CURSOR_H
@@ -15,10 +21,16 @@ typedef enum {
     CURSOR_HIDDEN
 } CursorStyle;
 
+typedef enum {
+    CURSOR_HARDWARE,
+    CURSOR_SOFTWARE
+} CursorBackend;
+
 extern uint32_t cursor_x;
 extern uint32_t cursor_y;
 
 void cursor_init(void);
+void cursor_set_backend(CursorBackend backend);
 void cursor_set_position(uint32_t x, uint32_t y);
 void cursor_get_position(uint32_t *x, uint32_t *y);
 void cursor_move(int dx, int dy);
@@ -26,7 +38,6 @@ void cursor_set_style(CursorStyle style);
 void cursor_show(void);
 void cursor_hide(void);
 void cursor_reset_blink(void);
-void cursor_tick(void);
 void cursor_update(void);
 void cursor_restore_char(void);
 
@@ -1,16 +1,17 @@
 /*
  * @file font.c
- * @version 0.0.2
+ * @version 0.0.6
  * Font rendering implementation
  */
 
+#include "config.h"
 #include "font.h"
+#include "font_outline.h"
 
 #ifndef NULL
 #define NULL ((void*)0)
 #endif
 
-#ifdef USE_FRAMEBUFFER
 #if USE_FRAMEBUFFER
 
 // Only compile font code when framebuffer is enabled
@@ -30,12 +31,142 @@ static void* font_malloc(uint32_t size) {
     return ptr;
 }
 
+/// GLYPH ATLAS
+
+// Coverage masks of every loaded size, packed in shelves: rows of glyphs
+// of about the same height, each filled left to right
+static uint8_t *atlas = NULL;
+
+typedef struct {
+    uint16_t y;
+    uint16_t height;
+    uint16_t used;
+} Shelf;
+
+#define MAX_SHELVES 64
+
+static Shelf shelves[MAX_SHELVES];
+static uint32_t shelf_count = 0;
+static uint32_t atlas_bottom = 0;
+
+static Font *loaded[FONT_MAX_LOADED];
+static uint32_t loaded_count = 0;
+
+// Empty the atlas; every glyph gets rasterized again when next drawn
+static void atlas_reset(void) {
+    shelf_count = 0;
+    atlas_bottom = 0;
+    for (uint32_t i = 0; i < loaded_count; i++) {
+        for (uint32_t c = 0; c < 256; c++) {
+            loaded[i]->glyph_cache[c].advance = 0;
+        }
+        loaded[i]->cache_size = 0;
+    }
+}
+
+// Room for a width x height mask: on the lowest shelf it fits, or a new one
+static uint8_t* atlas_alloc(uint32_t width, uint32_t height) {
+    Shelf *best = NULL;
+    for (uint32_t i = 0; i < shelf_count; i++) {
+        Shelf *s = &shelves[i];
+        if (s->height >= height && s->height <= height + height / 4 + 1 &&
+            (uint32_t)(FONT_ATLAS_WIDTH - s->used) >= width && (!best || s->height < best->height)) {
+            best = s;
+        }
+    }
+
+    if (!best) {
+        if (shelf_count == MAX_SHELVES || atlas_bottom + height > FONT_ATLAS_HEIGHT) {
+            return NULL;
+        }
+        best = &shelves[shelf_count++];
+        best->y = (uint16_t)atlas_bottom;
+        best->height = (uint16_t)height;
+        best->used = 0;
+        atlas_bottom += height;
+    }
+
+    uint8_t *mask = atlas + best->y * FONT_ATLAS_WIDTH + best->used;
+    best->used = (uint16_t)(best->used + width);
+    return mask;
+}
+
 int font_init(void) {
     font_memory_offset = 0;
     default_font = NULL;
+    atlas = NULL;
+    loaded_count = 0;
+    atlas_reset();
     return 0;
 }
 
+// Same size, same font, so glyphs are cached by (character, size)
+Font* font_load_outline(uint32_t font_size) {
+    if (font_size < OUTLINE_MIN_SIZE) font_size = OUTLINE_MIN_SIZE;
+    if (font_size > OUTLINE_MAX_SIZE) font_size = OUTLINE_MAX_SIZE;
+
+    for (uint32_t i = 0; i < loaded_count; i++) {
+        if (loaded[i]->font_size == font_size) {
+            return loaded[i];
+        }
+    }
+
+    if (!atlas) {
+        atlas = font_malloc(FONT_ATLAS_WIDTH * FONT_ATLAS_HEIGHT);
+    }
+    Font *font = loaded_count < FONT_MAX_LOADED ? font_malloc(sizeof(Font)) : NULL;
+    if (!atlas || !font) {
+        return NULL;
+    }
+
+    font->ttf_data = NULL;
+    font->ttf_size = 0;
+    font->font_size = font_size;
+    font->ascent = (int32_t)(font_size * OUTLINE_BASELINE / OUTLINE_UNITS);
+    font->descent = font->ascent - (int32_t)font_size;
+    font->line_gap = 0;
+    for (uint32_t c = 0; c < 256; c++) {
+        font->glyph_cache[c].advance = 0;
+    }
+    font->cache_size = 0;
+
+    loaded[loaded_count++] = font;
+    return font;
+}
+
+// The glyph for c, rasterized into the atlas on first use
+static const Glyph* font_glyph(Font *font, uint8_t c) {
+    Glyph *g = &font->glyph_cache[c];
+    if (g->advance) {
+        return g;
+    }
+
+    OutlineBox box;
+    g->codepoint = c;
+    g->bitmap = NULL;
+    g->width = 0;
+    g->height = 0;
+    g->bearing_x = 0;
+    g->bearing_y = 0;
+    if (font_outline_box(c, font->font_size, &box)) {
+        uint8_t *mask = atlas_alloc(box.width, box.height);
+        if (!mask) {
+            atlas_reset();
+            mask = atlas_alloc(box.width, box.height);
+        }
+        font_outline_rasterize(c, font->font_size, &box, mask, FONT_ATLAS_WIDTH);
+        g->bitmap = mask;
+        g->width = box.width;
+        g->height = box.height;
+        g->bearing_x = box.left;
+        g->bearing_y = font->ascent - box.top;
+    }
+
+    g->advance = font->font_size / 2;
+    font->cache_size++;
+    return g;
+}
+
 Font* font_load_ttf(const uint8_t *ttf_data, uint32_t size, uint32_t font_size) {
     (void)ttf_data;
     (void)size;
@@ -129,43 +260,192 @@ const uint8_t builtin_font_8x16[256][16] = {
              0x60, 0x66, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00},
 };
 
-void font_draw_char_builtin(uint32_t x, uint32_t y, char c, Color fg, Color bg) {
-    uint8_t ch = (uint8_t)c;
-    const uint8_t *glyph = builtin_font_8x16[ch];
+// Glyph rows expanded for one fg/bg pair: row_pixels[bits] holds the 8
+// pixels of a glyph row whose bitmap byte is bits. Rebuilt when the colors
+// change, which for console text is rare.
+static uint32_t row_pixels[256][8];
+static uint32_t table_fg = 0;
+static uint32_t table_bg = 0;
+static int table_valid = 0;
+
+static void expand_rows(Color fg, Color bg) {
+    uint32_t fg_pixel = color_to_uint32(fg);
+    uint32_t bg_pixel = color_to_uint32(bg);
+    if (table_valid && fg_pixel == table_fg && bg_pixel == table_bg) {
+        return;
+    }
 
-    for (uint32_t row = 0; row < 16; row++) {
-        uint8_t byte = glyph[row];
+    for (uint32_t bits = 0; bits < 256; bits++) {
         for (uint32_t col = 0; col < 8; col++) {
-            if (byte & (0x80 >> col)) {
-                framebuffer_putpixel(x + col, y + row, fg);
-            } else {
-                framebuffer_putpixel(x + col, y + row, bg);
+            row_pixels[bits][col] = (bits & (0x80 >> col)) ? fg_pixel : bg_pixel;
+        }
+    }
+    table_fg = fg_pixel;
+    table_bg = bg_pixel;
+    table_valid = 1;
+}
+
+static inline void put_row(uint32_t *dst, const uint32_t *src) {
+    dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = src[3];
+    dst[4] = src[4]; dst[5] = src[5]; dst[6] = src[6]; dst[7] = src[7];
+}
+
+// count cells of text on one line, drawn row by row across all of them
+// and marked dirty as one rectangle. Cells past the right or bottom edge
+// are cut off.
+void font_draw_chars_builtin(uint32_t x, uint32_t y, const char *text, uint32_t count, Color fg, Color bg) {
+    FramebufferInfo *fb = framebuffer_get_info();
+    if (!fb->buffer || x >= fb->width || y >= fb->height || !count) {
+        return;
+    }
+
+    uint32_t full = (fb->width - x) / 8;   // Cells that fit entirely
+    uint32_t rows = fb->height - y < 16 ? fb->height - y : 16;
+    uint32_t partial = 0;                  // Columns of a cut-off last cell
+    if (count > full) {
+        partial = (fb->width - x) % 8;
+        count = full;
+    }
+
+    expand_rows(fg, bg);
+
+    for (uint32_t row = 0; row < rows; row++) {
+        uint32_t *dst = framebuffer_row(y + row) + x;
+        for (uint32_t i = 0; i < count; i++, dst += 8) {
+            put_row(dst, row_pixels[builtin_font_8x16[(uint8_t)text[i]][row]]);
+        }
+        if (partial) {
+            const uint32_t *src = row_pixels[builtin_font_8x16[(uint8_t)text[count]][row]];
+            for (uint32_t col = 0; col < partial; col++) {
+                dst[col] = src[col];
             }
         }
     }
+
+    framebuffer_mark_dirty(x, y, count * 8 + partial, rows);
 }
 
-void font_draw_string_builtin(uint32_t x, uint32_t y, const char *text, Color fg, Color bg) {
-    uint32_t offset_x = 0;
+void font_draw_char_builtin(uint32_t x, uint32_t y, char c, Color fg, Color bg) {
+    font_draw_chars_builtin(x, y, &c, 1, fg, bg);
+}
 
+void font_draw_string_builtin(uint32_t x, uint32_t y, const char *text, Color fg, Color bg) {
+    // Each line is one run
     while (*text) {
+        uint32_t n = 0;
+        while (text[n] && text[n] != '\n') {
+            n++;
+        }
+        font_draw_chars_builtin(x, y, text, n, fg, bg);
+        text += n;
         if (*text == '\n') {
-            offset_x = 0;
             y += 16;
-        } else {
-            font_draw_char_builtin(x + offset_x, y, *text, fg, bg);
-            offset_x += 8;
+            text++;
         }
-        text++;
     }
 }
 
-void font_draw_char(Font *font, uint32_t x, uint32_t y, char c, Color fg, Color bg) {
+/// OUTLINE TEXT
+
+// Coverage blended from bg to fg for one pair, as for the bitmap rows
+static uint32_t blend_pixels[256];
+static uint32_t blend_fg = 0;
+static uint32_t blend_bg = 0;
+static int blend_valid = 0;
+
+// a of 255 is all fg
+static inline uint32_t blend(uint32_t fg, uint32_t bg, uint32_t a) {
+    a += a >> 7;
+    uint32_t rb = ((fg & 0xFF00FF) * a + (bg & 0xFF00FF) * (256 - a)) >> 8;
+    uint32_t g = ((fg & 0x00FF00) * a + (bg & 0x00FF00) * (256 - a)) >> 8;
+    return 0xFF000000 | (rb & 0xFF00FF) | (g & 0x00FF00);
+}
+
+static void expand_blend(uint32_t fg, uint32_t bg) {
+    if (blend_valid && fg == blend_fg && bg == blend_bg) {
+        return;
+    }
+
+    for (uint32_t a = 0; a < 256; a++) {
+        blend_pixels[a] = blend(fg, bg, a);
+    }
+    blend_fg = fg;
+    blend_bg = bg;
+    blend_valid = 1;
+}
+
+// Blend a glyph's mask at (x, y), clipped to the columns [left, right)
+// and rows [top, bottom); over a filled cell it is just a table lookup
+static void blit_glyph(const Glyph *g, int32_t x, int32_t y,
+                       int32_t left, int32_t right, int32_t top, int32_t bottom,
+                       uint32_t fg, int filled) {
+    int32_t col0 = x < left ? left - x : 0;
+    int32_t col1 = x + (int32_t)g->width > right ? right - x : (int32_t)g->width;
+    int32_t row0 = y < top ? top - y : 0;
+    int32_t row1 = y + (int32_t)g->height > bottom ? bottom - y : (int32_t)g->height;
+
+    for (int32_t row = row0; row < row1; row++) {
+        const uint8_t *mask = g->bitmap + row * FONT_ATLAS_WIDTH;
+        uint32_t *dst = framebuffer_row((uint32_t)(y + row)) + x;
+        for (int32_t col = col0; col < col1; col++) {
+            uint32_t a = mask[col];
+            if (!a) {
+                continue;
+            }
+            dst[col] = filled ? blend_pixels[a] : blend(fg, dst[col], a);
+        }
+    }
+}
+
+// count cells of text on one line, filled with bg (unless transparent)
+// and marked dirty as one rectangle; cut off at the right and bottom edge
+void font_draw_chars(Font *font, uint32_t x, uint32_t y, const char *text, uint32_t count, Color fg, Color bg) {
     if (!font) {
-        font_draw_char_builtin(x, y, c, fg, bg);
+        font_draw_chars_builtin(x, y, text, count, fg, bg);
+        return;
+    }
+
+    FramebufferInfo *fb = framebuffer_get_info();
+    if (!fb->buffer || x >= fb->width || y >= fb->height || !count) {
         return;
     }
-    font_draw_char_builtin(x, y, c, fg, bg);
+
+    uint32_t advance = font->font_size / 2;
+    uint32_t width = count * advance;
+    uint32_t rows = font_get_height(font);
+    if (width > fb->width - x) width = fb->width - x;
+    if (rows > fb->height - y) rows = fb->height - y;
+
+    uint32_t fg_pixel = color_to_uint32(fg);
+    int filled = bg.a != 0;
+    if (filled) {
+        uint32_t bg_pixel = color_to_uint32(bg);
+        expand_blend(fg_pixel, bg_pixel);
+        for (uint32_t row = 0; row < rows; row++) {
+            uint32_t *dst = framebuffer_row(y + row) + x;
+            for (uint32_t col = 0; col < width; col++) {
+                dst[col] = bg_pixel;
+            }
+        }
+    }
+
+    int32_t right = (int32_t)(x + width);
+    int32_t bottom = (int32_t)(y + rows);
+    for (uint32_t i = 0; i < count && x + i * advance < x + width; i++) {
+        const Glyph *g = font_glyph(font, (uint8_t)text[i]);
+        if (!g->bitmap) {
+            continue;
+        }
+        int32_t gx = (int32_t)(x + i * advance) + g->bearing_x;
+        int32_t gy = (int32_t)y + font->ascent - g->bearing_y;
+        blit_glyph(g, gx, gy, (int32_t)x, right, (int32_t)y, bottom, fg_pixel, filled);
+    }
+
+    framebuffer_mark_dirty(x, y, width, rows);
+}
+
+void font_draw_char(Font *font, uint32_t x, uint32_t y, char c, Color fg, Color bg) {
+    font_draw_chars(font, x, y, &c, 1, fg, bg);
 }
 
 void font_draw_string(Font *font, uint32_t x, uint32_t y, const char *text, Color fg, Color bg) {
@@ -173,21 +453,31 @@ void font_draw_string(Font *font, uint32_t x, uint32_t y, const char *text, Colo
         font_draw_string_builtin(x, y, text, fg, bg);
         return;
     }
-    font_draw_string_builtin(x, y, text, fg, bg);
+
+    while (*text) {
+        uint32_t n = 0;
+        while (text[n] && text[n] != '\n') {
+            n++;
+        }
+        font_draw_chars(font, x, y, text, n, fg, bg);
+        text += n;
+        if (*text == '\n') {
+            y += font_get_height(font);
+            text++;
+        }
+    }
 }
 
 uint32_t font_string_width(Font *font, const char *text) {
-    (void)font;
     uint32_t len = 0;
     while (*text++) len++;
-    return len * 8;
+    return len * (font ? font->font_size / 2 : 8);
 }
 
 #endif // USE_FRAMEBUFFER
-#endif // ifdef USE_FRAMEBUFFER
 
 // Stub implementations when framebuffer is disabled
-#if !defined(USE_FRAMEBUFFER) || !USE_FRAMEBUFFER
+#if !USE_FRAMEBUFFER
 
 int font_init(void) {
     return 0;
@@ -198,6 +488,11 @@ Font* font_load_ttf(const uint8_t *ttf_data, uint32_t size, uint32_t font_size)
     return NULL;
 }
 
+Font* font_load_outline(uint32_t font_size) {
+    (void)font_size;
+    return NULL;
+}
+
 void font_free(Font *font) {
     (void)font;
 }
@@ -231,6 +526,10 @@ void font_draw_string(Font *font, uint32_t x, uint32_t y, const char *text, Colo
     (void)font; (void)x; (void)y; (void)text; (void)fg; (void)bg;
 }
 
+void font_draw_chars(Font *font, uint32_t x, uint32_t y, const char *text, uint32_t count, Color fg, Color bg) {
+    (void)font; (void)x; (void)y; (void)text; (void)count; (void)fg; (void)bg;
+}
+
 uint32_t font_string_width(Font *font, const char *text) {
     (void)font;
     uint32_t len = 0;
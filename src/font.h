@@ -1,7 +1,12 @@
 /*
  * @file font.h
- * @version 0.0.1
+ * @version 0.0.3
  * Font rendering system with TrueType support
+ *
+ * Outline fonts are rasterized a glyph at a time into anti-aliased
+ * coverage masks, packed into one atlas shared by every size. Each glyph
+ * is rasterized once per size; drawing it again blends its mask from the
+ * atlas. When the atlas fills up it is emptied and refilled on demand.
  */
 
 #ifndef FONT_H
@@ -10,9 +15,13 @@
 #include "framebuffer.h"
 #include <inttypes.h>
 
+#define FONT_ATLAS_WIDTH  512
+#define FONT_ATLAS_HEIGHT 512
+#define FONT_MAX_LOADED   8    // Outline font sizes loaded at once
+
 typedef struct {
     uint32_t codepoint;
-    uint8_t *bitmap;     // Grayscale bitmap (1 byte per pixel)
+    uint8_t *bitmap;     // Coverage (1 byte per pixel), rows FONT_ATLAS_WIDTH apart
     uint32_t width;
     uint32_t height;
     int32_t  bearing_x;  // Horizontal bearing
@@ -28,16 +37,21 @@ typedef struct {
     int32_t descent;     // Font descender
     int32_t line_gap;    // Line gap
 
-    // Glyph cache (simple fixed-size cache)
+    // Glyphs by character; advance is 0 until one is rasterized
     Glyph glyph_cache[256];
     uint32_t cache_size;
 } Font;
 
 int font_init(void);
 Font* font_load_ttf(const uint8_t *ttf_data, uint32_t size, uint32_t font_size);
+Font* font_load_outline(uint32_t font_size);
 void font_free(Font *font);
+
+// Text in cells of font, at the top left of the first; a bg with alpha 0
+// blends the glyphs over what is there instead of filling the cells
 void font_draw_char(Font *font, uint32_t x, uint32_t y, char c, Color fg, Color bg);
 void font_draw_string(Font *font, uint32_t x, uint32_t y, const char *text, Color fg, Color bg);
+void font_draw_chars(Font *font, uint32_t x, uint32_t y, const char *text, uint32_t count, Color fg, Color bg);
 uint32_t font_string_width(Font *font, const char *text);
 uint32_t font_get_height(Font *font);
 void font_set_default(Font *font);
@@ -47,5 +61,6 @@ Font* font_get_default(void);
 extern const uint8_t builtin_font_8x16[256][16];
 void font_draw_char_builtin(uint32_t x, uint32_t y, char c, Color fg, Color bg);
 void font_draw_string_builtin(uint32_t x, uint32_t y, const char *text, Color fg, Color bg);
+void font_draw_chars_builtin(uint32_t x, uint32_t y, const char *text, uint32_t count, Color fg, Color bg);
 
 #endif // FONT_H
@@ -0,0 +1,374 @@
+/*
+ * @file font_outline.c
+ * @version 0.0.1
+ * Embedded outline font and its rasterizer
+ */
+
+#include "font_outline.h"
+
+/// GLYPHS
+
+// Paths on the 16x32 unit cell: M x y starts a stroke, L x y draws a line
+// and Q cx cy x y a quadratic curve. Caps are at y 4, x-height at 10, the
+// baseline at 24 and descenders reach 30.
+static const char *const outlines[128] = {
+    ['!'] = "M8 4L8 18M8 22L8 23",
+    ['"'] = "M6 4L6 9M10 4L10 9",
+    ['#'] = "M6 6L5 22M11 6L10 22M3 11L13 11M3 17L13 17",
+    ['$'] = "M13 8Q12 6 8 6Q3 6 3 10Q3 13 8 14Q13 15 13 18Q13 22 8 22Q4 22 3 20M8 3L8 25",
+    ['%'] = "M13 5L3 24M5 5Q7 5 7 8Q7 11 5 11Q3 11 3 8Q3 5 5 5"
+            "M11 17Q13 17 13 20Q13 23 11 23Q9 23 9 20Q9 17 11 17",
+    ['&'] = "M13 24L5 12Q3 9 5 6Q7 4 9 6Q11 9 7 13L4 17Q2 22 7 24Q10 24 13 17",
+    ['\''] = "M8 4L8 9",
+    ['('] = "M11 3Q5 8 5 14Q5 20 11 25",
+    [')'] = "M5 3Q11 8 11 14Q11 20 5 25",
+    ['*'] = "M8 8L8 18M4 10L12 16M12 10L4 16",
+    ['+'] = "M8 9L8 21M3 15L13 15",
+    [','] = "M9 22L9 24Q9 26 7 27",
+    ['-'] = "M4 15L12 15",
+    ['.'] = "M8 22L8 23",
+    ['/'] = "M13 3L3 25",
+
+    ['0'] = "M8 4Q13 4 13 9L13 19Q13 24 8 24Q3 24 3 19L3 9Q3 4 8 4M11 8L5 20",
+    ['1'] = "M5 7L9 4L9 24M5 24L13 24",
+    ['2'] = "M3 8Q4 4 8 4Q13 4 13 9Q13 13 8 17L3 24L13 24",
+    ['3'] = "M3 6Q5 4 8 4Q13 4 13 8Q13 13 8 13Q13 13 13 18Q13 24 8 24Q4 24 3 22",
+    ['4'] = "M11 24L11 4L3 18L13 18",
+    ['5'] = "M12 4L4 4L3 13Q5 11 8 11Q13 11 13 17Q13 24 8 24Q4 24 3 22",
+    ['6'] = "M12 5Q10 4 8 4Q3 4 3 12L3 18Q3 24 8 24Q13 24 13 18Q13 12 8 12Q4 12 3 15",
+    ['7'] = "M3 4L13 4L6 24",
+    ['8'] = "M8 4Q12 4 12 8Q12 13 8 13Q4 13 4 8Q4 4 8 4"
+            "M8 13Q13 13 13 18Q13 24 8 24Q3 24 3 18Q3 13 8 13",
+    ['9'] = "M13 12Q12 16 8 16Q3 16 3 10Q3 4 8 4Q13 4 13 10L13 16Q13 24 8 24Q6 24 4 23",
+    [':'] = "M8 11L8 12M8 22L8 23",
+    [';'] = "M8 11L8 12M9 22L9 24Q9 26 7 27",
+    ['<'] = "M12 8L4 15L12 22",
+    ['='] = "M3 12L13 12M3 18L13 18",
+    ['>'] = "M4 8L12 15L4 22",
+    ['?'] = "M3 8Q3 4 8 4Q13 4 13 9Q13 12 10 14Q8 15 8 18M8 22L8 23",
+    ['@'] = "M11 11L11 18Q11 20 12 20Q14 20 14 15L14 11Q14 4 8 4Q2 4 2 14Q2 24 9 24"
+            "M11 14Q11 11 8 11Q5 11 5 15Q5 19 8 19Q11 19 11 15",
+
+    ['A'] = "M3 24L8 4L13 24M5 17L11 17",
+    ['B'] = "M3 4L3 24L9 24Q13 24 13 19Q13 14 9 14L3 14M3 4L8 4Q12 4 12 9Q12 14 8 14",
+    ['C'] = "M13 7Q11 4 8 4Q3 4 3 10L3 18Q3 24 8 24Q11 24 13 21",
+    ['D'] = "M3 4L3 24L7 24Q13 24 13 18L13 10Q13 4 7 4L3 4",
+    ['E'] = "M13 4L3 4L3 24L13 24M3 14L11 14",
+    ['F'] = "M13 4L3 4L3 24M3 14L11 14",
+    ['G'] = "M13 7Q11 4 8 4Q3 4 3 10L3 18Q3 24 8 24Q13 24 13 18L13 15L9 15",
+    ['H'] = "M3 4L3 24M13 4L13 24M3 14L13 14",
+    ['I'] = "M5 4L11 4M8 4L8 24M5 24L11 24",
+    ['J'] = "M7 4L13 4M11 4L11 19Q11 24 7 24Q3 24 3 20",
+    ['K'] = "M3 4L3 24M13 4L3 16M6 13L13 24",
+    ['L'] = "M3 4L3 24L13 24",
+    ['M'] = "M3 24L3 4L8 16L13 4L13 24",
+    ['N'] = "M3 24L3 4L13 24L13 4",
+    ['O'] = "M8 4Q13 4 13 9L13 19Q13 24 8 24Q3 24 3 19L3 9Q3 4 8 4",
+    ['P'] = "M3 24L3 4L8 4Q13 4 13 9Q13 15 8 15L3 15",
+    ['Q'] = "M8 4Q13 4 13 9L13 19Q13 24 8 24Q3 24 3 19L3 9Q3 4 8 4M9 19L13 26",
+    ['R'] = "M3 24L3 4L8 4Q13 4 13 9Q13 15 8 15L3 15M8 15L13 24",
+    ['S'] = "M13 7Q12 4 8 4Q3 4 3 9Q3 13 8 14Q13 15 13 19Q13 24 8 24Q4 24 3 21",
+    ['T'] = "M3 4L13 4M8 4L8 24",
+    ['U'] = "M3 4L3 19Q3 24 8 24Q13 24 13 19L13 4",
+    ['V'] = "M3 4L8 24L13 4",
+    ['W'] = "M2 4L4 24L8 12L12 24L14 4",
+    ['X'] = "M3 4L13 24M13 4L3 24",
+    ['Y'] = "M3 4L8 14L13 4M8 14L8 24",
+    ['Z'] = "M3 4L13 4L3 24L13 24",
+    ['['] = "M11 3L6 3L6 25L11 25",
+    ['\\'] = "M3 3L13 25",
+    [']'] = "M5 3L10 3L10 25L5 25",
+    ['^'] = "M4 10L8 4L12 10",
+    ['_'] = "M2 28L14 28",
+    ['`'] = "M6 3L9 6",
+
+    ['a'] = "M4 11Q6 10 8 10Q12 10 12 14L12 24M12 16L8 16Q4 16 4 20Q4 24 8 24Q11 24 12 21",
+    ['b'] = "M3 4L3 24M3 14Q5 10 8 10Q13 10 13 17Q13 24 8 24Q5 24 3 20",
+    ['c'] = "M13 12Q11 10 8 10Q3 10 3 17Q3 24 8 24Q11 24 13 22",
+    ['d'] = "M13 4L13 24M13 14Q11 10 8 10Q3 10 3 17Q3 24 8 24Q11 24 13 20",
+    ['e'] = "M3 17L13 17Q13 10 8 10Q3 10 3 17Q3 24 8 24Q11 24 13 22",
+    ['f'] = "M13 5Q12 4 10 4Q7 4 7 8L7 24M4 11L12 11",
+    ['g'] = "M13 10L13 26Q13 30 8 30Q5 30 4 29M13 14Q11 10 8 10Q3 10 3 16Q3 22 8 22Q11 22 13 18",
+    ['h'] = "M3 4L3 24M3 14Q5 10 8 10Q13 10 13 15L13 24",
+    ['i'] = "M5 10L8 10L8 24M5 24L11 24M8 5L8 6",
+    ['j'] = "M6 10L10 10L10 26Q10 30 6 30Q4 30 3 29M10 5L10 6",
+    ['k'] = "M4 4L4 24M12 10L4 19M7 16L13 24",
+    ['l'] = "M5 4L8 4L8 24M5 24L11 24",
+    ['m'] = "M2 24L2 10M2 13Q3 10 5 10Q8 10 8 13L8 24M8 13Q9 10 11 10Q14 10 14 13L14 24",
+    ['n'] = "M3 24L3 10M3 14Q5 10 8 10Q13 10 13 15L13 24",
+    ['o'] = "M8 10Q13 10 13 17Q13 24 8 24Q3 24 3 17Q3 10 8 10",
+    ['p'] = "M3 10L3 30M3 14Q5 10 8 10Q13 10 13 17Q13 24 8 24Q5 24 3 20",
+    ['q'] = "M13 10L13 30M13 14Q11 10 8 10Q3 10 3 17Q3 24 8 24Q11 24 13 20",
+    ['r'] = "M4 10L4 24M4 15Q6 10 10 10Q12 10 13 11",
+    ['s'] = "M12 12Q11 10 8 10Q4 10 4 13Q4 16 8 17Q12 18 12 21Q12 24 8 24Q5 24 4 22",
+    ['t'] = "M7 5L7 20Q7 24 11 24Q12 24 13 23M4 10L12 10",
+    ['u'] = "M3 10L3 19Q3 24 8 24Q11 24 13 20M13 10L13 24",
+    ['v'] = "M3 10L8 24L13 10",
+    ['w'] = "M2 10L4 24L8 14L12 24L14 10",
+    ['x'] = "M3 10L13 24M13 10L3 24",
+    ['y'] = "M3 10L8 22M13 10L7 27Q6 30 3 30",
+    ['z'] = "M3 10L13 10L3 24L13 24",
+    ['{'] = "M11 3Q8 3 8 6L8 11Q8 14 5 14Q8 14 8 17L8 22Q8 25 11 25",
+    ['|'] = "M8 2L8 28",
+    ['}'] = "M5 3Q8 3 8 6L8 11Q8 14 11 14Q8 14 8 17L8 22Q8 25 5 25",
+    ['~'] = "M3 15Q5 12 8 15Q11 18 13 15",
+};
+
+#define PEN_RADIUS 1.3f   // In units
+#define DOT_SCALE  1.06f  // Octagon radius for the area of a circle of 1
+
+/// PATHS
+
+typedef struct {
+    float x;
+    float y;
+} Point;
+
+static const char *outline_of(uint8_t c) {
+    return c < 128 ? outlines[c] : 0;
+}
+
+// Reads a number and the separators after it
+static const char *read_number(const char *p, int *value) {
+    int v = 0;
+    while (*p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+    }
+    while (*p == ' ' || *p == ',') p++;
+    *value = v;
+    return p;
+}
+
+static const char *read_point(const char *p, float scale, Point *point) {
+    int x, y;
+    p = read_number(p, &x);
+    p = read_number(p, &y);
+    point->x = (float)x * scale;
+    point->y = (float)y * scale;
+    return p;
+}
+
+static inline int floor_int(float v) {
+    int i = (int)v;
+    return (float)i > v ? i - 1 : i;
+}
+
+static inline int ceil_int(float v) {
+    int i = (int)v;
+    return (float)i < v ? i + 1 : i;
+}
+
+static inline float square_root(float v) {
+    float r;
+    __asm__ ("fsqrt" : "=t"(r) : "0"(v));
+    return r;
+}
+
+static inline float pen_radius(uint32_t size) {
+    float r = PEN_RADIUS * (float)size / OUTLINE_UNITS;
+    return r < 0.5f ? 0.5f : r;
+}
+
+int font_outline_box(uint8_t c, uint32_t size, OutlineBox *box) {
+    const char *p = outline_of(c);
+    if (!p || !*p) {
+        return 0;
+    }
+
+    // Control points bound a curve, so every point in the path bounds it
+    float scale = (float)size / OUTLINE_UNITS;
+    float min_x = 1e9f, min_y = 1e9f, max_x = -1e9f, max_y = -1e9f;
+    while (*p) {
+        Point pt;
+        p = read_point(p + 1, scale, &pt);
+        while (*p >= '0' && *p <= '9') {
+            // The end point of a curve follows its control point
+            if (pt.x < min_x) min_x = pt.x;
+            if (pt.x > max_x) max_x = pt.x;
+            if (pt.y < min_y) min_y = pt.y;
+            if (pt.y > max_y) max_y = pt.y;
+            p = read_point(p, scale, &pt);
+        }
+        if (pt.x < min_x) min_x = pt.x;
+        if (pt.x > max_x) max_x = pt.x;
+        if (pt.y < min_y) min_y = pt.y;
+        if (pt.y > max_y) max_y = pt.y;
+    }
+
+    // The pen reaches past the path; one more column takes the area a
+    // line carries into the pixel right of it
+    float r = pen_radius(size) * DOT_SCALE;
+    box->left = floor_int(min_x - r);
+    box->top = floor_int(min_y - r);
+    box->width = (uint32_t)(ceil_int(max_x + r) + 1 - box->left);
+    box->height = (uint32_t)(ceil_int(max_y + r) - box->top);
+    return 1;
+}
+
+/// RASTERIZER
+
+// Signed area per pixel, summed along the rows afterwards (as in font-rs)
+static float accumulation[(OUTLINE_MAX_SIZE + 8) * (OUTLINE_MAX_SIZE + 8) + 1];
+static uint32_t acc_width;
+static uint32_t acc_height;
+
+// Adds the signed area left of the edge from (x0, y0) to (x1, y1) to the
+// pixels it crosses; the running sum across a row then gives coverage
+static void accumulate_edge(float x0, float y0, float x1, float y1) {
+    if (y0 == y1) {
+        return;
+    }
+
+    float dir = 1.0f;
+    if (y0 > y1) {
+        float t;
+        dir = -1.0f;
+        t = x0; x0 = x1; x1 = t;
+        t = y0; y0 = y1; y1 = t;
+    }
+
+    float dxdy = (x1 - x0) / (y1 - y0);
+    float x = x0;
+    if (y0 < 0.0f) {
+        x -= y0 * dxdy;
+        y0 = 0.0f;
+    }
+    if (y1 > (float)acc_height) {
+        y1 = (float)acc_height;
+    }
+
+    int y_end = ceil_int(y1);
+    for (int y = floor_int(y0); y < y_end; y++) {
+        float *row = accumulation + y * acc_width;
+        float top = (float)y > y0 ? (float)y : y0;
+        float bottom = (float)(y + 1) < y1 ? (float)(y + 1) : y1;
+        float dy = bottom - top;
+        float x_next = x + dxdy * dy;
+        float d = dy * dir;
+
+        float xa = x < x_next ? x : x_next;
+        float xb = x < x_next ? x_next : x;
+        int xa_i = floor_int(xa);
+        int xb_i = ceil_int(xb);
+
+        if (xb_i <= xa_i + 1) {
+            // Within one pixel: split by where it crosses on average
+            float xm = 0.5f * (x + x_next) - (float)xa_i;
+            row[xa_i] += d - d * xm;
+            row[xa_i + 1] += d * xm;
+        } else {
+            float s = 1.0f / (xb - xa);
+            float xa_f = xa - (float)xa_i;
+            float a0 = 0.5f * s * (1.0f - xa_f) * (1.0f - xa_f);
+            float xb_f = xb - (float)xb_i + 1.0f;
+            float am = 0.5f * s * xb_f * xb_f;
+            row[xa_i] += d * a0;
+            if (xb_i == xa_i + 2) {
+                row[xa_i + 1] += d * (1.0f - a0 - am);
+            } else {
+                float a1 = s * (1.5f - xa_f);
+                row[xa_i + 1] += d * (a1 - a0);
+                for (int i = xa_i + 2; i < xb_i - 1; i++) {
+                    row[i] += d * s;
+                }
+                float a2 = a1 + (float)(xb_i - xa_i - 3) * s;
+                row[xb_i - 1] += d * (1.0f - a2 - am);
+            }
+            row[xb_i] += d * am;
+        }
+        x = x_next;
+    }
+}
+
+// Unit octagon, clockwise like the sides of a stroke
+static const Point octagon[8] = {
+    { 1.0f, 0.0f }, { 0.7071f, -0.7071f }, { 0.0f, -1.0f }, { -0.7071f, -0.7071f },
+    { -1.0f, 0.0f }, { -0.7071f, 0.7071f }, { 0.0f, 1.0f }, { 0.7071f, 0.7071f },
+};
+
+// The round pen set down at p: joins and caps
+static void stroke_dot(Point p, float r) {
+    float R = r * DOT_SCALE;
+    for (int i = 0; i < 8; i++) {
+        const Point *a = &octagon[i];
+        const Point *b = &octagon[(i + 1) & 7];
+        accumulate_edge(p.x + a->x * R, p.y + a->y * R, p.x + b->x * R, p.y + b->y * R);
+    }
+}
+
+// The pen dragged from a to b: a rectangle r either side of the line
+static void stroke_line(Point a, Point b, float r) {
+    float dx = b.x - a.x;
+    float dy = b.y - a.y;
+    float length = square_root(dx * dx + dy * dy);
+    if (length < 1e-4f) {
+        return;
+    }
+
+    float nx = -dy / length * r;
+    float ny = dx / length * r;
+    accumulate_edge(a.x + nx, a.y + ny, b.x + nx, b.y + ny);
+    accumulate_edge(b.x + nx, b.y + ny, b.x - nx, b.y - ny);
+    accumulate_edge(b.x - nx, b.y - ny, a.x - nx, a.y - ny);
+    accumulate_edge(a.x - nx, a.y - ny, a.x + nx, a.y + ny);
+    stroke_dot(b, r);
+}
+
+void font_outline_rasterize(uint8_t c, uint32_t size, const OutlineBox *box,
+                            uint8_t *mask, uint32_t stride) {
+    acc_width = box->width;
+    acc_height = box->height;
+    uint32_t count = acc_width * acc_height;
+    for (uint32_t i = 0; i <= count; i++) {
+        accumulation[i] = 0.0f;
+    }
+
+    float scale = (float)size / OUTLINE_UNITS;
+    float r = pen_radius(size);
+    int steps = 2 + (int)size / 8;  // Lines per curve
+    Point origin = { (float)box->left, (float)box->top };
+
+    const char *p = outline_of(c);
+    Point pen = { 0.0f, 0.0f };
+    while (p && *p) {
+        char command = *p;
+        Point to;
+        p = read_point(p + 1, scale, &to);
+        to.x -= origin.x;
+        to.y -= origin.y;
+
+        if (command == 'M') {
+            stroke_dot(to, r);
+        } else if (command == 'L') {
+            stroke_line(pen, to, r);
+        } else if (command == 'Q') {
+            Point control = to;
+            p = read_point(p, scale, &to);
+            to.x -= origin.x;
+            to.y -= origin.y;
+            Point from = pen;
+            for (int i = 1; i <= steps; i++) {
+                float t = (float)i / (float)steps;
+                float u = 1.0f - t;
+                Point next = {
+                    u * u * from.x + 2.0f * u * t * control.x + t * t * to.x,
+                    u * u * from.y + 2.0f * u * t * control.y + t * t * to.y,
+                };
+                stroke_line(pen, next, r);
+                pen = next;
+            }
+        }
+        pen = to;
+    }
+
+    // Overlapping strokes add up past full coverage, so clamp
+    float sum = 0.0f;
+    const float *acc = accumulation;
+    for (uint32_t y = 0; y < acc_height; y++, mask += stride) {
+        for (uint32_t x = 0; x < acc_width; x++) {
+            sum += *acc++;
+            float a = sum < 0.0f ? -sum : sum;
+            mask[x] = a >= 1.0f ? 255 : (uint8_t)(a * 255.0f + 0.5f);
+        }
+    }
+}
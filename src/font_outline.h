@@ -0,0 +1,40 @@
+/*
+ * @file font_outline.h
+ * @version 0.0.1
+ * Embedded outline font and its rasterizer
+ *
+ * Glyphs for printable ASCII are paths of lines and quadratic curves on a
+ * cell of 16 by 32 units, drawn with a round pen. Rasterizing turns every
+ * stroke into outline polygons and adds up their exact signed area in
+ * each pixel, so coverage is anti-aliased without supersampling. Sizes
+ * are pixels per em; the cell is size / 2 wide and size tall.
+ */
+
+#ifndef FONT_OUTLINE_H
+#define FONT_OUTLINE_H
+
+#include <inttypes.h>
+
+#define OUTLINE_UNITS    32  // Units per em, which is the cell height
+#define OUTLINE_ADVANCE  16  // Cell width, in units
+#define OUTLINE_BASELINE 24  // Down from the top of the cell, in units
+#define OUTLINE_MIN_SIZE 6
+#define OUTLINE_MAX_SIZE 64
+
+// Where a glyph's coverage mask goes, in pixels from the cell's top left
+typedef struct {
+    int32_t left;
+    int32_t top;
+    uint32_t width;
+    uint32_t height;
+} OutlineBox;
+
+// Box of glyph c at size; 0 if it draws nothing (or has no outline)
+int font_outline_box(uint8_t c, uint32_t size, OutlineBox *box);
+
+// Coverage (0 to 255) of glyph c into a mask of box's size, rows stride
+// bytes apart. Every byte of the mask is written.
+void font_outline_rasterize(uint8_t c, uint32_t size, const OutlineBox *box,
+                            uint8_t *mask, uint32_t stride);
+
+#endif // FONT_OUTLINE_H
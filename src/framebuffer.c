@@ -1,6 +1,6 @@
 /*
  * @file framebuffer.c
- * @version 0.0.2
+ * @version 0.0.6
  * Framebuffer graphics implementation
  */
 
@@ -9,6 +9,19 @@
 // Global framebuffer info
 static FramebufferInfo fb_info = {0};
 
+// Areas of the back buffer not yet on screen. Rectangles can overlap;
+// the flush merges them per row, so no pixel is written twice.
+typedef struct {
+    uint32_t x0, y0, x1, y1;  // Half-open
+} DirtyRect;
+
+static DirtyRect dirty[FB_MAX_DIRTY];
+static int dirty_count = 0;
+
+// While flipping: what the hidden page missed when it was last on screen
+static DirtyRect previous[FB_MAX_DIRTY];
+static int previous_count = 0;
+
 FramebufferInfo* framebuffer_get_info(void) {
     return &fb_info;
 }
@@ -23,6 +36,38 @@ uint32_t color_to_uint32(Color color) {
     return (color.a << 24) | (color.r << 16) | (color.g << 8) | color.b;
 }
 
+// Row y of the screen, of the back buffer, and of whichever drawing targets
+static inline uint32_t *screen_row(uint32_t y) {
+    return fb_info.buffer + y * (fb_info.pitch / 4);
+}
+
+static inline uint32_t *back_row(uint32_t y) {
+    return fb_info.back + y * fb_info.width;
+}
+
+static inline uint32_t *draw_row(uint32_t y) {
+    return fb_info.back ? back_row(y) : screen_row(y);
+}
+
+static inline uint32_t *page_base(uint32_t page) {
+    return fb_info.base + page * fb_info.height * (fb_info.pitch / 4);
+}
+
+static inline void fill_span(uint32_t *dst, uint32_t pixel, uint32_t count) {
+    __asm__ volatile("rep stosl"
+                     : "+D"(dst), "+c"(count)
+                     : "a"(pixel)
+                     : "memory");
+}
+
+// Forward copy, so it can also move a block to a lower address
+static inline void copy_span(uint32_t *dst, const uint32_t *src, uint32_t count) {
+    __asm__ volatile("rep movsl"
+                     : "+D"(dst), "+S"(src), "+c"(count)
+                     :
+                     : "memory");
+}
+
 Color uint32_to_color(uint32_t pixel) {
     Color color;
     color.b = pixel & 0xFF;
@@ -32,14 +77,152 @@ Color uint32_to_color(uint32_t pixel) {
     return color;
 }
 
+/// DIRTY RECTANGLES
+
+static uint32_t rect_area(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+    return (x1 - x0) * (y1 - y0);
+}
+
+void framebuffer_mark_dirty(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if ((!fb_info.back && fb_info.pages != 2) || !width || !height) {
+        return;
+    }
+
+    DirtyRect r = { x, y, x + width, y + height };
+
+    // Touching or overlapping an existing one: grow that instead. The
+    // last one comes first, since drawing tends to stay in one place.
+    for (int i = dirty_count - 1; i >= 0; i--) {
+        DirtyRect *d = &dirty[i];
+        if (r.x0 <= d->x1 && d->x0 <= r.x1 && r.y0 <= d->y1 && d->y0 <= r.y1) {
+            if (r.x0 < d->x0) d->x0 = r.x0;
+            if (r.y0 < d->y0) d->y0 = r.y0;
+            if (r.x1 > d->x1) d->x1 = r.x1;
+            if (r.y1 > d->y1) d->y1 = r.y1;
+            return;
+        }
+    }
+
+    if (dirty_count < FB_MAX_DIRTY) {
+        dirty[dirty_count++] = r;
+        return;
+    }
+
+    // Full: fold it into the one that grows the least
+    int best = 0;
+    uint32_t best_growth = 0xFFFFFFFF;
+    for (int i = 0; i < dirty_count; i++) {
+        DirtyRect *d = &dirty[i];
+        uint32_t x0 = r.x0 < d->x0 ? r.x0 : d->x0;
+        uint32_t y0 = r.y0 < d->y0 ? r.y0 : d->y0;
+        uint32_t x1 = r.x1 > d->x1 ? r.x1 : d->x1;
+        uint32_t y1 = r.y1 > d->y1 ? r.y1 : d->y1;
+        uint32_t growth = rect_area(x0, y0, x1, y1) - rect_area(d->x0, d->y0, d->x1, d->y1);
+        if (growth < best_growth) {
+            best_growth = growth;
+            best = i;
+        }
+    }
+    DirtyRect *d = &dirty[best];
+    if (r.x0 < d->x0) d->x0 = r.x0;
+    if (r.y0 < d->y0) d->y0 = r.y0;
+    if (r.x1 > d->x1) d->x1 = r.x1;
+    if (r.y1 > d->y1) d->y1 = r.y1;
+}
+
+static void mark_all_dirty(void) {
+    dirty_count = 0;
+    framebuffer_mark_dirty(0, 0, fb_info.width, fb_info.height);
+}
+
+// Copies the back buffer under the rectangles to the drawing page
+static void copy_rects(const DirtyRect *rects, int count) {
+    uint32_t y_start = fb_info.height;
+    uint32_t y_end = 0;
+    for (int i = 0; i < count; i++) {
+        if (rects[i].y0 < y_start) y_start = rects[i].y0;
+        if (rects[i].y1 > y_end) y_end = rects[i].y1;
+    }
+
+    // Each row: the spans of the rectangles crossing it, sorted by start
+    // and merged, then one copy per merged span
+    for (uint32_t y = y_start; y < y_end; y++) {
+        uint32_t x0[2 * FB_MAX_DIRTY];
+        uint32_t x1[2 * FB_MAX_DIRTY];
+        int n = 0;
+
+        for (int i = 0; i < count; i++) {
+            if (y < rects[i].y0 || y >= rects[i].y1) continue;
+            int j = n++;
+            for (; j > 0 && x0[j - 1] > rects[i].x0; j--) {
+                x0[j] = x0[j - 1];
+                x1[j] = x1[j - 1];
+            }
+            x0[j] = rects[i].x0;
+            x1[j] = rects[i].x1;
+        }
+
+        uint32_t *dst = screen_row(y);
+        const uint32_t *src = back_row(y);
+        for (int i = 0; i < n; ) {
+            uint32_t start = x0[i];
+            uint32_t end = x1[i];
+            for (i++; i < n && x0[i] <= end; i++) {
+                if (x1[i] > end) end = x1[i];
+            }
+            copy_span(dst + start, src + start, end - start);
+        }
+    }
+}
+
+// Puts the drawing page on screen and starts drawing to the other
+static void flip(void) {
+    fb_info.visible ^= 1;
+    fb_info.set_y_offset(fb_info.visible * fb_info.height);
+    fb_info.buffer = page_base(fb_info.visible ^ 1);
+}
+
+void framebuffer_flush(void) {
+    if (!dirty_count) {
+        return;
+    }
+
+    if (fb_info.pages != 2) {
+        if (fb_info.back) copy_rects(dirty, dirty_count);
+        dirty_count = 0;
+        return;
+    }
+
+    if (fb_info.back) {
+        // The hidden page was last current a frame ago: it needs this
+        // frame's changes and the ones made while it was on screen
+        DirtyRect rects[2 * FB_MAX_DIRTY];
+        int count = 0;
+        for (int i = 0; i < previous_count; i++) rects[count++] = previous[i];
+        for (int i = 0; i < dirty_count; i++) rects[count++] = dirty[i];
+        copy_rects(rects, count);
+
+        for (int i = 0; i < dirty_count; i++) previous[i] = dirty[i];
+        previous_count = dirty_count;
+    }
+
+    flip();
+    dirty_count = 0;
+}
+
+/// DRAWING
+
+uint32_t* framebuffer_row(uint32_t y) {
+    return draw_row(y);
+}
+
 void framebuffer_putpixel(uint32_t x, uint32_t y, Color color) {
     if (!fb_info.buffer || x >= fb_info.width || y >= fb_info.height) {
         return;
     }
 
-    uint32_t pixel = color_to_uint32(color);
-    uint32_t offset = y * (fb_info.pitch / 4) + x;
-    fb_info.buffer[offset] = pixel;
+    draw_row(y)[x] = color_to_uint32(color);
+    framebuffer_mark_dirty(x, y, 1, 1);
 }
 
 Color framebuffer_getpixel(uint32_t x, uint32_t y) {
@@ -47,9 +230,8 @@ Color framebuffer_getpixel(uint32_t x, uint32_t y) {
         return COLOR_BLACK;
     }
 
-    uint32_t offset = y * (fb_info.pitch / 4) + x;
-    uint32_t pixel = fb_info.buffer[offset];
-    return uint32_to_color(pixel);
+    // From the back buffer when there is one, sparing a video memory read
+    return uint32_to_color(draw_row(y)[x]);
 }
 
 void framebuffer_clear(Color color) {
@@ -58,31 +240,118 @@ void framebuffer_clear(Color color) {
     }
 
     uint32_t pixel = color_to_uint32(color);
-    uint32_t total_pixels = (fb_info.pitch / 4) * fb_info.height;
+    if (fb_info.back) {
+        fill_span(fb_info.back, pixel, fb_info.width * fb_info.height);
+        mark_all_dirty();
+    } else {
+        fill_span(fb_info.buffer, pixel, (fb_info.pitch / 4) * fb_info.height);
+        mark_all_dirty();
+    }
+}
+
+void framebuffer_hline(uint32_t x, uint32_t y, uint32_t width, Color color) {
+    if (!fb_info.buffer || x >= fb_info.width || y >= fb_info.height) {
+        return;
+    }
+    if (width > fb_info.width - x) width = fb_info.width - x;
+
+    fill_span(draw_row(y) + x, color_to_uint32(color), width);
+    framebuffer_mark_dirty(x, y, width, 1);
+}
 
-    for (uint32_t i = 0; i < total_pixels; i++) {
-        fb_info.buffer[i] = pixel;
+void framebuffer_vline(uint32_t x, uint32_t y, uint32_t height, Color color) {
+    if (!fb_info.buffer || x >= fb_info.width || y >= fb_info.height) {
+        return;
     }
+    if (height > fb_info.height - y) height = fb_info.height - y;
+
+    uint32_t pixel = color_to_uint32(color);
+    uint32_t stride = fb_info.back ? fb_info.width : fb_info.pitch / 4;
+    uint32_t *p = draw_row(y) + x;
+    for (uint32_t i = 0; i < height; i++, p += stride) {
+        *p = pixel;
+    }
+    framebuffer_mark_dirty(x, y, 1, height);
 }
 
 void framebuffer_draw_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, Color color) {
+    if (!width || !height) {
+        return;
+    }
+
     // Top and bottom
-    for (uint32_t i = 0; i < width; i++) {
-        framebuffer_putpixel(x + i, y, color);
-        framebuffer_putpixel(x + i, y + height - 1, color);
+    framebuffer_hline(x, y, width, color);
+    if (height > 1) {
+        framebuffer_hline(x, y + height - 1, width, color);
     }
 
-    // Left and right
-    for (uint32_t i = 0; i < height; i++) {
-        framebuffer_putpixel(x, y + i, color);
-        framebuffer_putpixel(x + width - 1, y + i, color);
+    // Left and right, between them
+    if (height > 2) {
+        framebuffer_vline(x, y + 1, height - 2, color);
+        if (width > 1) {
+            framebuffer_vline(x + width - 1, y + 1, height - 2, color);
+        }
     }
 }
 
 void framebuffer_fill_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, Color color) {
+    if (!fb_info.buffer || x >= fb_info.width || y >= fb_info.height) {
+        return;
+    }
+
+    // Clip once, then fill whole row spans
+    if (width > fb_info.width - x) width = fb_info.width - x;
+    if (height > fb_info.height - y) height = fb_info.height - y;
+
+    uint32_t pixel = color_to_uint32(color);
+    for (uint32_t j = y; j < y + height; j++) {
+        fill_span(draw_row(j) + x, pixel, width);
+    }
+    framebuffer_mark_dirty(x, y, width, height);
+}
+
+void framebuffer_blit(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                      const uint32_t *pixels, uint32_t stride) {
+    if (!fb_info.buffer || x >= fb_info.width || y >= fb_info.height) {
+        return;
+    }
+
+    if (width > fb_info.width - x) width = fb_info.width - x;
+    if (height > fb_info.height - y) height = fb_info.height - y;
+
     for (uint32_t j = 0; j < height; j++) {
-        for (uint32_t i = 0; i < width; i++) {
-            framebuffer_putpixel(x + i, y + j, color);
+        copy_span(draw_row(y + j) + x, pixels + j * stride, width);
+    }
+    framebuffer_mark_dirty(x, y, width, height);
+}
+
+void framebuffer_scroll(uint32_t rows, Color fill) {
+    if (!fb_info.buffer) {
+        return;
+    }
+    if (rows >= fb_info.height) {
+        framebuffer_clear(fill);
+        return;
+    }
+
+    uint32_t pixel = color_to_uint32(fill);
+    uint32_t keep = fb_info.height - rows;
+    uint32_t width = fb_info.width;
+
+    if (!fb_info.back) {
+        // Without a back buffer the rows have to be read back from the screen
+        for (uint32_t y = 0; y < keep; y++) {
+            copy_span(screen_row(y), screen_row(y + rows), width);
         }
+        for (uint32_t y = keep; y < fb_info.height; y++) {
+            fill_span(screen_row(y), pixel, width);
+        }
+        mark_all_dirty();
+        return;
     }
+
+    // Move the picture up in RAM; the next flush writes it out once
+    copy_span(fb_info.back, back_row(rows), keep * width);
+    fill_span(back_row(keep), pixel, rows * width);
+    mark_all_dirty();
 }
@@ -1,7 +1,20 @@
 /*
  * @file framebuffer.h
- * @version 0.0.2
+ * @version 0.0.6
  * Framebuffer graphics mode support
+ *
+ * With a back buffer set, all drawing goes to it in RAM and records dirty
+ * rectangles; framebuffer_flush copies them to the screen in merged row
+ * spans. Reads and scrolling work from the back buffer, so video memory
+ * is only ever written, each pixel at most once per flush. Without one,
+ * drawing goes straight to the screen.
+ *
+ * With two pages (a virtual screen twice the visible height), buffer is
+ * the hidden page and framebuffer_flush presents it by moving the y
+ * offset, so frames never tear. A back buffer is then copied into the
+ * hidden page first, along with what the page missed from the frame
+ * before. Without one, each frame has to be drawn in full, and the flush
+ * is a single register write.
  */
 
 #ifndef FRAMEBUFFER_H
@@ -17,8 +30,15 @@ typedef struct {
     uint32_t height;  // Height in pixels
     uint32_t pitch;   // Bytes per scanline
     uint32_t bpp;     // Bits per pixel (32)
+    uint32_t *back;   // RAM back buffer, width * height pixels, or NULL
+    uint32_t *base;   // First page; buffer is the page drawn to
+    uint32_t pages;   // 2 when flipping pages, else 0 or 1
+    uint32_t visible; // Page on screen while flipping
+    void (*set_y_offset)(uint32_t y);  // Shows the screen from row y
 } FramebufferInfo;
 
+#define FB_MAX_DIRTY 32  // Dirty rectangles kept before they get merged
+
 typedef struct {
     uint8_t r;
     uint8_t g;
@@ -56,8 +76,19 @@ void framebuffer_clear(Color color);
 void framebuffer_putpixel(uint32_t x, uint32_t y, Color color);
 Color framebuffer_getpixel(uint32_t x, uint32_t y);
 
+void framebuffer_hline(uint32_t x, uint32_t y, uint32_t width, Color color);
+void framebuffer_vline(uint32_t x, uint32_t y, uint32_t height, Color color);
 void framebuffer_draw_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, Color color);
 void framebuffer_fill_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, Color color);
+void framebuffer_blit(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                      const uint32_t *pixels, uint32_t stride);
+void framebuffer_scroll(uint32_t rows, Color fill);
+
+// Row y of whatever drawing targets (the back buffer if set), for code that
+// fills pixels itself; it must clip, and mark what it wrote dirty
+uint32_t* framebuffer_row(uint32_t y);
+void framebuffer_mark_dirty(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+void framebuffer_flush(void);
 
 uint32_t color_to_uint32(Color color);
 Color uint32_to_color(uint32_t pixel);
@@ -4,10 +4,26 @@
 global idt_load
 global irq0_handler
 global irq1_handler
+global spurious_handler
 
 ; Import C functions
 extern timer_handler
 extern keyboard_handler
+extern apic_eoi_register
+
+; End of interrupt: a write to the local APIC's EOI register once
+; apic_init has taken over, the 8259's command port before that
+%macro EOI 0
+    mov eax, [apic_eoi_register]
+    test eax, eax
+    jz %%pic
+    mov dword [eax], 0
+    jmp %%done
+%%pic:
+    mov al, 0x20
+    out 0x20, al
+%%done:
+%endmacro
 
 ; Load IDT
 idt_load:
@@ -21,9 +37,7 @@ irq0_handler:
 
     call timer_handler
 
-    ; Send EOI to PIC
-    mov al, 0x20
-    out 0x20, al
+    EOI
 
     popa                ; Restore registers
     iret                ; Return from interrupt
@@ -34,9 +48,11 @@ irq1_handler:
 
     call keyboard_handler
 
-    ; Send EOI to PIC
-    mov al, 0x20
-    out 0x20, al
+    EOI
 
     popa                ; Restore registers
     iret                ; Return from interrupt
+
+; Local APIC spurious interrupt: nothing to handle and no EOI
+spurious_handler:
+    iret
@@ -4,23 +4,27 @@
  * LNL Kernel - Simple VGA/Framebuffer switch
  */
 
+#include "config.h"
 #include "keyboard.h"
 #include "cursor.h"
+#include "console.h"
 #include "timer.h"
+#include "clock.h"
+#include "apic.h"
 #include "vga.h"
 #include "framebuffer.h"
+#include "vesa.h"
 #include "font.h"
+#include "paging.h"
 #include "monad/monad.h"
+#include "monad/fasl.h"
+#include "monad/editor.h"
 
 struct idt_entry idt[256];
 struct idt_ptr idtp;
 
-#define USE_FRAMEBUFFER 0  // 0 = VGA text mode, 1 = VESA framebuffer
-
 #if USE_FRAMEBUFFER
-// Framebuffer mode variables
-static uint32_t text_x = 0;
-static uint32_t text_y = 0;
+// Framebuffer mode variables; text goes at cursor_x/cursor_y as in text mode
 static const uint32_t char_width = 8;
 static const uint32_t char_height = 16;
 static Color current_fg = COLOR_WHITE;
@@ -30,142 +34,157 @@ static Color current_bg = COLOR_BLACK;
 void clear_screen(void) {
 #if USE_FRAMEBUFFER
     framebuffer_clear(COLOR_BLACK);
-    text_x = 0;
-    text_y = 0;
+    cursor_x = 0;
+    cursor_y = 0;
 #else
-    uint8_t default_color = vga_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
-    uint16_t blank = vga_entry(' ', default_color);
-    for (uint32_t i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-        VGA_MEMORY[i] = blank;
-    }
-    cursor_set_position(0, 0);
+    console_clear();
+    cursor_x = 0;
+    cursor_y = 0;
+    console_flush();
 #endif
 }
 
 void scroll_screen(void) {
 #if USE_FRAMEBUFFER
-    FramebufferInfo *fb = framebuffer_get_info();
-
-    // Move all lines up by char_height pixels
-    for (uint32_t y = char_height; y < fb->height; y++) {
-        for (uint32_t x = 0; x < fb->width; x++) {
-            Color pixel = framebuffer_getpixel(x, y);
-            framebuffer_putpixel(x, y - char_height, pixel);
-        }
-    }
-
-    // Clear last line
-    uint32_t start_y = fb->height - char_height;
-    for (uint32_t y = start_y; y < fb->height; y++) {
-        for (uint32_t x = 0; x < fb->width; x++) {
-            framebuffer_putpixel(x, y, COLOR_BLACK);
-        }
-    }
+    framebuffer_scroll(char_height, COLOR_BLACK);
 #else
-    // Move all lines up
-    for (uint32_t y = 1; y < VGA_HEIGHT; y++) {
-        for (uint32_t x = 0; x < VGA_WIDTH; x++) {
-            VGA_MEMORY[(y-1) * VGA_WIDTH + x] = VGA_MEMORY[y * VGA_WIDTH + x];
-        }
-    }
-    // Clear last line
-    uint8_t default_color = vga_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
-    uint16_t blank = vga_entry(' ', default_color);
-    for (uint32_t x = 0; x < VGA_WIDTH; x++) {
-        VGA_MEMORY[(VGA_HEIGHT-1) * VGA_WIDTH + x] = blank;
-    }
+    console_scroll();
 #endif
 }
 
 void putchar_at(char c, uint8_t color, uint32_t x, uint32_t y) {
-    const uint32_t index = y * VGA_WIDTH + x;
-    VGA_MEMORY[index] = vga_entry(c, color);
+    console_put_at(c, color, x, y);
 }
 
-void putchar(char c) {
+// Colors of the REPL's HighlightStyle values
+#if USE_FRAMEBUFFER
+static const Color style_fg[] = {
+    [HL_PLAIN]   = COLOR_WHITE,
+    [HL_KEYWORD] = COLOR_KEYWORD,
+    [HL_NUMBER]  = COLOR_NUMBER,
+    [HL_LITERAL] = COLOR_FUNCTION,
+    [HL_QUOTE]   = COLOR_STRING,
+    [HL_COMMENT] = COLOR_COMMENT,
+    [HL_PAREN]   = COLOR_PAREN,
+    [HL_MATCH]   = COLOR_BLACK,
+    [HL_ERROR]   = COLOR_RED,
+};
+#else
+static const uint8_t style_color[] = {
+    [HL_PLAIN]   = VGA_COLOR_WHITE,
+    [HL_KEYWORD] = VGA_COLOR_LIGHT_BLUE,
+    [HL_NUMBER]  = VGA_COLOR_LIGHT_GREEN,
+    [HL_LITERAL] = VGA_COLOR_LIGHT_CYAN,
+    [HL_QUOTE]   = VGA_COLOR_LIGHT_MAGENTA,
+    [HL_COMMENT] = VGA_COLOR_GREEN,
+    [HL_PAREN]   = VGA_COLOR_LIGHT_BROWN,
+    [HL_MATCH]   = VGA_COLOR_WHITE | (VGA_COLOR_BROWN << 4),
+    [HL_ERROR]   = VGA_COLOR_LIGHT_RED,
+};
+#endif
+
+// A run of the input being edited, at column x of row y
+void print_styled_at(const char *text, uint32_t count, uint8_t style, uint32_t x, uint32_t y) {
 #if USE_FRAMEBUFFER
     FramebufferInfo *fb = framebuffer_get_info();
     uint32_t max_cols = fb->width / char_width;
-    uint32_t max_rows = fb->height / char_height;
-
-    if (c == '\n') {
-        text_x = 0;
-        text_y++;
-        if (text_y >= max_rows) {
-            text_y = max_rows - 1;
-            scroll_screen();
-        }
+    if (x >= max_cols || y >= fb->height / char_height) {
         return;
     }
+    if (count > max_cols - x) count = max_cols - x;
 
-    if (c == '\b') {
-        if (text_x > 0) {
-            text_x--;
-            font_draw_char_builtin(text_x * char_width, text_y * char_height,
-                                  ' ', current_fg, current_bg);
-        }
-        return;
+    Color bg = style == HL_MATCH ? COLOR_PAREN : current_bg;
+    font_draw_chars(font_get_default(), x * char_width, y * char_height, text, count,
+                    style_fg[style], bg);
+#else
+    for (uint32_t i = 0; i < count && x + i < VGA_WIDTH; i++) {
+        console_put_at(text[i], style_color[style], x + i, y);
     }
+#endif
+}
 
-    font_draw_char_builtin(text_x * char_width, text_y * char_height,
-                          c, current_fg, current_bg);
+#if USE_FRAMEBUFFER
+static void fb_newline(void) {
+    FramebufferInfo *fb = framebuffer_get_info();
+    uint32_t max_rows = fb->height / char_height;
 
-    text_x++;
-    if (text_x >= max_cols) {
-        text_x = 0;
-        text_y++;
-        if (text_y >= max_rows) {
-            text_y = max_rows - 1;
-            scroll_screen();
-        }
+    cursor_x = 0;
+    cursor_y++;
+    if (cursor_y >= max_rows) {
+        cursor_y = max_rows - 1;
+        scroll_screen();
     }
-#else
-    // Restore character at cursor position before writing new character
-    cursor_restore_char();
+}
+#endif
 
-    uint8_t default_color = vga_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+void putchar(char c) {
+#if USE_FRAMEBUFFER
+    FramebufferInfo *fb = framebuffer_get_info();
+    uint32_t max_cols = fb->width / char_width;
 
     if (c == '\n') {
-        cursor_x = 0;
-        cursor_y++;
-        if (cursor_y >= VGA_HEIGHT) {
-            cursor_y = VGA_HEIGHT - 1;
-            scroll_screen();
-        }
-        cursor_reset_blink();
-        cursor_update();
+        fb_newline();
         return;
     }
 
     if (c == '\b') {
         if (cursor_x > 0) {
             cursor_x--;
-            putchar_at(' ', default_color, cursor_x, cursor_y);
+            font_draw_char(font_get_default(), cursor_x * char_width, cursor_y * char_height,
+                           ' ', current_fg, current_bg);
         }
-        cursor_reset_blink();
-        cursor_update();
         return;
     }
 
-    putchar_at(c, default_color, cursor_x, cursor_y);
+    font_draw_char(font_get_default(), cursor_x * char_width, cursor_y * char_height,
+                   c, current_fg, current_bg);
+
     cursor_x++;
-    if (cursor_x >= VGA_WIDTH) {
-        cursor_x = 0;
-        cursor_y++;
-        if (cursor_y >= VGA_HEIGHT) {
-            cursor_y = VGA_HEIGHT - 1;
-            scroll_screen();
-        }
+    if (cursor_x >= max_cols) {
+        fb_newline();
     }
-    cursor_reset_blink();
-    cursor_update();
+#else
+    // Buffered; shows up on the next console_flush
+    console_putchar(c);
+#endif
+}
+
+// Put everything drawn since the last call on screen
+static void flush_screen(void) {
+#if USE_FRAMEBUFFER
+    framebuffer_flush();
+#else
+    console_flush();
 #endif
 }
 
 void print(const char* str) {
+#if USE_FRAMEBUFFER
+    // Plain characters up to the end of the line go out as one run
+    uint32_t max_cols = framebuffer_get_info()->width / char_width;
+    while (*str) {
+        uint32_t n = 0;
+        while (str[n] && str[n] != '\n' && str[n] != '\b' && cursor_x + n < max_cols) {
+            n++;
+        }
+        if (!n) {
+            putchar(*str++);
+            continue;
+        }
+
+        font_draw_chars(font_get_default(), cursor_x * char_width, cursor_y * char_height,
+                        str, n, current_fg, current_bg);
+        str += n;
+        cursor_x += n;
+        if (cursor_x >= max_cols) {
+            fb_newline();
+        }
+    }
+#else
     for (uint32_t i = 0; str[i] != '\0'; i++) {
         putchar(str[i]);
     }
+#endif
 }
 
 #if USE_FRAMEBUFFER
@@ -204,30 +223,51 @@ void print_hex(uint32_t num) {
 }
 
 void kernel_main(void) {
+    // Identity mapped, write-back; only changes memory types from here
+    int paging = paging_init();
+
 #if USE_FRAMEBUFFER
-    // Initialize framebuffer with QEMU default address
+    // Set the mode ourselves when the adapter allows it, with a second
+    // page to flip to; otherwise assume QEMU's default mode and address
     FramebufferInfo *fb = framebuffer_get_info();
-    fb->buffer = (uint32_t*)0xFD000000;  // QEMU default
-    fb->width = 1024;
-    fb->height = 768;
-    fb->pitch = 1024 * 4;
-    fb->bpp = 32;
+    if (vesa_bochs_set_mode(1024, 768, 32) != 0) {
+        fb->buffer = (uint32_t*)BOCHS_LFB_DEFAULT;
+        fb->base = fb->buffer;
+        fb->width = 1024;
+        fb->height = 768;
+        fb->pitch = 1024 * 4;
+        fb->bpp = 32;
+        fb->pages = 1;
+    }
+    fb->back = (uint32_t*)0x01000000;  // 3MB of RAM at 16MB, clear of the kernel
 
+    // Flushes are bulk copies, which write combining turns into bursts
+    PagingWriteCombining wc = paging_map_write_combining((uint32_t)fb->base,
+                                                         fb->pitch * fb->height * fb->pages);
+
+    // The outline font at char_height fills char_width x char_height cells,
+    // with the bitmap font as fallback
     font_init();
+    font_set_default(font_load_outline(char_height));
     clear_screen();
+    editor_resize(fb->width / char_width, fb->height / char_height);
 
     print_colored("Monad Kernel v0.0.7 (Framebuffer)\n", COLOR_CYAN, COLOR_BLACK);
     print_colored("================================\n\n", COLOR_CYAN, COLOR_BLACK);
 
     print("FB: ");
-    print_hex((uint32_t)fb->buffer);
+    print_hex((uint32_t)fb->base);
     print(" @ ");
     print_hex(fb->width);
     print("x");
     print_hex(fb->height);
+    print(fb->pages == 2 ? ", 2 pages" : "");
+    print(wc == PAGING_WC_PAT ? " (write-combining, PAT)" :
+          wc == PAGING_WC_MTRR ? " (write-combining, MTRR)" : " (uncached)");
     print("\n\n");
 #else
     // VGA text mode
+    console_init();
     clear_screen();
 
     print("Monad Kernel v0.0.7 (VGA Text)\n");
@@ -236,44 +276,70 @@ void kernel_main(void) {
 
     print("Initializing interrupts...\n");
 
-    // Initialize IDT and PIC
+    // Initialize IDT and PIC, then move to the APICs where there are some
     idt_init(idt, &idtp);
     pic_init();
+    int apic = apic_init();
+
+    // The timer queue runs on the clock, and the cursor's blink on the queue
+    int clock = clock_init();
+    timer_init();
 
 #if !USE_FRAMEBUFFER
-    // Initialize cursor BEFORE timer so it's ready when timer starts
     cursor_init();
 #endif
 
-    timer_init();
-
 #if USE_FRAMEBUFFER
-    print_colored("Interrupts initialized.\n", COLOR_GREEN, COLOR_BLACK);
-    print_colored("Timer initialized.\n", COLOR_GREEN, COLOR_BLACK);
+    print_colored(apic == 0 ? "Interrupts initialized (IOAPIC).\n" : "Interrupts initialized (8259).\n",
+                  COLOR_GREEN, COLOR_BLACK);
+    print_colored(paging == 0 ? "Paging enabled (4MB pages).\n" : "Paging unavailable (no PSE).\n",
+                  COLOR_GREEN, COLOR_BLACK);
+    print_colored(timer_backend() == TIMER_LAPIC ? "Timer initialized (LAPIC).\n" :
+                  "Timer initialized (PIT).\n", COLOR_GREEN, COLOR_BLACK);
+    print_colored(clock == 0 ? "Clock calibrated (TSC).\n" : "Clock unavailable (no TSC).\n",
+                  COLOR_GREEN, COLOR_BLACK);
     print_colored("Keyboard enabled.\n\n", COLOR_GREEN, COLOR_BLACK);
 #else
-    print("Interrupts initialized.\n");
-    print("Timer initialized.\n");
+    print(apic == 0 ? "Interrupts initialized (IOAPIC).\n" : "Interrupts initialized (8259).\n");
+    print(paging == 0 ? "Paging enabled (4MB pages).\n" : "Paging unavailable (no PSE).\n");
+    print(timer_backend() == TIMER_LAPIC ? "Timer initialized (LAPIC).\n" : "Timer initialized (PIT).\n");
+    print(clock == 0 ? "Clock calibrated (TSC).\n" : "Clock unavailable (no TSC).\n");
     print("Keyboard enabled.\n\n");
 
     cursor_set_style(CURSOR_BLOCK);
     cursor_show();  // Explicitly show cursor
 #endif
 
-    lnlisp_init();
+    lnlisp_init_image(monad_boot_image, monad_boot_image_size);
+    fasl_register_all(monad_fasl_modules, monad_fasl_sizes, monad_fasl_count);
     lnlisp_repl();
+    flush_screen();
 
     // Enable interrupts
     __asm__ volatile("sti");
 
-    // Main loop
+    // Main loop: handle every pending key event, then show the result at
+    // once and sleep until the next key or timer deadline
     while (1) {
-        if (keyboard_has_input()) {
-            char c = keyboard_getchar();
+        KeyEvent event;
+        while (keyboard_poll(&event)) {
+            char c = event.key;
+#if !USE_FRAMEBUFFER
+            if (c == KEY_PAGE_UP || c == KEY_PAGE_DOWN) {
+                console_page(c == KEY_PAGE_UP ? VGA_HEIGHT - 1 : -(VGA_HEIGHT - 1));
+                continue;
+            }
+#endif
             if (c) {
                 lnlisp_repl_input(c);
             }
         }
-        __asm__ volatile("hlt");
+        flush_screen();
+
+        __asm__ volatile("cli");
+        if (!keyboard_has_input()) {
+            timer_idle();
+        }
+        __asm__ volatile("sti");
     }
 }
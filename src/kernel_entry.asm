@@ -9,7 +9,9 @@ global _start
 section .text
 _start:
     ; We're already in protected mode with a stack
-    ; Just call the kernel
+    ; Reset the FPU (round to nearest, exceptions masked) for the reader's
+    ; floats, then call the kernel
+    fninit
     call kernel_main
 
     ; If it returns, hang
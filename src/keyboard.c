@@ -1,12 +1,12 @@
 /*
  * @file keyboard.c
- * @version 0.0.3
+ * @version 0.0.6
  * Keyboard driver
  */
 
 #include "keyboard.h"
-#include "cursor.h"
 #include "timer.h"
+#include "apic.h"
 
 // Port I/O
 static inline void outb(uint16_t port, uint8_t val) {
@@ -23,11 +23,15 @@ static inline uint8_t inb(uint16_t port) {
 static uint8_t shift_pressed = 0;
 static uint8_t ctrl_pressed = 0;
 
-// Input buffer
-#define BUFFER_SIZE 256
-static char input_buffer[BUFFER_SIZE];
-static uint32_t buffer_head = 0;
-static uint32_t buffer_tail = 0;
+static uint8_t extended = 0;      // The last byte was SCANCODE_EXTENDED
+static uint8_t pause_bytes = 0;   // Left of a Pause sequence, to skip
+
+// Events from the interrupt to the main loop. Single producer, single
+// consumer: the handler only moves head and the loop only moves tail, so
+// neither side needs interrupts off. Both count up and wrap freely.
+static KeyEvent queue[KEY_QUEUE_SIZE];
+static uint32_t queue_head = 0;
+static uint32_t queue_tail = 0;
 
 // Initialize IDT
 void idt_init(struct idt_entry* idt, struct idt_ptr* idtp) {
@@ -59,6 +63,14 @@ void idt_init(struct idt_entry* idt, struct idt_ptr* idtp) {
     idt[0x21].zero = 0;
     idt[0x21].flags = 0x8E;
 
+    // Set the local APIC's spurious vector, in case apic_init enables it
+    uint32_t spurious_addr = (uint32_t)spurious_handler;
+    idt[APIC_SPURIOUS_VECTOR].base_low = spurious_addr & 0xFFFF;
+    idt[APIC_SPURIOUS_VECTOR].base_high = (spurious_addr >> 16) & 0xFFFF;
+    idt[APIC_SPURIOUS_VECTOR].selector = 0x08;
+    idt[APIC_SPURIOUS_VECTOR].zero = 0;
+    idt[APIC_SPURIOUS_VECTOR].flags = 0x8E;
+
     // Load IDT
     idt_load(idtp);
 }
@@ -86,69 +98,94 @@ void pic_init(void) {
     outb(0xA1, 0xFF);
 }
 
+// What a press of code types, before Ctrl; extended codes are 0xE0xx
+static char translate(uint16_t code) {
+    switch (code & 0x7F) {
+        case SCANCODE_PAGE_UP:   return KEY_PAGE_UP;
+        case SCANCODE_PAGE_DOWN: return KEY_PAGE_DOWN;
+        case SCANCODE_UP:        return KEY_UP;
+        case SCANCODE_DOWN:      return KEY_DOWN;
+        case SCANCODE_LEFT:      return KEY_LEFT;
+        case SCANCODE_RIGHT:     return KEY_RIGHT;
+    }
+
+    // Of the other extended keys only keypad Enter and / type anything
+    if (code & 0xE000) {
+        code &= 0x7F;
+        return code == 0x1C || code == 0x35 ? scancode_to_ascii[code] : 0;
+    }
+    return shift_pressed ? scancode_to_ascii_shift[code] : scancode_to_ascii[code];
+}
+
 // Keyboard interrupt handler
 void keyboard_handler(void) {
     uint8_t scancode = inb(0x60);
 
-    // Reset cursor blink on any key event
-    cursor_reset_blink();
-
-    // Handle Ctrl press
-    if (scancode == SCANCODE_LCTRL) {
-        ctrl_pressed = 1;
+    if (pause_bytes) {
+        pause_bytes--;
         return;
     }
-
-    // Handle Ctrl release
-    if (scancode == SCANCODE_LCTRL_REL) {
-        ctrl_pressed = 0;
+    if (scancode == SCANCODE_PAUSE) {
+        pause_bytes = 5;
         return;
     }
-
-    // Handle shift press
-    if (scancode == SCANCODE_LSHIFT || scancode == SCANCODE_RSHIFT) {
-        shift_pressed = 1;
+    if (scancode == SCANCODE_EXTENDED) {
+        extended = 1;
         return;
     }
 
-    // Handle shift release
-    if (scancode == SCANCODE_LSHIFT_REL || scancode == SCANCODE_RSHIFT_REL) {
-        shift_pressed = 0;
-        return;
-    }
+    uint16_t code = scancode & 0x7F;
+    uint8_t released = scancode & SCANCODE_RELEASE;
+    if (extended) {
+        extended = 0;
 
-    // Only handle key press (scancode < 0x80)
-    if (scancode < 0x80) {
-        char c = shift_pressed ? scancode_to_ascii_shift[scancode] : scancode_to_ascii[scancode];
-        if (c) {
-            // If Ctrl is pressed, convert to control character
-            if (ctrl_pressed && c >= 'a' && c <= 'z') {
-                c = c - 'a' + 1;
-            }
-
-            // Add to buffer
-            uint32_t next_head = (buffer_head + 1) % BUFFER_SIZE;
-            if (next_head != buffer_tail) {
-                input_buffer[buffer_head] = c;
-                buffer_head = next_head;
-            }
+        // The fake shifts some keyboards wrap around extended keys
+        if (code == SCANCODE_LSHIFT || code == SCANCODE_RSHIFT) {
+            return;
         }
+        code |= SCANCODE_EXTENDED << 8;
+    }
+
+    // Modifiers, left and right alike
+    if ((code & 0x7F) == SCANCODE_LCTRL) {
+        ctrl_pressed = !released;
+    } else if (code == SCANCODE_LSHIFT || code == SCANCODE_RSHIFT) {
+        shift_pressed = !released;
+    }
+
+    char c = released ? 0 : translate(code);
+
+    // If Ctrl is pressed, convert to control character
+    if (ctrl_pressed && c >= 'a' && c <= 'z') {
+        c = c - 'a' + 1;
     }
+
+    // Full: the newest event is the one lost
+    uint32_t head = queue_head;
+    if (head - __atomic_load_n(&queue_tail, __ATOMIC_ACQUIRE) == KEY_QUEUE_SIZE) {
+        return;
+    }
+
+    KeyEvent *event = &queue[head % KEY_QUEUE_SIZE];
+    event->time = timer_now();
+    event->scancode = code;
+    event->released = released != 0;
+    event->key = c;
+    __atomic_store_n(&queue_head, head + 1, __ATOMIC_RELEASE);
 }
 
 // Check if input is available
 uint8_t keyboard_has_input(void) {
-    return buffer_head != buffer_tail;
+    return __atomic_load_n(&queue_head, __ATOMIC_ACQUIRE) != queue_tail;
 }
 
-// Get character from buffer
-char keyboard_getchar(void) {
-    if (buffer_head == buffer_tail) {
+int keyboard_poll(KeyEvent *event) {
+    uint32_t tail = queue_tail;
+    if (__atomic_load_n(&queue_head, __ATOMIC_ACQUIRE) == tail) {
         return 0;
     }
 
-    char c = input_buffer[buffer_tail];
-    buffer_tail = (buffer_tail + 1) % BUFFER_SIZE;
-
-    return c;
+    *event = queue[tail % KEY_QUEUE_SIZE];
+    __atomic_store_n(&queue_tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
 }
@@ -1,14 +1,19 @@
 /*
  * @file keyboard.h
- * @version 0.0.3
+ * @version 0.0.7
  * Keyboard driver and interrupt structures
  */
 #ifndef KEYBOARD_H
 #define KEYBOARD_H
 
+#if __STDC_HOSTED__
+#include <stdint.h>  // editor.c is built on the host too
+#else
 typedef unsigned char uint8_t;
 typedef unsigned short uint16_t;
 typedef unsigned int uint32_t;
+typedef unsigned long long uint64_t;
+#endif
 
 // IDT entry structure
 struct idt_entry {
@@ -32,18 +37,41 @@ struct idt_ptr {
 #define KEY_CTRL_F  6
 #define KEY_CTRL_K  11
 #define KEY_CTRL_D  4
+#define KEY_CTRL_N  14
+#define KEY_CTRL_P  16
+#define KEY_CTRL_U  21
+#define KEY_CTRL_Y  25
+
+// Keys with no ASCII code, above the 7-bit range
+#define KEY_PAGE_UP   ((char)0x80)
+#define KEY_PAGE_DOWN ((char)0x81)
+#define KEY_UP        ((char)0x82)
+#define KEY_DOWN      ((char)0x83)
+#define KEY_LEFT      ((char)0x84)
+#define KEY_RIGHT     ((char)0x85)
+
+// One key going down or up, in the order the controller sent them
+typedef struct {
+    uint64_t time;      // timer_now() when the interrupt came in
+    uint16_t scancode;  // Set 1 make code, 0xE0xx for extended keys
+    uint8_t released;
+    char key;           // What a press types (ASCII or KEY_*); 0 otherwise
+} KeyEvent;
+
+#define KEY_QUEUE_SIZE 256  // Power of two
 
 // External assembly functions
 extern void idt_load(struct idt_ptr* idt_ptr);
 extern void irq0_handler(void);  // Timer
 extern void irq1_handler(void);  // Keyboard
+extern void spurious_handler(void);  // Local APIC spurious vector
 
 // Function declarations
 void idt_init(struct idt_entry* idt, struct idt_ptr* idtp);
 void pic_init(void);
 void keyboard_handler(void);
 uint8_t keyboard_has_input(void);
-char keyboard_getchar(void);
+int keyboard_poll(KeyEvent *event);  // 1 with the oldest event, 0 if none
 
 // Scancode definitions
 #define SCANCODE_LSHIFT     0x2A
@@ -54,6 +82,15 @@ char keyboard_getchar(void);
 #define SCANCODE_RCTRL      0x1D
 #define SCANCODE_LCTRL_REL  0x9D
 #define SCANCODE_RCTRL_REL  0x9D
+#define SCANCODE_PAGE_UP    0x49
+#define SCANCODE_PAGE_DOWN  0x51
+#define SCANCODE_UP         0x48
+#define SCANCODE_DOWN       0x50
+#define SCANCODE_LEFT       0x4B
+#define SCANCODE_RIGHT      0x4D
+#define SCANCODE_EXTENDED   0xE0
+#define SCANCODE_PAUSE      0xE1  // Starts the six bytes Pause sends
+#define SCANCODE_RELEASE    0x80
 
 // Scancode to ASCII tables
 static const char scancode_to_ascii[128] = {
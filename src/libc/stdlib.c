@@ -0,0 +1,356 @@
+/*
+ * @file stdlib.c
+ */
+
+#include "stdlib.h"
+
+typedef unsigned int uint32_t;
+typedef unsigned long long uint64_t;
+
+/* BIG INTEGERS */
+
+// Just enough arbitrary precision for the exact comparisons in strtod:
+// the largest operand is an 800 digit significand times 5^310.
+#define BIG_LIMBS 128
+
+typedef struct {
+    uint32_t limb[BIG_LIMBS];  // Little-endian
+    int size;                  // Limbs in use, no leading zero limbs
+} Big;
+
+static void big_set(Big *b, uint64_t value) {
+    b->limb[0] = (uint32_t)value;
+    b->limb[1] = (uint32_t)(value >> 32);
+    b->size = b->limb[1] ? 2 : (b->limb[0] ? 1 : 0);
+}
+
+// b = b * factor + add
+static void big_mul_add(Big *b, uint32_t factor, uint32_t add) {
+    uint32_t carry = add;
+    for (int i = 0; i < b->size; i++) {
+        uint64_t t = (uint64_t)b->limb[i] * factor + carry;
+        b->limb[i] = (uint32_t)t;
+        carry = (uint32_t)(t >> 32);
+    }
+    if (carry && b->size < BIG_LIMBS) {
+        b->limb[b->size++] = carry;
+    }
+}
+
+static void big_mul_pow5(Big *b, int n) {
+    // 5^13 is the largest power of five that fits a limb
+    while (n >= 13) {
+        big_mul_add(b, 1220703125u, 0);
+        n -= 13;
+    }
+    uint32_t factor = 1;
+    while (n-- > 0) factor *= 5;
+    big_mul_add(b, factor, 0);
+}
+
+static void big_shl(Big *b, int bits) {
+    if (b->size == 0 || bits == 0) return;
+
+    int limbs = bits / 32;
+    int shift = bits % 32;
+
+    if (shift) {
+        uint32_t carry = 0;
+        for (int i = 0; i < b->size; i++) {
+            uint32_t v = b->limb[i];
+            b->limb[i] = (v << shift) | carry;
+            carry = v >> (32 - shift);
+        }
+        if (carry && b->size < BIG_LIMBS) {
+            b->limb[b->size++] = carry;
+        }
+    }
+
+    if (limbs) {
+        if (b->size + limbs > BIG_LIMBS) limbs = BIG_LIMBS - b->size;
+        for (int i = b->size - 1; i >= 0; i--) {
+            b->limb[i + limbs] = b->limb[i];
+        }
+        for (int i = 0; i < limbs; i++) {
+            b->limb[i] = 0;
+        }
+        b->size += limbs;
+    }
+}
+
+static int big_cmp(const Big *a, const Big *b) {
+    if (a->size != b->size) return a->size < b->size ? -1 : 1;
+    for (int i = a->size - 1; i >= 0; i--) {
+        if (a->limb[i] != b->limb[i]) return a->limb[i] < b->limb[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+/* DOUBLE HELPERS */
+
+typedef union {
+    double d;
+    uint64_t bits;
+} DoubleBits;
+
+static double u64_to_double(uint64_t v) {
+    // Exact below 2^53, rounded once above; avoids a libgcc call on i386
+    return (double)(uint32_t)(v >> 32) * 4294967296.0 + (double)(uint32_t)v;
+}
+
+static const double pow10_small[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static const double pow10_big[] = {
+    1e1, 1e2, 1e4, 1e8, 1e16, 1e32, 1e64, 1e128, 1e256,
+};
+
+// v * 10^e to within a few units in the last place
+static double scale_pow10(double v, int e) {
+    int n = e < 0 ? -e : e;
+    for (int i = 0; n; i++, n >>= 1) {
+        if (n & 1) {
+            v = e < 0 ? v / pow10_big[i] : v * pow10_big[i];
+        }
+    }
+    return v;
+}
+
+// The x87 keeps 64 bits of mantissa, so products would be rounded twice
+// (to 64 bits, then to 53 when stored). Clinger's fast path needs a single
+// rounding, so it runs with the precision control set to double.
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(__SSE2_MATH__)
+#define X87_PRECISION 1
+#endif
+
+static double exact_mul_pow10(double v, int e) {
+#ifdef X87_PRECISION
+    unsigned short saved, dbl;
+    __asm__ volatile ("fnstcw %0" : "=m"(saved));
+    dbl = (unsigned short)((saved & ~0x300) | 0x200);
+    __asm__ volatile ("fldcw %0" : : "m"(dbl));
+#endif
+
+    volatile double a = v;
+    volatile double p = pow10_small[e < 0 ? -e : e];
+    volatile double r = e < 0 ? a / p : a * p;
+
+#ifdef X87_PRECISION
+    __asm__ volatile ("fldcw %0" : : "m"(saved));
+#endif
+    return r;
+}
+
+/* STRTOD */
+
+#define MAX_DIGITS 800  // Enough to decide any halfway case
+
+static int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int match_word(const char *s, const char *word) {
+    for (; *word; s++, word++) {
+        char c = *s;
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        if (c != *word) return 0;
+    }
+    return 1;
+}
+
+// Compare digits * 10^e against mid * 2^q exactly
+static int compare_midpoint(const Big *scaled, int e, uint64_t mid, int q) {
+    Big x = *scaled;
+    Big h;
+    big_set(&h, mid);
+
+    // scaled already holds digits * 5^e for e >= 0
+    if (e < 0) big_mul_pow5(&h, -e);
+
+    if (e > q) {
+        big_shl(&x, e - q);
+    } else {
+        big_shl(&h, q - e);
+    }
+    return big_cmp(&x, &h);
+}
+
+// Nudge an approximation to the correctly rounded value of digits * 10^e
+static double correct_rounding(const char *digits, int ndigits, int e, double z) {
+    Big scaled;
+    big_set(&scaled, 0);
+    for (int i = 0; i < ndigits; i++) {
+        if (scaled.size == 0) {
+            big_set(&scaled, (uint64_t)(digits[i] - '0'));
+        } else {
+            big_mul_add(&scaled, 10, (uint32_t)(digits[i] - '0'));
+        }
+    }
+    if (e > 0) big_mul_pow5(&scaled, e);
+
+    DoubleBits start;
+    start.d = z;
+    if (z != z || z < 0) {
+        z = 0;
+    } else if (((start.bits >> 52) & 0x7FF) == 0x7FF) {
+        start.bits = 0x7FEFFFFFFFFFFFFFull; // Overflowed, start from the largest
+        z = start.d;
+    }
+
+    for (int round = 0; round < 64; round++) {
+        DoubleBits v;
+        v.d = z;
+        uint32_t biased = (uint32_t)(v.bits >> 52) & 0x7FF;
+        if (biased == 0x7FF) return z; // Stepped past the largest double
+
+        // z = m * 2^k
+        uint64_t m = v.bits & 0xFFFFFFFFFFFFFull;
+        int k = -1074;
+        if (biased) {
+            m |= 1ull << 52;
+            k = (int)biased - 1075;
+        }
+
+        // Above the midpoint to the next double up
+        int c = compare_midpoint(&scaled, e, 2 * m + 1, k - 1);
+        if (c > 0 || (c == 0 && (m & 1))) {
+            v.bits++;
+            z = v.d;
+            continue;
+        }
+
+        // Below the midpoint to the next double down, which is closer
+        // when z is a power of two
+        if (m == 0) return z;
+        c = (m == 1ull << 52 && biased > 1)
+            ? compare_midpoint(&scaled, e, 4 * m - 1, k - 2)
+            : compare_midpoint(&scaled, e, 2 * m - 1, k - 1);
+        if (c < 0 || (c == 0 && (m & 1))) {
+            v.bits--;
+            z = v.d;
+            continue;
+        }
+
+        return z;
+    }
+    return z;
+}
+
+double strtod(const char *str, char **endptr) {
+    const char *s = str;
+    while (*s == ' ' || (*s >= '\t' && *s <= '\r')) s++;
+
+    int negative = 0;
+    if (*s == '-' || *s == '+') {
+        negative = *s == '-';
+        s++;
+    }
+
+    if (match_word(s, "inf") || match_word(s, "nan")) {
+        DoubleBits v;
+        v.bits = match_word(s, "nan") ? 0x7FF8000000000000ull : 0x7FF0000000000000ull;
+        s += match_word(s, "infinity") ? 8 : 3;
+        if (endptr) *endptr = (char*)s;
+        return negative ? -v.d : v.d;
+    }
+
+    // Significant digits, value = digits * 10^exp10
+    char digits[MAX_DIGITS + 1];
+    int ndigits = 0;
+    int exp10 = 0;
+    int sticky = 0;   // Nonzero digits dropped past MAX_DIGITS
+    int any = 0;
+
+    for (; is_digit(*s); s++) {
+        any = 1;
+        if (ndigits == 0 && *s == '0') continue;
+        if (ndigits < MAX_DIGITS) {
+            digits[ndigits++] = *s;
+        } else {
+            exp10++;
+            sticky |= *s != '0';
+        }
+    }
+
+    if (*s == '.' && (any || is_digit(s[1]))) {
+        for (s++; is_digit(*s); s++) {
+            any = 1;
+            if (ndigits == 0 && *s == '0') {
+                exp10--;
+            } else if (ndigits < MAX_DIGITS) {
+                digits[ndigits++] = *s;
+                exp10--;
+            } else {
+                sticky |= *s != '0';
+            }
+        }
+    }
+
+    if (!any) {
+        if (endptr) *endptr = (char*)str;
+        return 0.0;
+    }
+
+    if ((*s == 'e' || *s == 'E')) {
+        const char *p = s + 1;
+        int exp_negative = 0;
+        if (*p == '-' || *p == '+') {
+            exp_negative = *p == '-';
+            p++;
+        }
+        if (is_digit(*p)) {
+            int n = 0;
+            for (; is_digit(*p); p++) {
+                if (n < 100000) n = n * 10 + (*p - '0');
+            }
+            exp10 += exp_negative ? -n : n;
+            s = p;
+        }
+    }
+
+    if (endptr) *endptr = (char*)s;
+
+    while (ndigits > 0 && digits[ndigits - 1] == '0') {
+        ndigits--;
+        exp10++;
+    }
+
+    double zero = negative ? -0.0 : 0.0;
+    if (ndigits == 0) return zero;
+
+    // A dropped tail only has to break ties, a trailing 1 does that
+    if (sticky) {
+        digits[ndigits++] = '1';
+        exp10--;
+    }
+
+    // Out of range: at least 1e309, or below 1e-324 (under half the
+    // smallest subnormal)
+    if (ndigits + exp10 > 309) {
+        DoubleBits inf;
+        inf.bits = 0x7FF0000000000000ull;
+        return negative ? -inf.d : inf.d;
+    }
+    if (ndigits + exp10 <= -324) return zero;
+
+    // Leading 19 digits always fit in 64 bits
+    int lead = ndigits < 19 ? ndigits : 19;
+    uint64_t mant = 0;
+    for (int i = 0; i < lead; i++) {
+        mant = mant * 10 + (uint64_t)(digits[i] - '0');
+    }
+
+    // Fast path: mantissa and power of ten are both exact doubles, so one
+    // multiply or divide gives the correctly rounded result
+    double result;
+    if (ndigits == lead && mant <= (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+        result = exact_mul_pow10(u64_to_double(mant), exp10);
+    } else {
+        double approx = scale_pow10(u64_to_double(mant), exp10 + (ndigits - lead));
+        result = correct_rounding(digits, ndigits, exp10, approx);
+    }
+
+    return negative ? -result : result;
+}
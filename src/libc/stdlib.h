@@ -0,0 +1,16 @@
+/*
+ * @file stdlib.h
+ */
+
+#ifndef STDLIB_H
+#define STDLIB_H
+
+/*
+ * @brief strtod(str, endptr)
+ * @details Decimal only (no hex floats), accepts inf/infinity/nan.
+ *          The result is correctly rounded (round half to even); values
+ *          too large become infinity, values too small become zero.
+ */
+double strtod(const char *str, char **endptr);
+
+#endif // STDLIB_H
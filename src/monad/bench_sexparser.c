@@ -0,0 +1,206 @@
+/*
+ * @file bench_sexparser.c
+ * @version 0.0.2
+ * Parser throughput benchmark (hosted)
+ *
+ * Generates a corpus of indented, commented Monad source and reports how
+ * many MB/s the reader gets through: from one string, fed in chunks to a
+ * streaming parser, and into flat nodes. The allocator only counts, so
+ * the numbers are for the lexer and parser alone.
+ *
+ * Usage: bench-sexparser [CORPUS_MB]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sexparser.h"
+
+#define CHUNK_SIZE 4096
+#define ROUNDS 5
+
+static unsigned long cells = 0;
+static char dummy;
+
+static void* cb_nil(void)              { return &dummy; }
+static void* cb_bool(int v)            { (void)v; return &dummy; }
+static void* cb_int(int32_t v)         { (void)v; return &dummy; }
+static void* cb_sym(const char *n)     { (void)n; return &dummy; }
+static void* cb_cons(void *a, void *b) { (void)a; (void)b; cells++; return &dummy; }
+
+static void* cb_sym_span(const char *n, int len, uint32_t hash) {
+    (void)n;
+    (void)len;
+    (void)hash;
+    return &dummy;
+}
+
+static void* cb_number(const SexpNumber *n) {
+    (void)n;
+    return &dummy;
+}
+
+static void cb_set_cdr(void *cons, void *cdr) {
+    (void)cons;
+    (void)cdr;
+}
+
+static void* cb_grow_stack(void *stack, uint32_t bytes) {
+    return realloc(stack, bytes);
+}
+
+static const SexpAllocator allocator = {
+    cb_nil, cb_bool, cb_int, cb_sym, cb_cons, cb_set_cdr, cb_grow_stack, cb_sym_span, cb_number
+};
+
+static const char *words[] = {
+    "define", "lambda", "if", "car", "cdr", "cons", "list", "null?",
+    "reverse-onto", "acc", "xs", "x", "+", "-", "*", "=", "page-bitmap",
+    "alloc-page", "map-page", "vaddr", "paddr", "schedule",
+};
+
+// Pseudo-random but reproducible source, roughly like hand-written code
+static char* generate(size_t size) {
+    char *buf = malloc(size + 256);
+    size_t len = 0;
+    unsigned seed = 12345;
+    int depth = 0;
+
+    while (len < size) {
+        seed = seed * 1103515245u + 12345u;
+        unsigned r = (seed >> 16) % 100;
+
+        if (r < 4 && depth == 0) {
+            len += sprintf(buf + len, ";; section %u - generated commentary line\n", seed % 1000);
+        } else if (r < 30 && depth < 12) {
+            len += sprintf(buf + len, "\n%*s(", depth * 2, "");
+            depth++;
+        } else if (r < 55 && depth > 0) {
+            buf[len++] = ')';
+            depth--;
+            if (depth == 0) buf[len++] = '\n';
+        } else if (r < 75) {
+            len += sprintf(buf + len, " %d", (int)(seed % 100000) - 50000);
+        } else {
+            len += sprintf(buf + len, " %s", words[seed % (sizeof(words) / sizeof(words[0]))]);
+        }
+    }
+
+    while (depth-- > 0) buf[len++] = ')';
+    buf[len] = '\0';
+    return buf;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parse_string(const char *src) {
+    SexpParser parser;
+    sexp_parser_init(&parser, src);
+
+    int datums = 0;
+    while (sexp_has_more(&parser)) {
+        sexp_parse(&parser, &allocator);
+        if (parser.error_code != SEXP_OK) {
+            fprintf(stderr, "parse error: %s\n", sexp_get_error(&parser));
+            exit(1);
+        }
+        datums++;
+    }
+    return datums;
+}
+
+static int parse_flat(const char *src) {
+    static SexpNode nodes[1024 * 1024];
+    SexpParser parser;
+    sexp_parser_init(&parser, src);
+
+    int datums = 0;
+    while (sexp_has_more(&parser)) {
+        if (sexp_parse_flat(&parser, &allocator, nodes, sizeof(nodes) / sizeof(nodes[0])) < 0) {
+            fprintf(stderr, "parse error: %s\n", sexp_get_error(&parser));
+            exit(1);
+        }
+        datums++;
+    }
+    return datums;
+}
+
+static int parse_stream(const char *src, size_t size) {
+    static char buffer[1024 * 1024];
+    SexpParser parser;
+    sexp_parser_init_stream(&parser, buffer, sizeof(buffer));
+
+    int datums = 0;
+    for (size_t off = 0; ; off += CHUNK_SIZE) {
+        if (off < size) {
+            size_t n = size - off < CHUNK_SIZE ? size - off : CHUNK_SIZE;
+            if (sexp_feed(&parser, src + off, (int)n) == SEXP_ERROR_BUFFER_FULL) {
+                fprintf(stderr, "stream buffer full\n");
+                exit(1);
+            }
+        } else {
+            sexp_finish(&parser);
+        }
+
+        while (1) {
+            sexp_parse(&parser, &allocator);
+            if (parser.error_code == SEXP_NEED_MORE) break;
+            if (parser.error_code != SEXP_OK) {
+                fprintf(stderr, "parse error: %s\n", sexp_get_error(&parser));
+                exit(1);
+            }
+            datums++;
+        }
+
+        if (off >= size) break;
+    }
+    return datums;
+}
+
+int main(int argc, char **argv) {
+    size_t mb = argc > 1 ? (size_t)atoi(argv[1]) : 16;
+    size_t size = mb * 1024 * 1024;
+    char *src = generate(size);
+    size = strlen(src);
+
+    double best_string = 0, best_stream = 0, best_flat = 0;
+    int datums = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        double t0 = now();
+        datums = parse_string(src);
+        double t1 = now();
+        int streamed = parse_stream(src, size);
+        double t2 = now();
+        int flat = parse_flat(src);
+        double t3 = now();
+
+        if (streamed != datums || flat != datums) {
+            fprintf(stderr, "stream parsed %d datums, flat %d, string %d\n", streamed, flat, datums);
+            return 1;
+        }
+
+        double string_mbs = size / (t1 - t0) / (1024 * 1024);
+        double stream_mbs = size / (t2 - t1) / (1024 * 1024);
+        double flat_mbs = size / (t3 - t2) / (1024 * 1024);
+        if (string_mbs > best_string) best_string = string_mbs;
+        if (stream_mbs > best_stream) best_stream = stream_mbs;
+        if (flat_mbs > best_flat) best_flat = flat_mbs;
+    }
+
+    printf("corpus: %zu bytes, %d datums, %lu cells\n", size, datums, cells / (2 * ROUNDS));
+    printf("string: %8.1f MB/s\n", best_string);
+    printf("stream: %8.1f MB/s\n", best_stream);
+    printf("flat:   %8.1f MB/s\n", best_flat);
+
+    free(src);
+    return 0;
+}
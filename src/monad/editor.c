@@ -0,0 +1,651 @@
+/*
+ * @file editor.c
+ * @version 0.0.2
+ * REPL input editor
+ */
+
+#include "editor.h"
+#include "../cursor.h"
+#include "../keyboard.h"
+
+extern void putchar(char c);
+extern void print_styled_at(const char *text, uint32_t count, uint8_t style, uint32_t x, uint32_t y);
+
+static uint32_t screen_columns = 80;
+static uint32_t screen_rows = 25;
+
+static const char blanks[] = "                                ";
+#define BLANKS ((int)sizeof(blanks) - 1)
+
+/// STATE
+
+// The input, with the gap at the cursor
+static char buffer[EDITOR_CAPACITY];
+static int gap_start = 0;
+static int gap_end = EDITOR_CAPACITY;
+
+// Tokens and what lies before the cursor; its cursor is always gap_start
+static Highlighter highlight;
+
+static int lines = 1;
+static int origin = 0;   // Screen row of line 0, negative once scrolled off
+static int view = 0;     // First column shown of the cursor's line
+static int match = -1;   // Paren drawn as the match
+
+// Kill buffer; consecutive kills add to it
+static char killed[EDITOR_CAPACITY];
+static int killed_length = 0;
+static int killing = 0;
+
+// History ring: entries share a ring of text, and an entry is gone once
+// either ring has come round over it
+typedef struct {
+    uint32_t start;   // In history_bytes terms
+    uint32_t length;
+} HistoryEntry;
+
+static char history_text[EDITOR_HISTORY_BYTES];
+static uint32_t history_bytes = 0;   // Written so far
+static HistoryEntry history[EDITOR_HISTORY];
+static uint32_t history_count = 0;   // Added so far
+static uint32_t history_pos = 0;     // Entry shown, history_count for the draft
+static char draft[EDITOR_CAPACITY];  // What was typed before browsing
+static int draft_length = 0;
+static char recalled[EDITOR_CAPACITY];
+
+/// GAP BUFFER
+
+static inline int text_length(void) {
+    return gap_start + (EDITOR_CAPACITY - gap_end);
+}
+
+static inline char char_at(int pos) {
+    return pos < gap_start ? buffer[pos] : buffer[pos + gap_end - gap_start];
+}
+
+static inline const char* bytes_at(int pos) {
+    return pos < gap_start ? buffer + pos : buffer + pos + gap_end - gap_start;
+}
+
+static HighlightText text_view(void) {
+    HighlightText t = { buffer, gap_start, buffer + gap_end, EDITOR_CAPACITY - gap_end };
+    return t;
+}
+
+static inline int cursor_line(void) {
+    return highlight.line;
+}
+
+static inline int line_start(void) {
+    return highlight.line_starts[highlight.line];
+}
+
+// Moves the gap, and the cursor with it
+static void move_to(int pos) {
+    while (gap_start > pos) {
+        buffer[--gap_end] = buffer[--gap_start];
+    }
+    while (gap_start < pos) {
+        buffer[gap_start++] = buffer[gap_end++];
+    }
+    highlight_move(&highlight, pos);
+}
+
+// End of the line holding pos, before its newline
+static int line_end(int pos) {
+    int length = text_length();
+    while (pos < length && char_at(pos) != '\n') pos++;
+    return pos;
+}
+
+// Line and line start of any offset: looked up before the cursor, counted
+// forward from it after
+static void locate(int pos, int *index, int *start) {
+    if (pos < gap_start) {
+        *index = highlight_line_of(&highlight, pos);
+        *start = highlight.line_starts[*index];
+        return;
+    }
+
+    *index = cursor_line();
+    *start = line_start();
+    for (int p = gap_start; p < pos; p++) {
+        if (char_at(p) == '\n') {
+            (*index)++;
+            *start = p + 1;
+        }
+    }
+}
+
+/// DRAWING
+
+static inline int text_columns(void) {
+    return (int)screen_columns - EDITOR_PROMPT_LEN;
+}
+
+static void clear_row(uint32_t x, int y) {
+    while (x < screen_columns) {
+        uint32_t n = screen_columns - x < BLANKS ? screen_columns - x : BLANKS;
+        print_styled_at(blanks, n, HL_PLAIN, x, (uint32_t)y);
+        x += n;
+    }
+}
+
+// Columns [col, to) of a line (to < 0 for all of it) in their colors,
+// blanking the rest of the row if clear is set
+static void draw_line(int index, int start, int col, int to, int clear) {
+    int y = origin + index;
+    if (y < 0 || y >= (int)screen_rows) {
+        return;
+    }
+
+    int first = index == cursor_line() ? view : 0;
+    int last = first + text_columns();
+    if (to < 0 || to > last) to = last;
+    if (col < first) col = first;
+
+    int pos = start + col;
+    int end = pos;
+    int length = text_length();
+    while (end < start + to && end < length && char_at(end) != '\n') end++;
+
+    uint32_t x = EDITOR_PROMPT_LEN + (pos - start) - first;
+    while (pos < end) {
+        int run_end;
+        HighlightStyle style = highlight_run(&highlight, pos, end, &run_end);
+        if (pos < gap_start && run_end > gap_start) {
+            run_end = gap_start;
+        }
+        if (match >= pos && match < run_end) {
+            if (match == pos) {
+                style = HL_MATCH;
+                run_end = pos + 1;
+            } else {
+                run_end = match;
+            }
+        }
+        print_styled_at(bytes_at(pos), run_end - pos, style, x, (uint32_t)y);
+        x += run_end - pos;
+        pos = run_end;
+    }
+
+    if (clear) {
+        clear_row(x, y);
+    }
+}
+
+static void draw_offset(int pos) {
+    int index, start;
+    locate(pos, &index, &start);
+    draw_line(index, start, pos - start, pos - start + 1, 0);
+}
+
+// A line from col on, then every line after it with its prompt, and the
+// rows of vacated lines below those cleared
+static void redraw_from(int index, int start, int col, int vacated) {
+    draw_line(index, start, col, -1, 1);
+
+    for (int i = index + 1; i < lines; i++) {
+        start = line_end(start) + 1;
+        int y = origin + i;
+        if (y >= 0 && y < (int)screen_rows) {
+            print_styled_at("...> ", EDITOR_PROMPT_LEN, HL_PLAIN, 0, (uint32_t)y);
+        }
+        draw_line(i, start, 0, -1, 1);
+    }
+
+    for (int i = lines; i < lines + vacated; i++) {
+        int y = origin + i;
+        if (y >= 0 && y < (int)screen_rows) {
+            clear_row(0, y);
+        }
+    }
+}
+
+// Scroll the screen until the last line fits, or, once the input fills
+// it, only as far as the cursor's line needs
+static void make_room(void) {
+    while (origin + lines > (int)screen_rows &&
+           (origin > 0 || origin + cursor_line() >= (int)screen_rows)) {
+        cursor_y = screen_rows - 1;
+        putchar('\n');
+        origin--;
+    }
+}
+
+// Every row the input covers, with its prompts; only once the input fills
+// the screen, since the rows above it are not the editor's
+static void redraw_screen(void) {
+    int start = 0;
+    for (int i = 0; i < lines && origin + i < (int)screen_rows; i++) {
+        if (origin + i >= 0) {
+            print_styled_at(i ? "...> " : "LNL> ", EDITOR_PROMPT_LEN, HL_PLAIN, 0, (uint32_t)(origin + i));
+            draw_line(i, start, 0, -1, 1);
+        }
+        start = line_end(start) + 1;
+    }
+    for (int y = origin + lines < 0 ? 0 : origin + lines; y < (int)screen_rows; y++) {
+        clear_row(0, y);
+    }
+}
+
+// An input taller than the screen is shown through it: move the view so
+// the cursor's line is on it and no rows go unused below the last line
+static void follow_cursor(void) {
+    int rows = (int)screen_rows;
+    int top = origin;
+    if (top < 0 && top + lines < rows) {
+        top = lines < rows ? 0 : rows - lines;
+    }
+    if (top + cursor_line() < 0) {
+        top = -cursor_line();
+    } else if (top + cursor_line() >= rows) {
+        top = rows - 1 - cursor_line();
+    }
+    if (top != origin) {
+        origin = top;
+        redraw_screen();
+    }
+}
+
+// Scroll the cursor's line sideways if the cursor left what it shows;
+// 1 if it did, and the line needs drawing in full
+static int adjust_view(void) {
+    int col = gap_start - line_start();
+    int width = text_columns();
+    if (col >= view && col < view + width) {
+        return 0;
+    }
+    view = col >= width ? col - width / 2 : 0;
+    return 1;
+}
+
+// Put the screen cursor where the gap is and follow it with the match
+static void place_cursor(void) {
+    follow_cursor();
+    cursor_x = EDITOR_PROMPT_LEN + (gap_start - line_start()) - view;
+    cursor_y = (uint32_t)(origin + cursor_line());
+
+    int m = highlight_match(&highlight);
+    if (m != match) {
+        int old = match;
+        match = m;
+        if (old >= 0 && old < text_length()) draw_offset(old);
+        if (m >= 0) draw_offset(m);
+    }
+}
+
+/// EDITING
+
+static int relex(int at, int removed, int inserted) {
+    HighlightText t = text_view();
+    int relexed_end;
+    return highlight_edit(&highlight, &t, at, removed, inserted, &relexed_end);
+}
+
+// Redraw after an edit on the cursor's line from offset from on, and the
+// rows below too when lines went
+static void show_edit(int from, int clear, int vacated) {
+    int start = line_start();
+    if (vacated) {
+        // The line shown sideways before may be shown from its start now
+        int old_view = view;
+        view = 0;
+        adjust_view();
+        if (view != old_view) from = start;
+        make_room();
+        redraw_from(cursor_line(), start, from > start ? from - start : 0, vacated);
+    } else if (adjust_view()) {
+        draw_line(cursor_line(), start, 0, -1, 1);
+    } else {
+        draw_line(cursor_line(), start, from > start ? from - start : 0, -1, clear);
+    }
+    place_cursor();
+}
+
+static void insert_text(const char *text, int n) {
+    if (n > gap_end - gap_start) n = gap_end - gap_start;
+    if (n <= 0) {
+        return;
+    }
+
+    int at = gap_start;
+    int newlines = 0;
+    for (int i = 0; i < n; i++) {
+        buffer[gap_start++] = text[i];
+        newlines += text[i] == '\n';
+    }
+    lines += newlines;
+
+    int from = relex(at, 0, n);
+    if (newlines) {
+        // Redraw from the line the insert started on
+        int index = cursor_line();
+        int start = line_start();
+        highlight_move(&highlight, gap_start);
+        if (view) from = start;
+        view = 0;
+        adjust_view();
+        make_room();
+        redraw_from(index, start, from > start ? from - start : 0, 0);
+        place_cursor();
+        return;
+    }
+    highlight_move(&highlight, gap_start);
+    show_edit(from, 0, 0);
+}
+
+static int count_newlines(int from, int to) {
+    int n = 0;
+    for (int p = from; p < to; p++) {
+        n += char_at(p) == '\n';
+    }
+    return n;
+}
+
+static void remove_before(int n) {
+    int at = gap_start - n;
+    int newlines = count_newlines(at, gap_start);
+
+    // Step back over them while they are still there
+    highlight_move(&highlight, at);
+    gap_start = at;
+    lines -= newlines;
+
+    int from = relex(at, n, 0);
+    show_edit(from, 1, newlines);
+}
+
+static void remove_after(int n) {
+    int newlines = count_newlines(gap_start, gap_start + n);
+    gap_end += n;
+    lines -= newlines;
+
+    int from = relex(gap_start, n, 0);
+    show_edit(from, 1, newlines);
+}
+
+static void move_cursor(int pos) {
+    int old_line = cursor_line();
+    int old_start = line_start();
+    move_to(pos);
+
+    // A line left scrolled sideways goes back to its start
+    if (cursor_line() != old_line && view) {
+        view = 0;
+        draw_line(old_line, old_start, 0, -1, 1);
+    }
+    if (adjust_view()) {
+        draw_line(cursor_line(), line_start(), 0, -1, 1);
+    }
+    place_cursor();
+}
+
+static void move_vertical(int down) {
+    int col = gap_start - line_start();
+    int start, end;
+    if (down) {
+        start = line_end(gap_start) + 1;
+        end = line_end(start);
+    } else {
+        start = highlight.line_starts[cursor_line() - 1];
+        end = line_start() - 1;
+    }
+    move_cursor(start + (col < end - start ? col : end - start));
+}
+
+/// KILL AND YANK
+
+static void kill_forward(int append) {
+    int end = line_end(gap_start);
+    int n = end - gap_start;
+    if (!n && end < text_length()) n = 1;  // At the end of a line: join the next
+    if (!n) {
+        return;
+    }
+
+    if (!append) killed_length = 0;
+    for (int i = 0; i < n && killed_length < EDITOR_CAPACITY; i++) {
+        killed[killed_length++] = char_at(gap_start + i);
+    }
+    remove_after(n);
+}
+
+static void kill_backward(int append) {
+    int n = gap_start - line_start();
+    if (!n) {
+        return;
+    }
+
+    // In front of what was killed before
+    if (!append) killed_length = 0;
+    if (killed_length + n > EDITOR_CAPACITY) killed_length = EDITOR_CAPACITY - n;
+    for (int i = killed_length - 1; i >= 0; i--) {
+        killed[i + n] = killed[i];
+    }
+    for (int i = 0; i < n; i++) {
+        killed[i] = buffer[gap_start - n + i];
+    }
+    killed_length += n;
+    remove_before(n);
+}
+
+/// HISTORY
+
+static int history_valid(uint32_t i) {
+    return i < history_count && history_count - i <= EDITOR_HISTORY &&
+           history_bytes - history[i % EDITOR_HISTORY].start <= EDITOR_HISTORY_BYTES;
+}
+
+static void history_add(int length) {
+    if (!length || length > EDITOR_HISTORY_BYTES) {
+        return;
+    }
+
+    // Not the same input twice in a row
+    if (history_valid(history_count - 1)) {
+        HistoryEntry *last = &history[(history_count - 1) % EDITOR_HISTORY];
+        int same = last->length == (uint32_t)length;
+        for (int i = 0; same && i < length; i++) {
+            same = history_text[(last->start + i) % EDITOR_HISTORY_BYTES] == buffer[i];
+        }
+        if (same) return;
+    }
+
+    HistoryEntry *e = &history[history_count % EDITOR_HISTORY];
+    e->start = history_bytes;
+    e->length = length;
+    for (int i = 0; i < length; i++) {
+        history_text[(history_bytes + i) % EDITOR_HISTORY_BYTES] = buffer[i];
+    }
+    history_bytes += length;
+    history_count++;
+}
+
+// Replace the whole input, leaving the cursor at its end
+static void replace_text(const char *text, int n) {
+    int old_lines = lines;
+
+    gap_start = 0;
+    gap_end = EDITOR_CAPACITY;
+    highlight_reset(&highlight);
+    match = -1;
+    view = 0;
+
+    lines = 1;
+    for (int i = 0; i < n; i++) {
+        buffer[gap_start++] = text[i];
+        lines += text[i] == '\n';
+    }
+    relex(0, 0, n);
+    highlight_move(&highlight, n);
+
+    adjust_view();
+    make_room();
+    redraw_from(0, 0, 0, old_lines > lines ? old_lines - lines : 0);
+    place_cursor();
+}
+
+static void history_show(uint32_t i) {
+    if (history_pos == history_count) {
+        draft_length = text_length();
+        for (int p = 0; p < draft_length; p++) {
+            draft[p] = char_at(p);
+        }
+    }
+    history_pos = i;
+
+    if (i == history_count) {
+        replace_text(draft, draft_length);
+        return;
+    }
+
+    HistoryEntry *e = &history[i % EDITOR_HISTORY];
+    for (uint32_t p = 0; p < e->length; p++) {
+        recalled[p] = history_text[(e->start + p) % EDITOR_HISTORY_BYTES];
+    }
+    replace_text(recalled, (int)e->length);
+}
+
+static void history_older(void) {
+    if (history_pos > 0 && history_valid(history_pos - 1)) {
+        history_show(history_pos - 1);
+    }
+}
+
+static void history_newer(void) {
+    if (history_pos < history_count) {
+        history_show(history_pos + 1);
+    }
+}
+
+/// INTERFACE
+
+void editor_resize(uint32_t columns, uint32_t rows) {
+    screen_columns = columns;
+    screen_rows = rows;
+}
+
+void editor_begin(void) {
+    gap_start = 0;
+    gap_end = EDITOR_CAPACITY;
+    highlight_reset(&highlight);
+    lines = 1;
+    origin = (int)cursor_y;
+    view = 0;
+    match = -1;
+    killing = 0;
+    history_pos = history_count;
+}
+
+int editor_key(char c) {
+    int append = killing;
+    killing = 0;
+
+    switch (c) {
+    case '\n':
+        if (highlight_unclosed(&highlight) == 0) {
+            return 1;
+        }
+        insert_text("\n", 1);
+        break;
+
+    case '\b':
+    case 127:
+        if (gap_start > 0) remove_before(1);
+        break;
+
+    case KEY_CTRL_D:
+        if (gap_end < EDITOR_CAPACITY) remove_after(1);
+        break;
+
+    case KEY_CTRL_A:
+        move_cursor(line_start());
+        break;
+
+    case KEY_CTRL_E:
+        move_cursor(line_end(gap_start));
+        break;
+
+    case KEY_CTRL_B:
+    case KEY_LEFT:
+        if (gap_start > 0) move_cursor(gap_start - 1);
+        break;
+
+    case KEY_CTRL_F:
+    case KEY_RIGHT:
+        if (gap_start < text_length()) move_cursor(gap_start + 1);
+        break;
+
+    case KEY_UP:
+        if (cursor_line() > 0) {
+            move_vertical(0);
+        } else {
+            history_older();
+        }
+        break;
+
+    case KEY_DOWN:
+        if (line_end(gap_start) < text_length()) {
+            move_vertical(1);
+        } else {
+            history_newer();
+        }
+        break;
+
+    case KEY_CTRL_P:
+        history_older();
+        break;
+
+    case KEY_CTRL_N:
+        history_newer();
+        break;
+
+    case KEY_CTRL_K:
+        kill_forward(append);
+        killing = 1;
+        break;
+
+    case KEY_CTRL_U:
+        kill_backward(append);
+        killing = 1;
+        break;
+
+    case KEY_CTRL_Y:
+        insert_text(killed, killed_length);
+        break;
+
+    default:
+        if (c >= 32 && c < 127) {
+            insert_text(&c, 1);
+        }
+        break;
+    }
+    return 0;
+}
+
+const char* editor_submit(int *length) {
+    int n = text_length();
+    move_to(n);
+
+    // Leave the input as typed, without the match or a sideways scroll
+    if (match >= 0) {
+        int old = match;
+        match = -1;
+        draw_offset(old);
+    }
+    if (view) {
+        view = 0;
+        draw_line(cursor_line(), line_start(), 0, -1, 1);
+    }
+    follow_cursor();
+
+    uint32_t x = EDITOR_PROMPT_LEN + (gap_start - line_start());
+    cursor_x = x < screen_columns ? x : screen_columns - 1;
+    cursor_y = (uint32_t)(origin + cursor_line());
+
+    // The gap is at the end, so the text is all in one piece
+    history_add(n);
+    *length = n;
+    return buffer;
+}
@@ -0,0 +1,44 @@
+/*
+ * @file editor.h
+ * @version 0.0.2
+ * REPL input editor
+ *
+ * The input lives in a gap buffer with the gap at the cursor, so typing
+ * and deleting cost the same anywhere in a long expression. Enter adds a
+ * line while parens are still open, and submits the input otherwise.
+ * Each line is a screen row after a prompt; a line wider than the screen
+ * scrolls sideways while the cursor is on it, and an input taller than
+ * the screen scrolls up and down to keep the cursor's line in view.
+ *
+ * Only what an edit changed is redrawn: the rest of the cursor's row, or
+ * the rows below when lines come or go. Submitted inputs go to a history
+ * ring, and killed text to a buffer it can be yanked back from.
+ *
+ * Keys: Ctrl+A/E line start/end, Ctrl+B/F and Left/Right by character,
+ * Up/Down by line or through the history at the first/last line,
+ * Ctrl+P/N through the history, Ctrl+D delete, Ctrl+K kill to the end of
+ * the line (or the newline there), Ctrl+U kill to its start, Ctrl+Y yank.
+ */
+
+#ifndef EDITOR_H
+#define EDITOR_H
+
+#include "highlight.h"
+
+#define EDITOR_CAPACITY      HIGHLIGHT_CAPACITY  // Bytes of input at most
+#define EDITOR_PROMPT_LEN    5                   // "LNL> " and "...> "
+#define EDITOR_HISTORY       64                  // Entries in the history ring
+#define EDITOR_HISTORY_BYTES 16384               // Text they share
+
+void editor_resize(uint32_t columns, uint32_t rows);
+
+// Start an empty input at the cursor, right after the prompt
+void editor_begin(void);
+
+// Handle a key; 1 when Enter completed the input
+int editor_key(char c);
+
+// The completed input, with the cursor left at its end
+const char* editor_submit(int *length);
+
+#endif // EDITOR_H
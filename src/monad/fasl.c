@@ -0,0 +1,329 @@
+/*
+ * @file fasl.c
+ * @version 0.0.3
+ * Compiled module loader
+ */
+
+#include "fasl.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+extern void print(const char *str);
+
+static FaslModule modules[FASL_MAX_MODULES];
+static uint32_t module_count = 0;
+
+// Placeholders for every top-level form of every imported module
+#define FASL_MAX_BINDINGS 2048
+static LNL *binding_pool[FASL_MAX_BINDINGS];
+static uint32_t binding_pos = 0;
+
+/// DECODING HELPERS
+
+static uint32_t fasl_u32(const uint8_t *data, uint32_t offset) {
+    return (uint32_t)data[offset] |
+           ((uint32_t)data[offset + 1] << 8) |
+           ((uint32_t)data[offset + 2] << 16) |
+           ((uint32_t)data[offset + 3] << 24);
+}
+
+static uint32_t header(const FaslModule *m, FaslHeaderField field) {
+    return fasl_u32(m->data, field);
+}
+
+static const char* module_symbol(const FaslModule *m, uint32_t index) {
+    uint32_t offset = fasl_u32(m->data, header(m, FASL_H_SYMTAB) + index * 4);
+    return (const char*)m->data + header(m, FASL_H_STRINGS) + offset;
+}
+
+static uint32_t form_field(const FaslModule *m, uint32_t form, uint32_t field) {
+    return fasl_u32(m->data, header(m, FASL_H_FORMTAB) + form * FASL_FORM_SIZE + field * 4);
+}
+
+uint32_t fasl_hash(const uint8_t *data, uint32_t size) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/// REGISTRATION
+
+static int section_ok(uint32_t offset, uint32_t count, uint32_t elem, uint32_t size) {
+    return offset <= size && count <= (size - offset) / elem;
+}
+
+int fasl_register(const uint8_t *data, uint32_t size) {
+    if (module_count >= FASL_MAX_MODULES || size < FASL_HEADER_SIZE) {
+        return -1;
+    }
+
+    FaslModule m = {data, size, NULL, NULL, NULL};
+
+    if (header(&m, FASL_H_MAGIC) != FASL_MAGIC ||
+        header(&m, FASL_H_VERSION) != FASL_VERSION ||
+        header(&m, FASL_H_SIZE) != size) {
+        return -1;
+    }
+
+    if (fasl_hash(data + FASL_HEADER_SIZE, size - FASL_HEADER_SIZE) !=
+        header(&m, FASL_H_HASH)) {
+        return -1;
+    }
+
+    if (!section_ok(header(&m, FASL_H_SYMTAB), header(&m, FASL_H_SYMBOLS), 4, size) ||
+        !section_ok(header(&m, FASL_H_CONSTTAB), header(&m, FASL_H_CONSTANTS), 4, size) ||
+        !section_ok(header(&m, FASL_H_FORMTAB), header(&m, FASL_H_FORMS), FASL_FORM_SIZE, size) ||
+        header(&m, FASL_H_STRINGS) > header(&m, FASL_H_CODE) || header(&m, FASL_H_CODE) > size ||
+        header(&m, FASL_H_NAME) >= header(&m, FASL_H_SYMBOLS)) {
+        return -1;
+    }
+
+    // The string pool ends with a NUL and every name starts inside it, so
+    // every name is terminated before the code
+    uint32_t pool = header(&m, FASL_H_CODE) - header(&m, FASL_H_STRINGS);
+    if (pool == 0 || data[header(&m, FASL_H_CODE) - 1] != '\0') {
+        return -1;
+    }
+    for (uint32_t i = 0; i < header(&m, FASL_H_SYMBOLS); i++) {
+        if (fasl_u32(data, header(&m, FASL_H_SYMTAB) + i * 4) >= pool) {
+            return -1;
+        }
+    }
+
+    m.name = module_symbol(&m, header(&m, FASL_H_NAME));
+    modules[module_count++] = m;
+    return 0;
+}
+
+void fasl_register_all(const uint8_t *const *list, const uint32_t *sizes, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (fasl_register(list[i], sizes[i]) != 0) {
+            print("fasl: rejected malformed module\n");
+        }
+    }
+}
+
+static FaslModule* find_module(const char *name) {
+    for (uint32_t i = 0; i < module_count; i++) {
+        const char *a = modules[i].name;
+        const char *b = name;
+        while (*a && *a == *b) {
+            a++;
+            b++;
+        }
+        if (*a == *b) return &modules[i];
+    }
+    return NULL;
+}
+
+/// FORM DECODING
+
+typedef struct {
+    const FaslModule *module;
+    uint32_t pos;
+    uint32_t end;
+    int failed;
+} FaslReader;
+
+static uint8_t read_u8(FaslReader *r) {
+    if (r->pos >= r->end) {
+        r->failed = 1;
+        return 0;
+    }
+    return r->module->data[r->pos++];
+}
+
+static uint32_t read_u32(FaslReader *r) {
+    if (r->pos + 4 > r->end) {
+        r->failed = 1;
+        return 0;
+    }
+    uint32_t v = fasl_u32(r->module->data, r->pos);
+    r->pos += 4;
+    return v;
+}
+
+static LNL* decode_form(FaslReader *r) {
+    const FaslModule *m = r->module;
+
+    switch (read_u8(r)) {
+        case FASL_NIL:
+            return lnl_nil();
+        case FASL_TRUE:
+            return lnl_true();
+        case FASL_FALSE:
+            return lnl_false();
+        case FASL_INT: {
+            uint32_t index = read_u32(r);
+            if (index >= header(m, FASL_H_CONSTANTS)) break;
+            return lnl_int((int32_t)fasl_u32(m->data, header(m, FASL_H_CONSTTAB) + index * 4));
+        }
+        case FASL_SYMBOL: {
+            uint32_t index = read_u32(r);
+            if (index >= header(m, FASL_H_SYMBOLS)) break;
+            return lnl_symbol(module_symbol(m, index));
+        }
+        case FASL_FLOAT: {
+            union { double real; uint32_t half[2]; } bits;
+            bits.half[0] = read_u32(r);
+            bits.half[1] = read_u32(r);
+            return lnl_float(bits.real);
+        }
+        case FASL_LIST: {
+            // Elements are linked in order as they are decoded
+            uint32_t count = read_u32(r);
+            LNL *head = NULL;
+            LNL *tail = NULL;
+            for (uint32_t i = 0; i < count && !r->failed; i++) {
+                LNL *cell = lnl_cons(decode_form(r), lnl_nil());
+                if (!head) {
+                    head = cell;
+                } else {
+                    tail->value.cons.cdr = cell;
+                }
+                tail = cell;
+            }
+            LNL *rest = decode_form(r);
+            if (!head) return rest;
+            tail->value.cons.cdr = rest;
+            return head;
+        }
+    }
+
+    r->failed = 1;
+    return lnl_nil();
+}
+
+static LNL* decode_at(const FaslModule *m, uint32_t offset, int *ok) {
+    FaslReader r = {m, offset, m->size, 0};
+    LNL *form = decode_form(&r);
+    *ok = !r.failed;
+    return form;
+}
+
+/// IMPORT
+
+static int module_open(FaslModule *m) {
+    if (m->env) return 0;
+
+    uint32_t forms = header(m, FASL_H_FORMS);
+    if (binding_pos + forms > FASL_MAX_BINDINGS) return -1;
+
+    Environment *env = env_create(lnlisp_global_env());
+    if (!env) return -1;
+
+    m->env = env;
+    m->bindings = &binding_pool[binding_pos];
+    binding_pos += forms;
+
+    // Definitions only get a placeholder, their bodies stay encoded
+    for (uint32_t i = 0; i < forms; i++) {
+        uint32_t name = form_field(m, i, 0);
+        if (name == FASL_NO_NAME) {
+            m->bindings[i] = NULL;
+            continue;
+        }
+        m->bindings[i] = lnl_autoload(m, i);
+        env_define(env, module_symbol(m, name), m->bindings[i]);
+    }
+
+    // Init forms run once, in order, when the module is first imported
+    for (uint32_t i = 0; i < forms; i++) {
+        if (form_field(m, i, 0) != FASL_NO_NAME) continue;
+
+        int ok;
+        LNL *form = decode_at(m, form_field(m, i, 2), &ok);
+        if (!ok) {
+            // Closed again, so the next import fails the same way instead
+            // of finding it open; the bindings go back if nothing opened
+            // since took more
+            m->env = NULL;
+            if (binding_pos == (uint32_t)(m->bindings - binding_pool) + forms) {
+                binding_pos -= forms;
+            }
+            return -1;
+        }
+        lnlisp_eval(form, env);
+    }
+
+    return 0;
+}
+
+static int name_listed(LNL *names, const char *name) {
+    while (lnl_is_pair(names)) {
+        LNL *sym = lnl_car(names);
+        if (sym->type == TYPE_SYMBOL && lnl_strcmp(sym->value.symbol, name) == 0) {
+            return 1;
+        }
+        names = lnl_cdr(names);
+    }
+    return 0;
+}
+
+int fasl_import(const char *module, LNL *names, Environment *env) {
+    FaslModule *m = find_module(module);
+    if (!m) {
+        print("import: unknown module ");
+        print(module);
+        print("\n");
+        return -1;
+    }
+
+    if (module_open(m) != 0) {
+        print("import: cannot open module ");
+        print(module);
+        print("\n");
+        return -1;
+    }
+
+    uint32_t forms = header(m, FASL_H_FORMS);
+    for (uint32_t i = 0; i < forms; i++) {
+        uint32_t name = form_field(m, i, 0);
+        if (name == FASL_NO_NAME || !(form_field(m, i, 1) & FASL_FORM_EXPORTED)) {
+            continue;
+        }
+
+        const char *sym = module_symbol(m, name);
+        if (lnl_is_nil(names) || name_listed(names, sym)) {
+            env_define(env, sym, m->bindings[i]);
+        }
+    }
+
+    return 0;
+}
+
+LNL* fasl_force(LNL *placeholder) {
+    FaslModule *m = (FaslModule*)placeholder->value.autoload.module;
+    uint32_t form = placeholder->value.autoload.form;
+
+    if (placeholder->value.autoload.loading) {
+        print("fasl: circular definition of ");
+        print(module_symbol(m, form_field(m, form, 0)));
+        print("\n");
+        return lnl_nil();
+    }
+
+    int ok;
+    LNL *expr = decode_at(m, form_field(m, form, 2), &ok);
+    if (!ok) {
+        print("fasl: corrupt definition in ");
+        print(m->name);
+        print("\n");
+        return lnl_nil();
+    }
+
+    placeholder->value.autoload.loading = 1;
+    LNL *value = lnlisp_eval(expr, m->env);
+
+    // Every binding shares the placeholder, so overwriting it in place
+    // publishes the value to the module and to all importers at once
+    *placeholder = *value;
+    placeholder->marked = 0;
+    placeholder->next = NULL;
+    return placeholder;
+}
@@ -0,0 +1,95 @@
+/*
+ * @file fasl.h
+ * @version 0.0.2
+ * Compiled module format (FASL)
+ *
+ * A module is compiled ahead of time by mkfasl into a flat little-endian
+ * blob that can be used in place, without any parsing:
+ *
+ *   header     FaslHeader fields, one u32 each
+ *   symbols    u32[symbol_count]   offsets of names in the string pool
+ *   constants  i32[constant_count] integer literals
+ *   forms      FaslForm[form_count] top-level forms, three u32 each
+ *   strings    NUL-terminated symbol names
+ *   code       pre-parsed forms, preorder, see FaslTag
+ *
+ * Registering a module only validates it: the header, the content hash,
+ * that every section lies inside it, and that every name starts in the
+ * string pool.
+ * Importing binds every definition to a placeholder; a definition's body
+ * is decoded and evaluated the first time the placeholder is referenced.
+ */
+
+#ifndef FASL_H
+#define FASL_H
+
+#include "monad.h"
+
+#define FASL_MAGIC   0x46444E4D  // "MNDF"
+#define FASL_VERSION 1
+
+#define FASL_MAX_MODULES 64
+
+#define FASL_HEADER_SIZE (13 * 4)
+#define FASL_FORM_SIZE   (3 * 4)
+
+#define FASL_NO_NAME 0xFFFFFFFF
+
+// Header field offsets
+typedef enum {
+    FASL_H_MAGIC     = 0,
+    FASL_H_VERSION   = 4,
+    FASL_H_HASH      = 8,   // FNV-1a of everything after the header
+    FASL_H_SIZE      = 12,  // Total size in bytes
+    FASL_H_NAME      = 16,  // Symbol index of the module name
+    FASL_H_SYMBOLS   = 20,  // Symbol count
+    FASL_H_CONSTANTS = 24,  // Constant count
+    FASL_H_FORMS     = 28,  // Form count
+    FASL_H_SYMTAB    = 32,  // Offset of the symbol table
+    FASL_H_CONSTTAB  = 36,  // Offset of the constant table
+    FASL_H_FORMTAB   = 40,  // Offset of the form table
+    FASL_H_STRINGS   = 44,  // Offset of the string pool
+    FASL_H_CODE      = 48   // Offset of the code section
+} FaslHeaderField;
+
+// Form table entry: name symbol (FASL_NO_NAME for init forms), flags,
+// code offset of the value expression (or of the whole form)
+#define FASL_FORM_EXPORTED 0x1
+
+// Encoded form tags
+typedef enum {
+    FASL_NIL = 0,
+    FASL_TRUE,
+    FASL_FALSE,
+    FASL_INT,       // u32 constant index
+    FASL_SYMBOL,    // u32 symbol index
+    FASL_LIST,      // u32 count, count elements, then the tail
+    FASL_FLOAT      // u32 low, u32 high: IEEE double bits
+} FaslTag;
+
+typedef struct {
+    const uint8_t *data;
+    uint32_t size;
+    const char *name;
+    Environment *env;    // Module scope, created on first import
+    LNL **bindings;      // Placeholder per form, created on first import
+} FaslModule;
+
+// Embedded modules, generated at build time by mkfasl (monad_modules.c)
+extern const uint8_t *const monad_fasl_modules[];
+extern const uint32_t monad_fasl_sizes[];
+extern const uint32_t monad_fasl_count;
+
+uint32_t fasl_hash(const uint8_t *data, uint32_t size);
+
+// Validate and record a compiled module, returns -1 if malformed
+int fasl_register(const uint8_t *data, uint32_t size);
+void fasl_register_all(const uint8_t *const *modules, const uint32_t *sizes, uint32_t count);
+
+// Bind the exports of a module (or only those in names) into env
+int fasl_import(const char *module, LNL *names, Environment *env);
+
+// Load the body behind an autoload placeholder, returns the placeholder
+LNL* fasl_force(LNL *placeholder);
+
+#endif // FASL_H
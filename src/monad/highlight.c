@@ -0,0 +1,298 @@
+/*
+ * @file highlight.c
+ * @version 0.0.3
+ * Incremental syntax highlighting for the REPL editor
+ */
+
+#include "highlight.h"
+
+// Special forms the evaluator knows by name
+static const char *keywords[] = {
+    "define", "lambda", "if", "quote", "import", "time",
+};
+
+#define KEYWORD_COUNT ((int)(sizeof(keywords) / sizeof(keywords[0])))
+
+// A token that runs into the text's gap, copied out whole
+static char joined[HIGHLIGHT_CAPACITY];
+
+static int is_keyword(const char *text, int length) {
+    for (int i = 0; i < KEYWORD_COUNT; i++) {
+        const char *k = keywords[i];
+        int j = 0;
+        while (j < length && k[j] == text[j]) j++;
+        if (j == length && k[j] == '\0') return 1;
+    }
+    return 0;
+}
+
+static uint8_t token_style(SexpTokenType type, const char *text, int length) {
+    switch (type) {
+    case TOKEN_LPAREN:
+    case TOKEN_RPAREN:  return HL_PAREN;
+    case TOKEN_QUOTE:   return HL_QUOTE;
+    case TOKEN_NUMBER:  return HL_NUMBER;
+    case TOKEN_TRUE:
+    case TOKEN_FALSE:
+    case TOKEN_NIL:     return HL_LITERAL;
+    case TOKEN_COMMENT: return HL_COMMENT;
+    case TOKEN_ERROR:   return HL_ERROR;
+    case TOKEN_SYMBOL:  return is_keyword(text, length) ? HL_KEYWORD : HL_PLAIN;
+    default:            return HL_PLAIN;
+    }
+}
+
+// Whether c ends a token of the given type
+static int ends_token(SexpTokenType type, char c) {
+    if (c == '\n') return 1;
+    if (type == TOKEN_COMMENT) return 0;
+    if (type == TOKEN_SPACE) return !sexp_isspace(c);
+    return sexp_isspace(c) || c == '(' || c == ')' || c == '\'' || c == ';' || c == '\0';
+}
+
+// Lex the token at pos; *bytes points at its characters
+static int lex(const HighlightText *t, int pos, SexpTokenType *type, const char **bytes) {
+    if (pos >= t->head_length) {
+        int p = pos - t->head_length;
+        *bytes = t->tail + p;
+        return t->head_length + sexp_lex(t->tail, t->tail_length, p, type);
+    }
+
+    *bytes = t->head + pos;
+    int end = sexp_lex(t->head, t->head_length, pos, type);
+    if (end < t->head_length || !t->tail_length ||
+        *type == TOKEN_LPAREN || *type == TOKEN_RPAREN ||
+        *type == TOKEN_QUOTE || *type == TOKEN_NEWLINE) {
+        return end;
+    }
+
+    // It reached the gap and may go on after it
+    int n = 0;
+    for (int i = pos; i < t->head_length; i++) {
+        joined[n++] = t->head[i];
+    }
+    for (int i = 0; i < t->tail_length && !ends_token(*type, t->tail[i]); i++) {
+        joined[n++] = t->tail[i];
+    }
+    *bytes = joined;
+    return pos + sexp_lex(joined, n, 0, type);
+}
+
+/// TOKEN GAP
+
+static inline int token_count(const Highlighter *h) {
+    return h->before + h->after;
+}
+
+static inline const HighlightToken *token(const Highlighter *h, int i) {
+    return i < h->before ? &h->tokens[i]
+                         : &h->tokens[HIGHLIGHT_CAPACITY - h->after + (i - h->before)];
+}
+
+static inline int token_start(const Highlighter *h, int i) {
+    return i < h->before ? h->tokens[i].start : h->length - token(h, i)->start;
+}
+
+static int token_end(const Highlighter *h, int i) {
+    return i + 1 < token_count(h) ? token_start(h, i + 1) : h->length;
+}
+
+// Index of the token holding pos
+static int token_at(const Highlighter *h, int pos) {
+    int lo = 0;
+    int hi = token_count(h) - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (token_start(h, mid) <= pos) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// Make index the first token after the gap
+static void move_gap(Highlighter *h, int index) {
+    while (h->before > index) {
+        HighlightToken t = h->tokens[--h->before];
+        t.start = (uint16_t)(h->length - t.start);
+        h->tokens[HIGHLIGHT_CAPACITY - ++h->after] = t;
+    }
+    while (h->before < index) {
+        HighlightToken t = h->tokens[HIGHLIGHT_CAPACITY - h->after--];
+        t.start = (uint16_t)(h->length - t.start);
+        h->tokens[h->before++] = t;
+    }
+}
+
+static void reset_cursor(Highlighter *h) {
+    h->cursor = 0;
+    h->line = 0;
+    h->line_starts[0] = 0;
+    h->open_count = 0;
+    h->closed_count = 0;
+}
+
+void highlight_reset(Highlighter *h) {
+    h->before = 0;
+    h->after = 0;
+    h->length = 0;
+    reset_cursor(h);
+}
+
+/// EDITING
+
+int highlight_edit(Highlighter *h, const HighlightText *text,
+                   int at, int removed, int inserted, int *relexed_end) {
+    int length = text->head_length + text->tail_length;
+    int old_length = h->length;
+    int old_end = at + removed;
+    int delta = inserted - removed;
+
+    // What is kept about the cursor only describes bytes before it
+    if (h->cursor > at) {
+        reset_cursor(h);
+    }
+
+    // New bytes can join the token before them, so start there; the old
+    // tokens from it on go after the gap, where the edit leaves them be
+    move_gap(h, at > 0 && token_count(h) ? token_at(h, at - 1) : 0);
+    int start = h->after ? old_length - h->tokens[HIGHLIGHT_CAPACITY - h->after].start : 0;
+
+    // Lex until a token starts where an old one past the edit did; from
+    // there on the bytes, and so the tokens, are the same as before
+    int pos = start;
+    while (pos < length) {
+        int old_start = 0;
+        while (h->after) {
+            old_start = old_length - h->tokens[HIGHLIGHT_CAPACITY - h->after].start;
+            if (old_start >= old_end && old_start + delta >= pos) break;
+            h->after--;
+        }
+        if (h->after && old_start + delta == pos) {
+            break;
+        }
+
+        SexpTokenType type;
+        const char *bytes;
+        int end = lex(text, pos, &type, &bytes);
+        HighlightToken *t = &h->tokens[h->before++];
+        t->start = (uint16_t)pos;
+        t->type = (uint8_t)type;
+        t->style = token_style(type, bytes, end - pos);
+        pos = end;
+    }
+    if (pos >= length) {
+        h->after = 0;
+    }
+
+    h->length = length;
+    *relexed_end = pos;
+    return start;
+}
+
+/// CURSOR
+
+void highlight_move(Highlighter *h, int cursor) {
+    if (cursor == 0) {
+        reset_cursor(h);
+        return;
+    }
+
+    // A token at a time; only parens and newlines touch the stacks
+    while (h->cursor < cursor) {
+        int i = token_at(h, h->cursor);
+        switch (token(h, i)->type) {
+        case TOKEN_LPAREN:
+            h->open[h->open_count++] = (uint16_t)h->cursor;
+            break;
+        case TOKEN_RPAREN:
+            h->closed[h->closed_count++] = h->open_count ? (int16_t)h->open[--h->open_count] : -1;
+            break;
+        case TOKEN_NEWLINE:
+            h->line_starts[++h->line] = (uint16_t)(h->cursor + 1);
+            break;
+        default: {
+            int end = token_end(h, i);
+            h->cursor = end < cursor ? end : cursor;
+            continue;
+        }
+        }
+        h->cursor++;
+    }
+
+    while (h->cursor > cursor) {
+        int i = token_at(h, h->cursor - 1);
+        switch (token(h, i)->type) {
+        case TOKEN_LPAREN:
+            h->open_count--;
+            break;
+        case TOKEN_RPAREN: {
+            int16_t partner = h->closed[--h->closed_count];
+            if (partner >= 0) h->open[h->open_count++] = (uint16_t)partner;
+            break;
+        }
+        case TOKEN_NEWLINE:
+            h->line--;
+            break;
+        default: {
+            int start = token_start(h, i);
+            h->cursor = start > cursor ? start : cursor;
+            continue;
+        }
+        }
+        h->cursor--;
+    }
+}
+
+int highlight_match(const Highlighter *h) {
+    if (h->cursor > 0 && token(h, token_at(h, h->cursor - 1))->type == TOKEN_RPAREN) {
+        return h->closed_count ? h->closed[h->closed_count - 1] : -1;
+    }
+    return h->open_count ? h->open[h->open_count - 1] : -1;
+}
+
+int highlight_line_of(const Highlighter *h, int pos) {
+    int lo = 0;
+    int hi = h->line;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (h->line_starts[mid] <= pos) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+int highlight_unclosed(const Highlighter *h) {
+    int depth = 0;
+    for (int i = 0; i < token_count(h); i++) {
+        uint8_t type = token(h, i)->type;
+        if (type == TOKEN_LPAREN) depth++;
+        if (type == TOKEN_RPAREN && depth > 0) depth--;
+    }
+    return depth;
+}
+
+/// DRAWING
+
+HighlightStyle highlight_run(const Highlighter *h, int pos, int end, int *run_end) {
+    if (!token_count(h)) {
+        *run_end = end;
+        return HL_PLAIN;
+    }
+
+    int i = token_at(h, pos);
+    uint8_t style = token(h, i)->style;
+    while (i + 1 < token_count(h) && token_start(h, i + 1) < end &&
+           token(h, i + 1)->style == style) {
+        i++;
+    }
+
+    int stop = token_end(h, i);
+    *run_end = stop < end ? stop : end;
+    return (HighlightStyle)style;
+}
@@ -0,0 +1,100 @@
+/*
+ * @file highlight.h
+ * @version 0.0.2
+ * Incremental syntax highlighting for the REPL editor
+ *
+ * The text is kept as tokens from sexp_lex covering every byte. After an
+ * edit only the tokens from the one before the edit up to the first old
+ * boundary the lexer lands on again are relexed. The tokens sit in a gap
+ * buffer of their own, split at the last edit: those after the gap count
+ * their offset from the end of the text, so an edit leaves them as they
+ * are and typing costs the same anywhere in a long input.
+ *
+ * Paren matching and line positions work from the cursor: the '(' still
+ * open before it, for every ')' before it the '(' it closed, and where
+ * each line up to the cursor starts. Moving the cursor by a character
+ * pushes or pops one entry, so finding the match never rescans the text.
+ */
+
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include "sexparser.h"
+
+typedef unsigned short uint16_t;
+typedef signed short int16_t;
+
+#define HIGHLIGHT_CAPACITY 4096  // Bytes of text at most
+
+// What a character is drawn as
+typedef enum {
+    HL_PLAIN,
+    HL_KEYWORD,   // Special form names
+    HL_NUMBER,
+    HL_LITERAL,   // nil
+    HL_QUOTE,
+    HL_COMMENT,
+    HL_PAREN,
+    HL_MATCH,     // The paren that goes with the cursor position
+    HL_ERROR      // Atoms the reader would reject
+} HighlightStyle;
+
+// The text in two pieces, as a gap buffer holds it
+typedef struct {
+    const char *head;
+    int head_length;
+    const char *tail;
+    int tail_length;
+} HighlightText;
+
+typedef struct {
+    uint16_t start;  // Offset before the token gap, distance from the end after it
+    uint8_t type;    // SexpTokenType
+    uint8_t style;   // HighlightStyle
+} HighlightToken;
+
+typedef struct {
+    HighlightToken tokens[HIGHLIGHT_CAPACITY];
+    int before;      // Tokens in tokens[0, before)
+    int after;       // Tokens at the end of tokens
+    int length;      // Of the text
+
+    // What lies before the cursor, as offsets into the text
+    int cursor;
+    int line;                                  // Newlines before the cursor
+    uint16_t line_starts[HIGHLIGHT_CAPACITY];  // Of lines 0 to line
+    uint16_t open[HIGHLIGHT_CAPACITY];         // '(' still open, innermost last
+    int open_count;
+    int16_t closed[HIGHLIGHT_CAPACITY];        // Per ')', the '(' it closed or -1
+    int closed_count;
+} Highlighter;
+
+void highlight_reset(Highlighter *h);
+
+/*
+ * @brief highlight_edit(h, text, at, removed, inserted, relexed_end)
+ * @details text is the whole input after removed bytes at at were
+ *          replaced by inserted ones. Returns the first offset whose
+ *          style may have changed; everything from there to *relexed_end
+ *          was relexed, and when the length changed the rest moved too.
+ */
+int highlight_edit(Highlighter *h, const HighlightText *text,
+                   int at, int removed, int inserted, int *relexed_end);
+
+// Move the cursor over the text as highlighted now
+void highlight_move(Highlighter *h, int cursor);
+
+// The paren to show as matching at the cursor, or -1: the partner of a
+// ')' just before it, otherwise the innermost open '('
+int highlight_match(const Highlighter *h);
+
+// Line of an offset before the cursor
+int highlight_line_of(const Highlighter *h, int pos);
+
+// '(' left open at the end of the text
+int highlight_unclosed(const Highlighter *h);
+
+// Style at pos, and the end of the run of that style (up to end)
+HighlightStyle highlight_run(const Highlighter *h, int pos, int end, int *run_end);
+
+#endif // HIGHLIGHT_H
@@ -0,0 +1,42 @@
+/*
+ * @file host_stubs.c
+ * @version 0.0.1
+ * Kernel symbols for the hosted interpreter
+ *
+ * The console, cursor and clock the interpreter links against, for the
+ * build-time tools (monad-mkimage, monad-mkfasl). Output goes to stderr,
+ * nothing is drawn, and time stands still at build time. monad.c is built
+ * with print/putchar renamed for the hosted library.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../clock.h"
+
+uint32_t cursor_x = 0;
+uint32_t cursor_y = 0;
+
+void monad_host_print(const char *str) {
+    fputs(str, stderr);
+}
+
+void monad_host_putchar(char c) {
+    fputc(c, stderr);
+}
+
+void print_styled_at(const char *text, uint32_t count, uint8_t style, uint32_t x, uint32_t y) {
+    (void)text;
+    (void)count;
+    (void)style;
+    (void)x;
+    (void)y;
+}
+
+uint64_t clock_ns(void) {
+    return 0;
+}
+
+uint64_t clock_cycles(void) {
+    return 0;
+}
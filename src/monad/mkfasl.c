@@ -0,0 +1,407 @@
+/*
+ * @file mkfasl.c
+ * @version 0.0.2
+ * Build-time module compiler
+ *
+ * Parses Monad modules with the hosted reader and writes them out in the
+ * FASL format (see fasl.h), embedded as C arrays in kernel.bin.
+ * A module starts with its declaration:
+ *
+ *   (module NAME (EXPORT...))   ; or (module NAME _) to export everything
+ *
+ * Usage: monad-mkfasl OUTPUT.c [MODULE.mon...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "monad.h"
+#include "sexparser.h"
+#include "fasl.h"
+
+/// READER
+
+static void* cb_nil(void)              { return lnl_nil();                    }
+static void* cb_bool(int v)            { return v ? lnl_true() : lnl_false(); }
+static void* cb_int(int32_t v)         { return lnl_int(v);                   }
+static void* cb_sym(const char *n)     { return lnl_symbol(n);                }
+static void* cb_cons(void *a, void *b) { return lnl_cons((LNL*)a, (LNL*)b);   }
+
+static void* cb_sym_span(const char *n, int len, uint32_t hash) {
+    return lnl_symbol_span(n, len, hash);
+}
+
+// Same literals as the interpreter's reader accepts
+static void* cb_number(const SexpNumber *num) {
+    if (num->type == SEXP_NUM_FLOAT || num->type == SEXP_NUM_F32 || num->type == SEXP_NUM_F64) {
+        return lnl_float(num->value.real);
+    }
+    int64_t v = num->value.integer;
+    if (num->type == SEXP_NUM_U32) return lnl_int((int32_t)(uint32_t)v);
+    if (v < -2147483647 - 1 || v > 2147483647) return NULL;
+    return lnl_int((int32_t)v);
+}
+
+static void cb_set_cdr(void *cons, void *cdr) {
+    ((LNL*)cons)->value.cons.cdr = (LNL*)cdr;
+}
+
+static void* cb_grow_stack(void *stack, uint32_t bytes) {
+    return realloc(stack, bytes);
+}
+
+static const SexpAllocator allocator = {
+    cb_nil, cb_bool, cb_int, cb_sym, cb_cons, cb_set_cdr, cb_grow_stack, cb_sym_span,
+    cb_number
+};
+
+static char* read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *buf = malloc(size + 1);
+    if (buf && fread(buf, 1, size, f) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    if (buf) buf[size] = '\0';
+    fclose(f);
+    return buf;
+}
+
+/// WRITER
+
+typedef struct {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t cap;
+} Buffer;
+
+typedef struct {
+    const char *symbols[MAX_SYMBOLS];
+    uint32_t symbol_count;
+    int32_t constants[4096];
+    uint32_t constant_count;
+    uint32_t forms[4096][3];
+    uint32_t form_count;
+    Buffer code;
+} Module;
+
+static void buf_u8(Buffer *b, uint8_t v) {
+    if (b->size == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 4096;
+        b->data = realloc(b->data, b->cap);
+        if (!b->data) {
+            fprintf(stderr, "mkfasl: out of memory\n");
+            exit(1);
+        }
+    }
+    b->data[b->size++] = v;
+}
+
+static void buf_u32(Buffer *b, uint32_t v) {
+    buf_u8(b, v & 0xFF);
+    buf_u8(b, (v >> 8) & 0xFF);
+    buf_u8(b, (v >> 16) & 0xFF);
+    buf_u8(b, (v >> 24) & 0xFF);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static uint32_t symbol_index(Module *m, const char *name) {
+    for (uint32_t i = 0; i < m->symbol_count; i++) {
+        if (m->symbols[i] == name) return i;
+    }
+    if (m->symbol_count == MAX_SYMBOLS) {
+        fprintf(stderr, "mkfasl: too many symbols\n");
+        exit(1);
+    }
+    m->symbols[m->symbol_count] = name;
+    return m->symbol_count++;
+}
+
+static uint32_t constant_index(Module *m, int32_t value) {
+    for (uint32_t i = 0; i < m->constant_count; i++) {
+        if (m->constants[i] == value) return i;
+    }
+    if (m->constant_count == sizeof(m->constants) / sizeof(m->constants[0])) {
+        fprintf(stderr, "mkfasl: too many constants\n");
+        exit(1);
+    }
+    m->constants[m->constant_count] = value;
+    return m->constant_count++;
+}
+
+// Forms are parsed flat, so encoding is one walk over the nodes in the
+// same preorder the FASL code uses
+#define MAX_FORM_NODES 65536
+
+static uint32_t child_count(const SexpNode *node) {
+    uint32_t count = 0;
+    for (const SexpNode *c = node + 1; c < SEXP_NODE_NEXT(node); c = SEXP_NODE_NEXT(c)) {
+        count++;
+    }
+    return count;
+}
+
+// The index-th child of a list node, NULL if there are fewer
+static const SexpNode* child(const SexpNode *node, uint32_t index) {
+    if (node->tag != SEXP_NODE_LIST && node->tag != SEXP_NODE_DOTTED) return NULL;
+    const SexpNode *c = node + 1;
+    for (; c < SEXP_NODE_NEXT(node); c = SEXP_NODE_NEXT(c)) {
+        if (index-- == 0) return c;
+    }
+    return NULL;
+}
+
+static const char* node_symbol(const SexpNode *node) {
+    if (!node || node->tag != SEXP_NODE_SYMBOL) return NULL;
+    return ((LNL*)node->value.symbol)->value.symbol;
+}
+
+static void encode(Module *m, const SexpNode *node) {
+    Buffer *b = &m->code;
+
+    switch (node->tag) {
+        case SEXP_NODE_NIL:
+            buf_u8(b, FASL_NIL);
+            break;
+        case SEXP_NODE_TRUE:
+            buf_u8(b, FASL_TRUE);
+            break;
+        case SEXP_NODE_FALSE:
+            buf_u8(b, FASL_FALSE);
+            break;
+        case SEXP_NODE_INT:
+            buf_u8(b, FASL_INT);
+            buf_u32(b, constant_index(m, node->value.integer));
+            break;
+        case SEXP_NODE_NUMBER: {
+            LNL *num = (LNL*)node->value.number;
+            if (num->type == TYPE_FLOAT) {
+                union { double real; uint32_t half[2]; } bits;
+                bits.real = num->value.real;
+                buf_u8(b, FASL_FLOAT);
+                buf_u32(b, bits.half[0]);
+                buf_u32(b, bits.half[1]);
+            } else {
+                buf_u8(b, FASL_INT);
+                buf_u32(b, constant_index(m, num->value.integer));
+            }
+            break;
+        }
+        case SEXP_NODE_SYMBOL:
+            buf_u8(b, FASL_SYMBOL);
+            buf_u32(b, symbol_index(m, node_symbol(node)));
+            break;
+        case SEXP_NODE_LIST:
+        case SEXP_NODE_DOTTED: {
+            // A dotted list's last child is its tail, not an element
+            int dotted = node->tag == SEXP_NODE_DOTTED;
+            uint32_t count = child_count(node) - dotted;
+
+            buf_u8(b, FASL_LIST);
+            buf_u32(b, count);
+            const SexpNode *c = node + 1;
+            for (uint32_t i = 0; i < count; i++, c = SEXP_NODE_NEXT(c)) {
+                encode(m, c);
+            }
+            if (dotted) {
+                encode(m, c);
+            } else {
+                buf_u8(b, FASL_NIL);
+            }
+            break;
+        }
+        default:
+            fprintf(stderr, "mkfasl: cannot encode node of type %d\n", node->tag);
+            exit(1);
+    }
+}
+
+static void add_form(Module *m, uint32_t name, uint32_t flags, const SexpNode *form) {
+    if (m->form_count == sizeof(m->forms) / sizeof(m->forms[0])) {
+        fprintf(stderr, "mkfasl: too many forms\n");
+        exit(1);
+    }
+    uint32_t *entry = m->forms[m->form_count++];
+    entry[0] = name;
+    entry[1] = flags;
+    entry[2] = m->code.size;
+    encode(m, form);
+}
+
+static int is_symbol(LNL *obj, const char *name) {
+    return obj->type == TYPE_SYMBOL && strcmp(obj->value.symbol, name) == 0;
+}
+
+static int exported(LNL *exports, const char *name) {
+    if (is_symbol(exports, "_")) return 1;
+    for (; lnl_is_pair(exports); exports = lnl_cdr(exports)) {
+        if (is_symbol(lnl_car(exports), "_") || is_symbol(lnl_car(exports), name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static const SexpNode* parse_form(SexpParser *parser, const char *path) {
+    static SexpNode nodes[MAX_FORM_NODES];
+
+    if (sexp_parse_flat(parser, &allocator, nodes, MAX_FORM_NODES) < 0) {
+        fprintf(stderr, "mkfasl: %s: %s\n", path, sexp_get_error(parser));
+        exit(1);
+    }
+    return nodes;
+}
+
+static Buffer compile_module(const char *path, const char *source) {
+    static Module m;
+    memset(&m, 0, sizeof(m));
+
+    SexpParser parser;
+    sexp_parser_init(&parser, source);
+
+    const SexpNode *decl = sexp_has_more(&parser) ? parse_form(&parser, path) : NULL;
+    const char *module = decl ? node_symbol(child(decl, 1)) : NULL;
+    if (!decl || !node_symbol(child(decl, 0)) ||
+        strcmp(node_symbol(child(decl, 0)), "module") != 0 || !module) {
+        fprintf(stderr, "mkfasl: %s: expected (module NAME (EXPORT...))\n", path);
+        exit(1);
+    }
+
+    uint32_t name = symbol_index(&m, module);
+    const SexpNode *export_list = child(decl, 2);
+    LNL *exports = export_list ? lnl_from_flat(export_list) : lnl_nil();
+
+    while (sexp_has_more(&parser)) {
+        const SexpNode *form = parse_form(&parser, path);
+
+        // (define NAME EXPR) is loaded lazily, anything else runs on import
+        const char *head = node_symbol(child(form, 0));
+        const char *sym = node_symbol(child(form, 1));
+        const SexpNode *value = child(form, 2);
+        if (head && strcmp(head, "define") == 0 && sym && value) {
+            add_form(&m, symbol_index(&m, sym),
+                     exported(exports, sym) ? FASL_FORM_EXPORTED : 0,
+                     value);
+        } else {
+            add_form(&m, FASL_NO_NAME, 0, form);
+        }
+    }
+
+    // Lay the sections out after the header
+    uint32_t symtab = FASL_HEADER_SIZE;
+    uint32_t consttab = symtab + m.symbol_count * 4;
+    uint32_t formtab = consttab + m.constant_count * 4;
+    uint32_t strings = formtab + m.form_count * FASL_FORM_SIZE;
+    uint32_t strings_size = 0;
+    for (uint32_t i = 0; i < m.symbol_count; i++) {
+        strings_size += strlen(m.symbols[i]) + 1;
+    }
+    uint32_t code = strings + strings_size;
+
+    Buffer out = {0};
+    for (uint32_t i = 0; i < FASL_HEADER_SIZE / 4; i++) buf_u32(&out, 0);
+
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < m.symbol_count; i++) {
+        buf_u32(&out, offset);
+        offset += strlen(m.symbols[i]) + 1;
+    }
+    for (uint32_t i = 0; i < m.constant_count; i++) {
+        buf_u32(&out, (uint32_t)m.constants[i]);
+    }
+    for (uint32_t i = 0; i < m.form_count; i++) {
+        buf_u32(&out, m.forms[i][0]);
+        buf_u32(&out, m.forms[i][1]);
+        buf_u32(&out, m.forms[i][2] + code);
+    }
+    for (uint32_t i = 0; i < m.symbol_count; i++) {
+        for (const char *c = m.symbols[i]; ; c++) {
+            buf_u8(&out, (uint8_t)*c);
+            if (!*c) break;
+        }
+    }
+    for (uint32_t i = 0; i < m.code.size; i++) {
+        buf_u8(&out, m.code.data[i]);
+    }
+    free(m.code.data);
+
+    put_u32(out.data + FASL_H_MAGIC, FASL_MAGIC);
+    put_u32(out.data + FASL_H_VERSION, FASL_VERSION);
+    put_u32(out.data + FASL_H_SIZE, out.size);
+    put_u32(out.data + FASL_H_NAME, name);
+    put_u32(out.data + FASL_H_SYMBOLS, m.symbol_count);
+    put_u32(out.data + FASL_H_CONSTANTS, m.constant_count);
+    put_u32(out.data + FASL_H_FORMS, m.form_count);
+    put_u32(out.data + FASL_H_SYMTAB, symtab);
+    put_u32(out.data + FASL_H_CONSTTAB, consttab);
+    put_u32(out.data + FASL_H_FORMTAB, formtab);
+    put_u32(out.data + FASL_H_STRINGS, strings);
+    put_u32(out.data + FASL_H_CODE, code);
+    put_u32(out.data + FASL_H_HASH,
+            fasl_hash(out.data + FASL_HEADER_SIZE, out.size - FASL_HEADER_SIZE));
+
+    return out;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s OUTPUT.c [MODULE.mon...]\n", argv[0]);
+        return 1;
+    }
+
+    lnlisp_init();
+
+    FILE *out = fopen(argv[1], "w");
+    if (!out) {
+        fprintf(stderr, "mkfasl: cannot write %s\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(out, "/* Generated by mkfasl, do not edit */\n\n");
+
+    int count = argc - 2;
+    for (int i = 0; i < count; i++) {
+        char *source = read_file(argv[i + 2]);
+        if (!source) {
+            fprintf(stderr, "mkfasl: cannot read %s\n", argv[i + 2]);
+            return 1;
+        }
+
+        Buffer fasl = compile_module(argv[i + 2], source);
+        free(source);
+
+        fprintf(out, "static const unsigned char module_%d[] = {", i);
+        for (uint32_t j = 0; j < fasl.size; j++) {
+            fprintf(out, "%s0x%02x,", (j % 12) ? " " : "\n    ", fasl.data[j]);
+        }
+        fprintf(out, "\n};\n\n");
+        free(fasl.data);
+    }
+
+    // Keep the tables non-empty so the output is valid C with no modules
+    fprintf(out, "const unsigned char *const monad_fasl_modules[] = {");
+    for (int i = 0; i < count; i++) fprintf(out, "\n    module_%d,", i);
+    fprintf(out, count ? "\n};\n\n" : "0};\n\n");
+
+    fprintf(out, "const unsigned int monad_fasl_sizes[] = {");
+    for (int i = 0; i < count; i++) fprintf(out, "\n    sizeof(module_%d),", i);
+    fprintf(out, count ? "\n};\n\n" : "0};\n\n");
+
+    fprintf(out, "const unsigned int monad_fasl_count = %d;\n", count);
+    fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * @file mkimage.c
+ * @version 0.0.2
+ * Build-time boot image generator
+ *
+ * Runs the interpreter hosted over the prelude sources and dumps the
+ * resulting heap, symbol table and environments as a C array that is
+ * linked into kernel.bin.
+ *
+ * Usage: monad-mkimage OUTPUT.c [PRELUDE.mon...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "monad.h"
+
+static char* read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *buf = malloc(size + 1);
+    if (buf && fread(buf, 1, size, f) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    if (buf) buf[size] = '\0';
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t image[1024 * 1024];
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s OUTPUT.c [PRELUDE.mon...]\n", argv[0]);
+        return 1;
+    }
+
+    lnlisp_init();
+
+    for (int i = 2; i < argc; i++) {
+        char *source = read_file(argv[i]);
+        if (!source) {
+            fprintf(stderr, "mkimage: cannot read %s\n", argv[i]);
+            return 1;
+        }
+        if (lnlisp_load(source) != 0) {
+            fprintf(stderr, "mkimage: failed to load %s\n", argv[i]);
+            return 1;
+        }
+        free(source);
+    }
+
+    uint32_t size = lnl_image_save(image, sizeof(image));
+    if (size == 0) {
+        fprintf(stderr, "mkimage: heap could not be serialized\n");
+        return 1;
+    }
+
+    FILE *out = fopen(argv[1], "w");
+    if (!out) {
+        fprintf(stderr, "mkimage: cannot write %s\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(out, "/* Generated by mkimage, do not edit */\n\n");
+    fprintf(out, "const unsigned char monad_boot_image[] = {");
+    for (uint32_t i = 0; i < size; i++) {
+        fprintf(out, "%s0x%02x,", (i % 12) ? " " : "\n    ", image[i]);
+    }
+    fprintf(out, "\n};\n\n");
+    fprintf(out, "const unsigned int monad_boot_image_size = %u;\n", size);
+    fclose(out);
+
+    return 0;
+}
@@ -6,7 +6,11 @@
 
 #include "monad.h"
 #include "sexparser.h"
+#include "fasl.h"
+#include "editor.h"
+#include "../libc/stdlib.h"
 #include "../cursor.h"
+#include "../clock.h"
 
 #ifndef NULL
 #define NULL ((void*)0)
@@ -52,34 +56,87 @@ static int str_equal(const char *s1, const char *s2) {
     return *s1 == *s2;
 }
 
-static void str_copy(char *dst, const char *src, int max_len) {
-    int i = 0;
-    while (src[i] && i < max_len - 1) {
-        dst[i] = src[i];
-        i++;
+static int str_length(const char *s) {
+    int len = 0;
+    while (s[len]) len++;
+    return len;
+}
+
+int lnl_strcmp(const char *s1, const char *s2) {
+    while (*s1 && *s1 == *s2) {
+        s1++;
+        s2++;
     }
-    dst[i] = '\0';
+    return (uint8_t)*s1 - (uint8_t)*s2;
 }
 
 /// SYMBOL TABLE
 
 static char symbol_table[MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
+static uint32_t symbol_hashes[MAX_SYMBOLS];
 static int symbol_count = 0;
 
-static const char* intern_symbol(const char *name) {
-    // Check if exists
-    for (int i = 0; i < symbol_count; i++) {
-        if (str_equal(symbol_table[i], name)) {
-            return symbol_table[i];
+// Open-addressed index into symbol_table (slot + 1, 0 when empty), kept
+// under half full so a lookup is normally a single probe
+#define SYMBOL_INDEX_SIZE 2048
+static uint16_t symbol_index[SYMBOL_INDEX_SIZE];
+
+static int symbol_matches(int slot, const char *name, int len, uint32_t hash) {
+    if (symbol_hashes[slot] != hash) return 0;
+    const char *sym = symbol_table[slot];
+    for (int i = 0; i < len; i++) {
+        if (sym[i] != name[i]) return 0;
+    }
+    return sym[len] == '\0';
+}
+
+static void symbol_index_rebuild(void) {
+    for (int i = 0; i < SYMBOL_INDEX_SIZE; i++) {
+        symbol_index[i] = 0;
+    }
+    for (int slot = 0; slot < symbol_count; slot++) {
+        uint32_t hash = sexp_hash(symbol_table[slot], str_length(symbol_table[slot]));
+        uint32_t i = hash & (SYMBOL_INDEX_SIZE - 1);
+        while (symbol_index[i]) i = (i + 1) & (SYMBOL_INDEX_SIZE - 1);
+        symbol_hashes[slot] = hash;
+        symbol_index[i] = (uint16_t)(slot + 1);
+    }
+}
+
+// Intern len bytes of name (need not be NUL-terminated) with its SEXP_HASH
+static const char* intern_span(const char *name, int len, uint32_t hash) {
+    // Over-long names are truncated, as they always have been
+    if (len >= MAX_SYMBOL_LENGTH) {
+        len = MAX_SYMBOL_LENGTH - 1;
+        hash = sexp_hash(name, len);
+    }
+
+    uint32_t i = hash & (SYMBOL_INDEX_SIZE - 1);
+    while (symbol_index[i]) {
+        int slot = symbol_index[i] - 1;
+        if (symbol_matches(slot, name, len, hash)) {
+            return symbol_table[slot];
         }
+        i = (i + 1) & (SYMBOL_INDEX_SIZE - 1);
     }
 
     // Add new
-    if (symbol_count < MAX_SYMBOLS) {
-        str_copy(symbol_table[symbol_count], name, MAX_SYMBOL_LENGTH);
-        return symbol_table[symbol_count++];
+    if (symbol_count >= MAX_SYMBOLS) {
+        return NULL;
     }
-    return NULL;
+    int slot = symbol_count++;
+    for (int j = 0; j < len; j++) {
+        symbol_table[slot][j] = name[j];
+    }
+    symbol_table[slot][len] = '\0';
+    symbol_hashes[slot] = hash;
+    symbol_index[i] = (uint16_t)(slot + 1);
+    return symbol_table[slot];
+}
+
+static const char* intern_symbol(const char *name) {
+    int len = str_length(name);
+    return intern_span(name, len, sexp_hash(name, len));
 }
 
 /// CONSTRUCTORS
@@ -92,6 +149,14 @@ LNL* lnl_int(int32_t val) {
     return obj;
 }
 
+LNL* lnl_float(double val) {
+    LNL *obj = alloc_obj();
+    if (!obj) return lnl_nil();
+    obj->type = TYPE_FLOAT;
+    obj->value.real = val;
+    return obj;
+}
+
 LNL* lnl_symbol(const char *name) {
     LNL *obj = alloc_obj();
     if (!obj) return lnl_nil();
@@ -100,6 +165,14 @@ LNL* lnl_symbol(const char *name) {
     return obj;
 }
 
+LNL* lnl_symbol_span(const char *name, int len, uint32_t hash) {
+    LNL *obj = alloc_obj();
+    if (!obj) return lnl_nil();
+    obj->type = TYPE_SYMBOL;
+    obj->value.symbol = (char*)intern_span(name, len, hash);
+    return obj;
+}
+
 LNL* lnl_cons(LNL *car, LNL *cdr) {
     LNL *obj = alloc_obj();
     if (!obj) return lnl_nil();
@@ -127,12 +200,26 @@ LNL* lnl_function(LNL *params, LNL *body, Environment *env) {
     return obj;
 }
 
+LNL* lnl_autoload(void *module, uint32_t form) {
+    LNL *obj = alloc_obj();
+    if (!obj) return lnl_nil();
+    obj->type = TYPE_AUTOLOAD;
+    obj->value.autoload.module = module;
+    obj->value.autoload.form = form;
+    obj->value.autoload.loading = 0;
+    return obj;
+}
+
 /// ENVIRONMENT
 
 static Environment envs[128];
 static int env_count = 0;
 static Environment *global_env = NULL;
 
+Environment* lnlisp_global_env(void) {
+    return global_env;
+}
+
 Environment* env_create(Environment *parent) {
     if (env_count >= 128) return NULL;
     Environment *env = &envs[env_count++];
@@ -201,11 +288,45 @@ static void* cb_int(int32_t v)         { return lnl_int(v);                   }
 static void* cb_sym(const char *n)     { return lnl_symbol(n);                }
 static void* cb_cons(void *a, void *b) { return lnl_cons((LNL*)a, (LNL*)b);   }
 
+static void* cb_sym_span(const char *n, int len, uint32_t hash) {
+    return lnl_symbol_span(n, len, hash);
+}
+
+// Suffixed and out-of-range literals; the interpreter keeps 32-bit integers
+static void* cb_number(const SexpNumber *num) {
+    if (num->type == SEXP_NUM_FLOAT || num->type == SEXP_NUM_F32 || num->type == SEXP_NUM_F64) {
+        return lnl_float(num->value.real);
+    }
+    int64_t v = num->value.integer;
+    if (num->type == SEXP_NUM_U32) return lnl_int((int32_t)(uint32_t)v); // Bit pattern
+    if (v < -2147483647 - 1 || v > 2147483647) return NULL;
+    return lnl_int((int32_t)v);
+}
+
+static void cb_set_cdr(void *cons, void *cdr) {
+    ((LNL*)cons)->value.cons.cdr = (LNL*)cdr;
+}
+
+// Sized to the heap: a datum nested deeper than that has more cells than
+// the heap holds, so it can't be read anyway. Past it grow_stack returns
+// NULL, which the parser reports as nesting too deep. Parses don't
+// overlap, so parsers share it.
+static SexpFrame parse_stack[HEAP_SIZE];
+
+static void* cb_grow_stack(void *stack, uint32_t bytes) {
+    (void)stack;
+    return bytes <= sizeof(parse_stack) ? parse_stack : NULL;
+}
+
+static const SexpAllocator lnl_allocator = {
+    cb_nil, cb_bool, cb_int, cb_sym, cb_cons, cb_set_cdr, cb_grow_stack, cb_sym_span,
+    cb_number
+};
+
 LNL* lnlisp_read(const char *input) {
     SexpParser parser;
-    SexpAllocator alloc = {cb_nil, cb_bool, cb_int, cb_sym, cb_cons};
     sexp_parser_init(&parser, input);
-    LNL *result = (LNL*)sexp_parse(&parser, &alloc);
+    LNL *result = (LNL*)sexp_parse(&parser, &lnl_allocator);
 
     // Check for parse errors
     if (parser.error_code != SEXP_OK) {
@@ -218,9 +339,62 @@ LNL* lnlisp_read(const char *input) {
     return result;
 }
 
+// Nodes are visited last to first, so every subtree is finished before
+// the list node that owns it. Finished values wait on a stack made of
+// cons cells, which a list then takes over as its own cells.
+LNL* lnl_from_flat(const SexpNode *root) {
+    LNL *stack = lnl_nil();
+
+    for (const SexpNode *node = root + root->size - 1; node >= root; node--) {
+        LNL *value;
+
+        switch (node->tag) {
+            case SEXP_NODE_NIL:    value = lnl_nil();                        break;
+            case SEXP_NODE_TRUE:   value = lnl_true();                       break;
+            case SEXP_NODE_FALSE:  value = lnl_false();                      break;
+            case SEXP_NODE_INT:    value = lnl_int(node->value.integer);     break;
+            case SEXP_NODE_SYMBOL: value = (LNL*)node->value.symbol;         break;
+            case SEXP_NODE_NUMBER: value = (LNL*)node->value.number;         break;
+            default: {
+                // The children are the first cells of the stack, in order
+                int children = 0;
+                const SexpNode *c = node + 1;
+                for (; c < SEXP_NODE_NEXT(node); c = SEXP_NODE_NEXT(c)) {
+                    children++;
+                }
+
+                LNL *last = stack;
+                for (int i = 1; i < children; i++) {
+                    last = last->value.cons.cdr;
+                }
+                LNL *rest = last->value.cons.cdr;
+
+                if (node->tag == SEXP_NODE_DOTTED) {
+                    // The tail's own cell is dropped, its value is the cdr
+                    LNL *prev = stack;
+                    while (prev->value.cons.cdr != last) prev = prev->value.cons.cdr;
+                    prev->value.cons.cdr = last->value.cons.car;
+                } else {
+                    last->value.cons.cdr = lnl_nil();
+                }
+
+                value = stack;
+                stack = rest;
+                break;
+            }
+        }
+
+        stack = lnl_cons(value, stack);
+        if (!lnl_is_pair(stack)) return lnl_nil(); // Heap exhausted
+    }
+
+    return stack->value.cons.car;
+}
+
 /// EVALUATOR
 
 static LNL* eval_list(LNL *exprs, Environment *env);
+static void print_elapsed(uint64_t ns, uint64_t cycles);
 
 LNL* lnlisp_eval(LNL *expr, Environment *env) {
     if (!expr) return lnl_nil();
@@ -229,7 +403,7 @@ LNL* lnlisp_eval(LNL *expr, Environment *env) {
     if (lnl_is_nil(expr)) return expr;
 
     // Self-evaluating types
-    if (expr->type == TYPE_INTEGER || expr->type == TYPE_BOOLEAN) {
+    if (expr->type == TYPE_INTEGER || expr->type == TYPE_FLOAT || expr->type == TYPE_BOOLEAN) {
         return expr;
     }
 
@@ -242,6 +416,9 @@ LNL* lnlisp_eval(LNL *expr, Environment *env) {
             print("\n");
             return lnl_nil();
         }
+        if (val->type == TYPE_AUTOLOAD) {
+            return fasl_force(val);
+        }
         return val;
     }
 
@@ -279,6 +456,17 @@ LNL* lnlisp_eval(LNL *expr, Environment *env) {
                 return val;
             }
 
+            // import
+            if (str_equal(sym, "import")) {
+                LNL *module = lnl_car(rest);
+                if (module->type != TYPE_SYMBOL) {
+                    print("import: module name must be a symbol\n");
+                    return lnl_nil();
+                }
+                fasl_import(module->value.symbol, lnl_car(lnl_cdr(rest)), env);
+                return lnl_nil();
+            }
+
             // lambda
             if (str_equal(sym, "lambda")) {
                 LNL *params = lnl_car(rest);
@@ -299,6 +487,16 @@ LNL* lnlisp_eval(LNL *expr, Environment *env) {
                     return lnlisp_eval(lnl_car(lnl_cdr(rest)), env);
                 }
             }
+
+            // time: the value of expr, after printing how long it took
+            if (str_equal(sym, "time")) {
+                uint64_t start_ns = clock_ns();
+                uint64_t start_cycles = clock_cycles();
+                LNL *val = lnlisp_eval(lnl_car(rest), env);
+                uint64_t cycles = clock_cycles() - start_cycles;
+                print_elapsed(clock_ns() - start_ns, cycles);
+                return val;
+            }
         }
 
         // Function application
@@ -368,8 +566,33 @@ static LNL* eval_list(LNL *exprs, Environment *env) {
 
 /// PRIMITIVES
 
+// Arithmetic stays in 32-bit integers unless a float is involved
+static int any_float(LNL *args) {
+    for (; lnl_is_pair(args); args = lnl_cdr(args)) {
+        if (lnl_car(args)->type == TYPE_FLOAT) return 1;
+    }
+    return 0;
+}
+
+static double number_value(LNL *obj) {
+    return obj->type == TYPE_FLOAT ? obj->value.real : (double)obj->value.integer;
+}
+
+static int is_number(LNL *obj) {
+    return obj->type == TYPE_INTEGER || obj->type == TYPE_FLOAT;
+}
+
 static LNL* prim_add(LNL *args, Environment *env) {
     (void)env;
+    if (any_float(args)) {
+        double sum = 0;
+        for (; lnl_is_pair(args); args = lnl_cdr(args)) {
+            LNL *arg = lnl_car(args);
+            if (is_number(arg)) sum += number_value(arg);
+        }
+        return lnl_float(sum);
+    }
+
     int32_t sum = 0;
     while (lnl_is_pair(args)) {
         LNL *arg = lnl_car(args);
@@ -386,7 +609,18 @@ static LNL* prim_sub(LNL *args, Environment *env) {
     if (!lnl_is_pair(args)) return lnl_int(0);
 
     LNL *first = lnl_car(args);
-    if (first->type != TYPE_INTEGER) return lnl_int(0);
+    if (!is_number(first)) return lnl_int(0);
+
+    if (any_float(args)) {
+        double result = number_value(first);
+        args = lnl_cdr(args);
+        if (lnl_is_nil(args)) return lnl_float(-result);
+        for (; lnl_is_pair(args); args = lnl_cdr(args)) {
+            LNL *arg = lnl_car(args);
+            if (is_number(arg)) result -= number_value(arg);
+        }
+        return lnl_float(result);
+    }
 
     int32_t result = first->value.integer;
     args = lnl_cdr(args);
@@ -407,6 +641,15 @@ static LNL* prim_sub(LNL *args, Environment *env) {
 
 static LNL* prim_mul(LNL *args, Environment *env) {
     (void)env;
+    if (any_float(args)) {
+        double prod = 1;
+        for (; lnl_is_pair(args); args = lnl_cdr(args)) {
+            LNL *arg = lnl_car(args);
+            if (is_number(arg)) prod *= number_value(arg);
+        }
+        return lnl_float(prod);
+    }
+
     int32_t prod = 1;
     while (lnl_is_pair(args)) {
         LNL *arg = lnl_car(args);
@@ -438,6 +681,12 @@ static LNL* prim_eq(LNL *args, Environment *env) {
             }
         }
 
+        if (first->type == TYPE_FLOAT) {
+            if (first->value.real != curr->value.real) {
+                return lnl_false();
+            }
+        }
+
         args = lnl_cdr(args);
     }
     return lnl_true();
@@ -468,8 +717,237 @@ static LNL* prim_list(LNL *args, Environment *env) {
     return args;
 }
 
+// Exact up to 2^53; 64-bit integer conversions would need libgcc
+static double u64_to_double(uint64_t n) {
+    return (double)(uint32_t)(n >> 32) * 4294967296.0 + (double)(uint32_t)n;
+}
+
+// Nanoseconds since boot, as a float since integers are 32 bits
+static LNL* prim_now(LNL *args, Environment *env) {
+    (void)args;
+    (void)env;
+    return lnl_float(u64_to_double(clock_ns()));
+}
+
 /// PRINTER
 
+static void print_uint(uint32_t n) {
+    char buf[10];
+    int i = 0;
+    do {
+        buf[i++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    while (i > 0) putchar(buf[--i]);
+}
+
+// Nine digits at a time, through a double; exact below 2^53
+static void print_u64(uint64_t n) {
+    double x = u64_to_double(n);
+    uint32_t high = (uint32_t)(x / 1e9);
+    double rest = x - (double)high * 1e9;
+    if (rest < 0) {  // The quotient rounded up
+        high--;
+        rest += 1e9;
+    }
+    uint32_t low = (uint32_t)rest;
+    if (!high) {
+        print_uint(low);
+        return;
+    }
+    print_uint(high);
+    for (uint32_t d = 100000000; d; d /= 10) {
+        putchar((char)('0' + low / d % 10));
+    }
+}
+
+static const long double pow10_table[] = {
+    1e1L, 1e2L, 1e4L, 1e8L, 1e16L, 1e32L, 1e64L, 1e128L, 1e256L,
+};
+
+// Scaled in extended precision, so the 17th digit is usually right already
+static long double scale_pow10(long double v, int e) {
+    int n = e < 0 ? -e : e;
+    for (int i = 0; n; i++, n >>= 1) {
+        if (n & 1) {
+            v = e < 0 ? v / pow10_table[i] : v * pow10_table[i];
+        }
+    }
+    return v;
+}
+
+// Significand of prec (at most 17) digits as hi * 10^8 + lo
+typedef struct {
+    uint32_t hi;
+    uint32_t lo;
+    int exp;     // Decimal exponent of the first digit
+    int prec;
+} FloatDigits;
+
+static void digits_step(FloatDigits *d, int up) {
+    uint32_t top = 1;
+    for (int i = 9; i < d->prec; i++) top *= 10; // 10^(prec - 9)
+
+    if (up) {
+        if (++d->lo == 100000000u) {
+            d->lo = 0;
+            if (++d->hi == top * 10) {
+                d->hi = top;
+                d->exp++;
+            }
+        }
+    } else if (d->lo-- == 0) {
+        d->lo = 99999999u;
+        if (d->hi-- == top) {
+            d->hi = top * 10 - 1;
+            d->exp--;
+        }
+    }
+}
+
+static void digits_text(const FloatDigits *d, char *digits) {
+    uint32_t hi = d->hi;
+    uint32_t lo = d->lo;
+    for (int i = d->prec - 1; i >= d->prec - 8; i--, lo /= 10) digits[i] = (char)('0' + lo % 10);
+    for (int i = d->prec - 9; i >= 0; i--, hi /= 10) digits[i] = (char)('0' + hi % 10);
+}
+
+// The digits as d.ddde-ddd, read back with the same strtod as the reader
+static double digits_value(const char *digits, int prec, int exp) {
+    char text[28];
+    int len = 0;
+    text[len++] = digits[0];
+    text[len++] = '.';
+    for (int i = 1; i < prec; i++) text[len++] = digits[i];
+    text[len++] = 'e';
+    if (exp < 0) {
+        text[len++] = '-';
+        exp = -exp;
+    }
+    if (exp >= 100) text[len++] = (char)('0' + exp / 100);
+    if (exp >= 10) text[len++] = (char)('0' + exp / 10 % 10);
+    text[len++] = (char)('0' + exp % 10);
+    text[len] = '\0';
+    return strtod(text, NULL);
+}
+
+// The first prec significant digits of x > 0. Returns 1 if they read back
+// as x, nudging the last digit if the scaling was off. Only 32-bit integer
+// conversions, so nothing is needed from libgcc.
+static int float_digits(double x, int prec, char *digits, int *exp) {
+    FloatDigits d = { 0, 0, 0, prec };
+    long double a = x;
+    while (a >= 1e16L) { a /= 1e16L; d.exp += 16; }
+    while (a >= 10)    { a /= 10;    d.exp++; }
+    while (a < 1e-16L) { a *= 1e16L; d.exp -= 16; }
+    while (a < 1)      { a *= 10;    d.exp--; }
+
+    uint32_t top = 1;
+    for (int i = 9; i < prec; i++) top *= 10;
+
+    // The exponent estimate can be one off either way
+    for (int tries = 0; tries < 3; tries++) {
+        long double y = scale_pow10(x, prec - 1 - d.exp);
+        uint32_t hi = (uint32_t)(y / 1e8L);
+        long double rest = y - (long double)hi * 1e8L;
+        if (rest < 0) {
+            hi--;
+            rest += 1e8L;
+        }
+        uint32_t lo = (uint32_t)(rest + 0.5L);
+        if (lo >= 100000000u) {
+            lo -= 100000000u;
+            hi++;
+        }
+
+        if (hi >= top * 10) {
+            d.exp++;
+        } else if (hi < top) {
+            d.exp--;
+        } else {
+            d.hi = hi;
+            d.lo = lo;
+            break;
+        }
+    }
+
+    for (int step = 0; step < 4; step++) {
+        digits_text(&d, digits);
+        double back = digits_value(digits, prec, d.exp);
+        if (back == x) break;
+        digits_step(&d, back < x);
+    }
+    *exp = d.exp;
+    return digits_value(digits, prec, d.exp) == x;
+}
+
+// Fifteen significant digits unless that doesn't read back as the same
+// value, then seventeen. Always has a '.' or exponent, so it reads back as
+// a float and not an integer.
+static void print_float(double x) {
+    if (x != x) {
+        print("nan");
+        return;
+    }
+    if (x < 0 || (x == 0 && 1 / x < 0)) {
+        putchar('-');
+        x = -x;
+    }
+    if (x == 0) {
+        print("0.0");
+        return;
+    }
+    if (x - x != 0) {
+        print("inf");
+        return;
+    }
+
+    char digits[17];
+    int e;
+    int prec = 15;
+    if (!float_digits(x, prec, digits, &e)) {
+        prec = 17;
+        float_digits(x, prec, digits, &e);
+    }
+
+    int n = prec;
+    while (n > 1 && digits[n - 1] == '0') n--;
+
+    if (e >= -5 && e < prec) {
+        if (e < 0) {
+            print("0.");
+            for (int i = -1; i > e; i--) putchar('0');
+            for (int i = 0; i < n; i++) putchar(digits[i]);
+        } else {
+            for (int i = 0; i <= e; i++) putchar(i < n ? digits[i] : '0');
+            putchar('.');
+            if (n <= e + 1) putchar('0');
+            for (int i = e + 1; i < n; i++) putchar(digits[i]);
+        }
+        return;
+    }
+
+    putchar(digits[0]);
+    if (n > 1) {
+        putchar('.');
+        for (int i = 1; i < n; i++) putchar(digits[i]);
+    }
+    putchar('e');
+    if (e < 0) {
+        putchar('-');
+        e = -e;
+    }
+    print_uint((uint32_t)e);
+}
+
+static void print_elapsed(uint64_t ns, uint64_t cycles) {
+    print("; ");
+    print_float(u64_to_double(ns) / 1e6);
+    print(" ms, ");
+    print_u64(cycles);
+    print(" cycles\n");
+}
+
 static void print_list(LNL *obj) {
     putchar('(');
     int first = 1;
@@ -525,6 +1003,10 @@ void lnlisp_print(LNL *obj) {
             break;
         }
 
+        case TYPE_FLOAT:
+            print_float(obj->value.real);
+            break;
+
         case TYPE_BOOLEAN:
             print(obj->value.boolean ? "#t" : "#f");
             break;
@@ -549,6 +1031,10 @@ void lnlisp_print(LNL *obj) {
             print("<builtin>");
             break;
 
+        case TYPE_AUTOLOAD:
+            print("<autoload>");
+            break;
+
         default:
             print("<?>");
             break;
@@ -557,162 +1043,436 @@ void lnlisp_print(LNL *obj) {
 
 /// REPL
 
-static char input_buf[MAX_INPUT];
-static int input_pos = 0;
-
-extern void putchar_at(char c, uint8_t color, uint32_t x, uint32_t y);
-extern uint32_t cursor_x;
-extern uint32_t cursor_y;
+// Reader state carried across inputs
+static SexpParser repl_parser;
+static char repl_stream[2 * EDITOR_CAPACITY];
 
+// Keys go to the editor until Enter completes an input. Edits only move
+// the cursor and write to the console; the kernel flushes the console
+// (and redraws the cursor) once the pending keys are handled
 void lnlisp_repl_input(char c) {
-    const int PROMPT_LEN = 5;  // Length of "LNL> "
-
-    // Handle Ctrl+A - beginning of line
-    if (c == 1) {  // Ctrl+A
-        cursor_x = PROMPT_LEN;
-        cursor_update();
+    if (!editor_key(c)) {
         return;
     }
 
-    // Handle Ctrl+E - end of line
-    if (c == 5) {  // Ctrl+E
-        cursor_x = PROMPT_LEN + input_pos;
-        cursor_update();
-        return;
+    int length;
+    const char *text = editor_submit(&length);
+    putchar('\n');
+
+    // Inputs accumulate in the reader until they complete a datum
+    if (sexp_feed(&repl_parser, text, length) == SEXP_ERROR_BUFFER_FULL ||
+        sexp_feed(&repl_parser, "\n", 1) == SEXP_ERROR_BUFFER_FULL) {
+        print("Input too long\n");
+        sexp_parser_init_stream(&repl_parser, repl_stream, sizeof(repl_stream));
     }
 
-    // Handle Ctrl+F - forward one character
-    if (c == 6) {  // Ctrl+F
-        if (cursor_x < PROMPT_LEN + input_pos) {
-            cursor_x++;
-            cursor_update();
+    while (1) {
+        LNL *expr = (LNL*)sexp_parse(&repl_parser, &lnl_allocator);
+        if (repl_parser.error_code == SEXP_NEED_MORE) {
+            break;
+        }
+        if (repl_parser.error_code != SEXP_OK) {
+            print("Parse error: ");
+            print(sexp_get_error(&repl_parser));
+            print("\n");
+            sexp_parser_init_stream(&repl_parser, repl_stream, sizeof(repl_stream));
+            break;
         }
-        return;
-    }
 
-    // Handle Ctrl+B - backward one character
-    if (c == 2) {  // Ctrl+B
-        if (cursor_x > PROMPT_LEN) {
-            cursor_x--;
-            cursor_update();
+        LNL *result = lnlisp_eval(expr, global_env);
+        if (result) {
+            lnlisp_print(result);
+            putchar('\n');
         }
-        return;
     }
 
-    // Handle Ctrl+K - kill to end of line
-    if (c == 11) {  // Ctrl+K
-        int cursor_offset = cursor_x - PROMPT_LEN;
-        int old_pos = input_pos;
-        input_pos = cursor_offset;
+    print(sexp_pending(&repl_parser) ? "...> " : "LNL> ");
+    editor_begin();
+}
+
+// Builtins are referenced by their index here from the boot image,
+// so only ever append to this table
+static const struct {
+    const char *name;
+    LNLBuiltin func;
+} builtins[] = {
+    {"+",    prim_add},
+    {"-",    prim_sub},
+    {"*",    prim_mul},
+    {"=",    prim_eq},
+    {"cons", prim_cons},
+    {"car",  prim_car},
+    {"cdr",  prim_cdr},
+    {"list", prim_list},
+    {"now",  prim_now},
+};
+
+#define BUILTIN_COUNT ((int)(sizeof(builtins) / sizeof(builtins[0])))
 
-        // Clear to end of line visually
-        int saved_x = cursor_x;
-        for (int i = cursor_offset; i < old_pos; i++) {
-            putchar(' ');
-        }
-        cursor_x = saved_x;
-        cursor_update();
-        return;
+void lnlisp_init(void) {
+    heap_pos = 0;
+    symbol_count = 0;
+    env_count = 0;
+    symbol_index_rebuild();
+
+    global_env = env_create(NULL);
+
+    for (int i = 0; i < BUILTIN_COUNT; i++) {
+        env_define(global_env, builtins[i].name, lnl_builtin(builtins[i].func));
     }
+}
 
-    // Handle Ctrl+D - delete character at cursor
-    if (c == 4) {  // Ctrl+D
-        int cursor_offset = cursor_x - PROMPT_LEN;
-        if (cursor_offset < input_pos) {
-            // Remove character at cursor
-            for (int i = cursor_offset; i < input_pos - 1; i++) {
-                input_buf[i] = input_buf[i + 1];
-            }
-            input_pos--;
+int lnlisp_load(const char *source) {
+    SexpParser parser;
+    sexp_parser_init(&parser, source);
 
-            // Redraw from cursor position
-            int saved_x = cursor_x;
-            for (int i = cursor_offset; i < input_pos; i++) {
-                putchar(input_buf[i]);
-            }
-            putchar(' ');  // Clear last character
-            cursor_x = saved_x;
-            cursor_update();
+    while (sexp_has_more(&parser)) {
+        LNL *expr = (LNL*)sexp_parse(&parser, &lnl_allocator);
+        if (parser.error_code != SEXP_OK) {
+            print("Parse error: ");
+            print(sexp_get_error(&parser));
+            print("\n");
+            return -1;
         }
+        lnlisp_eval(expr, global_env);
+    }
+    return 0;
+}
+
+/// BOOT IMAGE
+// The image is a flat little-endian dump of the symbol table, the heap and
+// the environments. Pointers are stored as indices so the same image can be
+// produced by a hosted 64-bit build and mapped into the 32-bit kernel:
+//
+//   header   magic, version, symbol count, heap count, env count, global env
+//   symbols  u8 length + bytes, in table order
+//   heap     u8 type + payload, in heap order
+//   envs     parent, size, then size * (symbol index, object ref)
+
+// Object references
+#define IMAGE_REF_NULL  0
+#define IMAGE_REF_NIL   1
+#define IMAGE_REF_TRUE  2
+#define IMAGE_REF_FALSE 3
+#define IMAGE_REF_HEAP  4  // heap index + IMAGE_REF_HEAP
+
+#define IMAGE_NO_SYMBOL 0xFFFFFFFF
+
+typedef struct {
+    uint8_t *buf;
+    uint32_t pos;
+    uint32_t cap;
+    int failed;
+} ImageWriter;
+
+typedef struct {
+    const uint8_t *buf;
+    uint32_t pos;
+    uint32_t size;
+    int failed;
+} ImageReader;
+
+static void image_put_u8(ImageWriter *w, uint8_t v) {
+    if (w->pos >= w->cap) {
+        w->failed = 1;
         return;
     }
+    w->buf[w->pos++] = v;
+}
 
-    if (c == '\n') {
-        input_buf[input_pos] = '\0';
-        putchar('\n');
+static void image_put_u32(ImageWriter *w, uint32_t v) {
+    image_put_u8(w, v & 0xFF);
+    image_put_u8(w, (v >> 8) & 0xFF);
+    image_put_u8(w, (v >> 16) & 0xFF);
+    image_put_u8(w, (v >> 24) & 0xFF);
+}
 
-        if (input_pos > 0) {
-            LNL *expr = lnlisp_read(input_buf);
-            if (expr) {
-                LNL *result = lnlisp_eval(expr, global_env);
-                if (result) {
-                    lnlisp_print(result);
-                    putchar('\n');
-                }
-            }
+static uint8_t image_get_u8(ImageReader *r) {
+    if (r->pos >= r->size) {
+        r->failed = 1;
+        return 0;
+    }
+    return r->buf[r->pos++];
+}
+
+static uint32_t image_get_u32(ImageReader *r) {
+    uint32_t v = image_get_u8(r);
+    v |= (uint32_t)image_get_u8(r) << 8;
+    v |= (uint32_t)image_get_u8(r) << 16;
+    v |= (uint32_t)image_get_u8(r) << 24;
+    return v;
+}
+
+static uint32_t image_obj_ref(ImageWriter *w, LNL *obj) {
+    if (!obj)              return IMAGE_REF_NULL;
+    if (obj == &nil_obj)   return IMAGE_REF_NIL;
+    if (obj == &true_obj)  return IMAGE_REF_TRUE;
+    if (obj == &false_obj) return IMAGE_REF_FALSE;
+    if (obj < heap || obj >= heap + heap_pos) {
+        w->failed = 1;
+        return IMAGE_REF_NULL;
+    }
+    return (uint32_t)(obj - heap) + IMAGE_REF_HEAP;
+}
+
+static LNL* image_obj_deref(ImageReader *r, uint32_t ref) {
+    switch (ref) {
+        case IMAGE_REF_NULL:  return NULL;
+        case IMAGE_REF_NIL:   return &nil_obj;
+        case IMAGE_REF_TRUE:  return &true_obj;
+        case IMAGE_REF_FALSE: return &false_obj;
+    }
+    if (ref - IMAGE_REF_HEAP >= (uint32_t)heap_pos) {
+        r->failed = 1;
+        return NULL;
+    }
+    return &heap[ref - IMAGE_REF_HEAP];
+}
+
+static uint32_t image_symbol_ref(ImageWriter *w, const char *sym) {
+    if (!sym) return IMAGE_NO_SYMBOL;
+    const char *base = symbol_table[0];
+    if (sym < base || sym >= base + symbol_count * MAX_SYMBOL_LENGTH) {
+        w->failed = 1;
+        return IMAGE_NO_SYMBOL;
+    }
+    return (uint32_t)(sym - base) / MAX_SYMBOL_LENGTH;
+}
+
+static char* image_symbol_deref(ImageReader *r, uint32_t ref) {
+    if (ref == IMAGE_NO_SYMBOL) return NULL;
+    if (ref >= (uint32_t)symbol_count) {
+        r->failed = 1;
+        return NULL;
+    }
+    return symbol_table[ref];
+}
+
+static uint32_t image_env_ref(ImageWriter *w, Environment *env) {
+    if (!env) return 0;
+    if (env < envs || env >= envs + env_count) {
+        w->failed = 1;
+        return 0;
+    }
+    return (uint32_t)(env - envs) + 1;
+}
+
+static Environment* image_env_deref(ImageReader *r, uint32_t ref) {
+    if (ref == 0) return NULL;
+    if (ref > (uint32_t)env_count) {
+        r->failed = 1;
+        return NULL;
+    }
+    return &envs[ref - 1];
+}
+
+uint32_t lnl_image_save(uint8_t *out, uint32_t capacity) {
+    ImageWriter w = {out, 0, capacity, 0};
+
+    image_put_u32(&w, LNL_IMAGE_MAGIC);
+    image_put_u32(&w, LNL_IMAGE_VERSION);
+    image_put_u32(&w, symbol_count);
+    image_put_u32(&w, heap_pos);
+    image_put_u32(&w, env_count);
+    image_put_u32(&w, image_env_ref(&w, global_env));
+
+    for (int i = 0; i < symbol_count; i++) {
+        int len = str_length(symbol_table[i]);
+        image_put_u8(&w, (uint8_t)len);
+        for (int j = 0; j < len; j++) {
+            image_put_u8(&w, (uint8_t)symbol_table[i][j]);
         }
+    }
 
-        input_pos = 0;
-        print("LNL> ");
-    } else if (c == '\b' || c == 127) {
-        int cursor_offset = cursor_x - PROMPT_LEN;
-        if (cursor_offset > 0) {
-            // Remove character before cursor
-            for (int i = cursor_offset - 1; i < input_pos - 1; i++) {
-                input_buf[i] = input_buf[i + 1];
+    for (int i = 0; i < heap_pos; i++) {
+        LNL *obj = &heap[i];
+        image_put_u8(&w, (uint8_t)obj->type);
+
+        switch (obj->type) {
+            case TYPE_INTEGER:
+                image_put_u32(&w, (uint32_t)obj->value.integer);
+                break;
+            case TYPE_FLOAT: {
+                union { double real; uint32_t half[2]; } bits;
+                bits.real = obj->value.real;
+                image_put_u32(&w, bits.half[0]);
+                image_put_u32(&w, bits.half[1]);
+                break;
             }
-            input_pos--;
-            cursor_x--;
-
-            // Redraw from cursor position
-            int saved_x = cursor_x;
-            for (int i = cursor_offset - 1; i < input_pos; i++) {
-                putchar(input_buf[i]);
+            case TYPE_BOOLEAN:
+                image_put_u8(&w, obj->value.boolean);
+                break;
+            case TYPE_SYMBOL:
+                image_put_u32(&w, image_symbol_ref(&w, obj->value.symbol));
+                break;
+            case TYPE_CONS:
+                image_put_u32(&w, image_obj_ref(&w, obj->value.cons.car));
+                image_put_u32(&w, image_obj_ref(&w, obj->value.cons.cdr));
+                break;
+            case TYPE_FUNCTION:
+                image_put_u32(&w, image_obj_ref(&w, obj->value.function.params));
+                image_put_u32(&w, image_obj_ref(&w, obj->value.function.body));
+                image_put_u32(&w, image_env_ref(&w, obj->value.function.env));
+                break;
+            case TYPE_BUILTIN: {
+                int index = 0;
+                while (index < BUILTIN_COUNT && builtins[index].func != obj->value.builtin) {
+                    index++;
+                }
+                if (index == BUILTIN_COUNT) {
+                    w.failed = 1; // Registered at runtime, can't be baked
+                }
+                image_put_u32(&w, (uint32_t)index);
+                break;
             }
-            putchar(' ');  // Clear last character
-            cursor_x = saved_x;
-            cursor_update();
+            case TYPE_AUTOLOAD:
+                w.failed = 1; // Points into a module registered at runtime
+                break;
+            default:
+                break;
         }
-    } else if (c >= 32 && c < 127) {
-        if (input_pos < MAX_INPUT - 1) {
-            int cursor_offset = cursor_x - PROMPT_LEN;
+    }
 
-            // Insert character at cursor position
-            for (int i = input_pos; i > cursor_offset; i--) {
-                input_buf[i] = input_buf[i - 1];
-            }
-            input_buf[cursor_offset] = c;
-            input_pos++;
+    for (int i = 0; i < env_count; i++) {
+        Environment *env = &envs[i];
+        image_put_u32(&w, image_env_ref(&w, env->parent));
+        image_put_u32(&w, env->size);
+        for (int j = 0; j < env->size; j++) {
+            image_put_u32(&w, image_symbol_ref(&w, env->symbols[j]));
+            image_put_u32(&w, image_obj_ref(&w, env->values[j]));
+        }
+    }
+
+    return w.failed ? 0 : w.pos;
+}
+
+int lnl_image_load(const uint8_t *image, uint32_t size) {
+    ImageReader r = {image, 0, size, 0};
+
+    if (!image || size == 0) return -1;
 
-            // Redraw from cursor position
-            for (int i = cursor_offset; i < input_pos; i++) {
-                putchar(input_buf[i]);
+    if (image_get_u32(&r) != LNL_IMAGE_MAGIC ||
+        image_get_u32(&r) != LNL_IMAGE_VERSION) {
+        return -1;
+    }
+
+    uint32_t nsymbols = image_get_u32(&r);
+    uint32_t nobjects = image_get_u32(&r);
+    uint32_t nenvs    = image_get_u32(&r);
+    uint32_t global   = image_get_u32(&r);
+
+    if (r.failed || nsymbols > MAX_SYMBOLS || nobjects > HEAP_SIZE ||
+        nenvs > sizeof(envs) / sizeof(envs[0])) {
+        return -1;
+    }
+
+    // Counts go first so that references can be range checked while
+    // decoding; everything refers to slots by index
+    symbol_count = nsymbols;
+    heap_pos = nobjects;
+    env_count = nenvs;
+
+    for (uint32_t i = 0; i < nsymbols; i++) {
+        uint32_t len = image_get_u8(&r);
+        if (len >= MAX_SYMBOL_LENGTH) r.failed = 1;
+        for (uint32_t j = 0; j < len && !r.failed; j++) {
+            symbol_table[i][j] = (char)image_get_u8(&r);
+        }
+        symbol_table[i][r.failed ? 0 : len] = '\0';
+    }
+    symbol_index_rebuild();
+
+    for (uint32_t i = 0; i < nobjects && !r.failed; i++) {
+        LNL *obj = &heap[i];
+        obj->type = (LNLType)image_get_u8(&r);
+        obj->marked = 0;
+        obj->next = NULL;
+
+        switch (obj->type) {
+            case TYPE_INTEGER:
+                obj->value.integer = (int32_t)image_get_u32(&r);
+                break;
+            case TYPE_FLOAT: {
+                union { double real; uint32_t half[2]; } bits;
+                bits.half[0] = image_get_u32(&r);
+                bits.half[1] = image_get_u32(&r);
+                obj->value.real = bits.real;
+                break;
+            }
+            case TYPE_BOOLEAN:
+                obj->value.boolean = image_get_u8(&r);
+                break;
+            case TYPE_SYMBOL:
+                obj->value.symbol = image_symbol_deref(&r, image_get_u32(&r));
+                break;
+            case TYPE_CONS:
+                obj->value.cons.car = image_obj_deref(&r, image_get_u32(&r));
+                obj->value.cons.cdr = image_obj_deref(&r, image_get_u32(&r));
+                break;
+            case TYPE_FUNCTION:
+                obj->value.function.params = image_obj_deref(&r, image_get_u32(&r));
+                obj->value.function.body = image_obj_deref(&r, image_get_u32(&r));
+                obj->value.function.env = image_env_deref(&r, image_get_u32(&r));
+                break;
+            case TYPE_BUILTIN: {
+                uint32_t index = image_get_u32(&r);
+                if (index >= (uint32_t)BUILTIN_COUNT) {
+                    r.failed = 1;
+                    break;
+                }
+                obj->value.builtin = builtins[index].func;
+                break;
             }
-            cursor_x = PROMPT_LEN + cursor_offset + 1;
-            cursor_update();
+            case TYPE_FREE:
+            case TYPE_NIL:
+                break;
+            default:
+                r.failed = 1;
+                break;
         }
     }
-}
 
-void lnlisp_init(void) {
-    heap_pos = 0;
-    symbol_count = 0;
-    env_count = 0;
+    for (uint32_t i = 0; i < nenvs && !r.failed; i++) {
+        Environment *env = &envs[i];
+        env->parent = image_env_deref(&r, image_get_u32(&r));
+        uint32_t env_size = image_get_u32(&r);
+        if (env_size > MAX_SYMBOLS) {
+            r.failed = 1;
+            break;
+        }
+        env->size = env_size;
+        for (uint32_t j = 0; j < env_size; j++) {
+            env->symbols[j] = image_symbol_deref(&r, image_get_u32(&r));
+            env->values[j] = image_obj_deref(&r, image_get_u32(&r));
+        }
+    }
 
-    global_env = env_create(NULL);
+    global_env = image_env_deref(&r, global);
+
+    if (r.failed || !global_env) {
+        heap_pos = 0;
+        symbol_count = 0;
+        env_count = 0;
+        global_env = NULL;
+        return -1;
+    }
+    return 0;
+}
 
-    env_define(global_env, "+", lnl_builtin(prim_add));
-    env_define(global_env, "-", lnl_builtin(prim_sub));
-    env_define(global_env, "*", lnl_builtin(prim_mul));
-    env_define(global_env, "=", lnl_builtin(prim_eq));
-    env_define(global_env, "cons", lnl_builtin(prim_cons));
-    env_define(global_env, "car", lnl_builtin(prim_car));
-    env_define(global_env, "cdr", lnl_builtin(prim_cdr));
-    env_define(global_env, "list", lnl_builtin(prim_list));
+void lnlisp_init_image(const uint8_t *image, uint32_t size) {
+    // The banner is the kernel's; the build-time tools call lnlisp_init
+    // and keep their output to diagnostics
+    if (lnl_image_load(image, size) != 0) {
+        lnlisp_init();
+        print("MONADLISP v0.0.1\n");
+        return;
+    }
 
-    print("MONADLISP v0.0.1\n");
+    print("MONADLISP v0.0.1 (boot image)\n");
 }
 
 void lnlisp_repl(void) {
+    sexp_parser_init_stream(&repl_parser, repl_stream, sizeof(repl_stream));
     print("LNL> ");
+    editor_begin();
 }
@@ -7,6 +7,8 @@
 #ifndef LNLISP_H
 #define LNLISP_H
 
+#include "sexparser.h"
+
 // Type definitions
 typedef unsigned char uint8_t;
 typedef unsigned short uint16_t;
@@ -14,7 +16,6 @@ typedef unsigned int uint32_t;
 typedef signed int int32_t;
 
 // Configuration
-#define MAX_INPUT 1000
 #define MAX_SYMBOLS 1000
 #define MAX_SYMBOL_LENGTH 64
 
@@ -29,12 +30,13 @@ typedef enum {
     TYPE_NIL,      // Scheme nil/()
     TYPE_BOOLEAN,  // #t or #f
     TYPE_INTEGER,  // Integer numbers
-    TYPE_FLOAT,    // Floating point (future)
+    TYPE_FLOAT,    // Floating point numbers
     TYPE_SYMBOL,   // Symbols
     TYPE_STRING,   // Strings (future)
     TYPE_CONS,     // Cons cell (pair)
     TYPE_FUNCTION, // Lambda function
-    TYPE_BUILTIN   // Built-in primitive
+    TYPE_BUILTIN,  // Built-in primitive
+    TYPE_AUTOLOAD  // Compiled module definition not loaded yet
 } LNLType;
 
 // LNL object structure
@@ -45,6 +47,7 @@ struct LNL {
 
     union {
         int32_t integer;
+        double real;
         uint8_t boolean;
         char *symbol;
 
@@ -60,6 +63,12 @@ struct LNL {
         } function;
 
         LNLBuiltin builtin;
+
+        struct {
+            void *module;  // FaslModule the definition lives in
+            uint32_t form; // Index in the module's form table
+            uint8_t loading;
+        } autoload;
     } value;
 };
 
@@ -81,6 +90,29 @@ LNL* lnlisp_read(const char *input);           // R
 LNL* lnlisp_eval(LNL *expr, Environment *env); // E
 void lnlisp_print(LNL *obj);                   // P
                                                // L
+
+// Cons tree of a datum parsed with sexp_parse_flat and the Monad allocator
+LNL* lnl_from_flat(const SexpNode *root);
+
+// Evaluate every form in source in the global environment
+int lnlisp_load(const char *source);
+
+/// BOOT IMAGE
+
+#define LNL_IMAGE_MAGIC   0x49444E4D  // "MNDI"
+#define LNL_IMAGE_VERSION 1
+
+// Generated at build time by mkimage from the prelude (monad_image.c)
+extern const uint8_t monad_boot_image[];
+extern const uint32_t monad_boot_image_size;
+
+// Serialize heap, symbol table and environments, returns 0 on failure
+uint32_t lnl_image_save(uint8_t *out, uint32_t capacity);
+// Map a saved image in place of lnlisp_init, returns -1 if unusable
+int lnl_image_load(const uint8_t *image, uint32_t size);
+// Boot from image, falling back to lnlisp_init, and print the banner
+void lnlisp_init_image(const uint8_t *image, uint32_t size);
+
 /// MEMORY MANAGEMENT
 
 void lnl_heap_init(void);
@@ -95,10 +127,13 @@ LNL* lnl_nil(void);
 LNL* lnl_true(void);
 LNL* lnl_false(void);
 LNL* lnl_int(int32_t val);
+LNL* lnl_float(double val);
 LNL* lnl_symbol(const char *name);
+LNL* lnl_symbol_span(const char *name, int len, uint32_t hash); // hash: sexp_hash
 LNL* lnl_cons(LNL *car, LNL *cdr);
 LNL* lnl_builtin(LNLBuiltin func);
 LNL* lnl_function(LNL *params, LNL *body, Environment *env);
+LNL* lnl_autoload(void *module, uint32_t form);
 
 /// ENVIRONMENT OPERATIONS
 
@@ -106,6 +141,7 @@ Environment* env_create(Environment *parent);
 void env_define(Environment *env, const char *symbol, LNL *value);
 LNL* env_lookup(Environment *env, const char *symbol);
 void env_set(Environment *env, const char *symbol, LNL *value);
+Environment* lnlisp_global_env(void);
 
 /// UTILITY FUNCTIONS
 
@@ -4,54 +4,192 @@
  */
 
 #include "sexparser.h"
+#include "../libc/stdlib.h"
 
 #ifndef NULL
 #define NULL ((void*)0)
 #endif
 
 
+/// CHARACTER CLASSES
+
+#define CC_SPACE     0x01
+#define CC_DIGIT     0x02
+#define CC_ALPHA     0x04
+#define CC_SYM_START 0x08  // Can start a symbol
+#define CC_SYM       0x10  // Can continue a symbol
+#define CC_DELIM     0x20  // Ends an atom
+
+#define CC_SYMBOLIC (CC_SYM_START | CC_SYM)
+
+static const uint8_t char_class[256] = {
+    ['\0']        = CC_DELIM,
+    [' ']         = CC_SPACE | CC_DELIM,
+    ['\t']        = CC_SPACE | CC_DELIM,
+    ['\n']        = CC_SPACE | CC_DELIM,
+    ['\r']        = CC_SPACE | CC_DELIM,
+    ['(']         = CC_DELIM,
+    [')']         = CC_DELIM,
+    ['\'']        = CC_DELIM,
+    [';']         = CC_DELIM,
+    ['0' ... '9'] = CC_DIGIT | CC_SYM,
+    ['a' ... 'z'] = CC_ALPHA | CC_SYMBOLIC,
+    ['A' ... 'Z'] = CC_ALPHA | CC_SYMBOLIC,
+    ['+'] = CC_SYMBOLIC, ['-'] = CC_SYMBOLIC, ['*'] = CC_SYMBOLIC,
+    ['/'] = CC_SYMBOLIC, ['='] = CC_SYMBOLIC, ['>'] = CC_SYMBOLIC,
+    ['<'] = CC_SYMBOLIC, ['?'] = CC_SYMBOLIC, ['!'] = CC_SYMBOLIC,
+    ['_'] = CC_SYMBOLIC, ['&'] = CC_SYMBOLIC, ['|'] = CC_SYMBOLIC,
+    ['%'] = CC_SYMBOLIC, ['^'] = CC_SYMBOLIC, ['~'] = CC_SYMBOLIC,
+    ['#'] = CC_SYMBOLIC,  // #t and #f, found by their hash like nil
+    ['.'] = CC_SYM,  // Can't start a symbol (dotted pairs) but joins module names
+};
+
+#define CHAR_IS(c, cls) (char_class[(uint8_t)(c)] & (cls))
+
 /// UTILITY FUNCTIONS
 
 int sexp_isspace(char c) {
-    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    return CHAR_IS(c, CC_SPACE) != 0;
 }
 
 int sexp_isdigit(char c) {
-    return c >= '0' && c <= '9';
+    return CHAR_IS(c, CC_DIGIT) != 0;
 }
 
 int sexp_isalpha(char c) {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    return CHAR_IS(c, CC_ALPHA) != 0;
 }
 
 int sexp_issymbol_start(char c) {
-    return sexp_isalpha(c) ||
-           c == '+' || c == '-' || c == '*' || c == '/' ||
-           c == '=' || c == '>' || c == '<' || c == '?' ||
-           c == '!' || c == '_' || c == '&' || c == '|' ||
-           c == '%' || c == '^' || c == '~';
+    return CHAR_IS(c, CC_SYM_START) != 0;
 }
 
 int sexp_issymbol_char(char c) {
-    return sexp_issymbol_start(c) || sexp_isdigit(c);
+    return CHAR_IS(c, CC_SYM) != 0;
 }
 
-/// PARSER IMPLEMENTATION
+/// WORD-AT-A-TIME SCANNING
+// Runs of whitespace and comment bodies are skipped four bytes at a time.
+// Loads are aligned so they never cross into an unmapped page past the
+// terminating NUL; byte order is little-endian (x86).
 
-static void parser_advance(SexpParser *p) {
-    if (p->current == '\n') {
-        p->line++;
-        p->column = 1;
-    } else {
-        p->column++;
+typedef uint32_t __attribute__((may_alias)) sexp_word;
+
+#define SWAR_ONES  0x01010101u
+#define SWAR_HIGHS 0x80808080u
+#define SWAR_LOWS  0x7F7F7F7Fu
+
+// 0x80 in every byte of w that is zero, and only in those
+static inline uint32_t swar_zero(uint32_t w) {
+    return ~(((w & SWAR_LOWS) + SWAR_LOWS) | w | SWAR_LOWS);
+}
+
+static inline uint32_t swar_eq(uint32_t w, uint8_t c) {
+    return swar_zero(w ^ (SWAR_ONES * c));
+}
+
+static inline uint32_t swar_space(uint32_t w) {
+    return swar_eq(w, ' ') | swar_eq(w, '\n') | swar_eq(w, '\t') | swar_eq(w, '\r');
+}
+
+static inline int word_aligned(const char *s) {
+    return ((unsigned long)s & (sizeof(sexp_word) - 1)) == 0;
+}
+
+// Offset of the first non-whitespace byte at or after i
+static int scan_spaces(const char *s, int i) {
+    while (!word_aligned(s + i)) {
+        if (!CHAR_IS(s[i], CC_SPACE)) return i;
+        i++;
+    }
+    for (;;) {
+        uint32_t hits = swar_space(*(const sexp_word*)(s + i));
+        if (hits != SWAR_HIGHS) {
+            return i + (__builtin_ctz(~hits & SWAR_HIGHS) >> 3);
+        }
+        i += 4;
+    }
+}
+
+// Offset of the first '\n' or NUL at or after i
+static int scan_line_end(const char *s, int i) {
+    while (!word_aligned(s + i)) {
+        if (s[i] == '\n' || s[i] == '\0') return i;
+        i++;
+    }
+    for (;;) {
+        uint32_t w = *(const sexp_word*)(s + i);
+        uint32_t hits = swar_eq(w, '\n') | swar_zero(w);
+        if (hits) {
+            return i + (__builtin_ctz(hits) >> 3);
+        }
+        i += 4;
+    }
+}
+
+// Offset of the first byte at or after i that can't continue a symbol,
+// hashing the symbol on the way
+static int scan_symbol(const char *s, int i, uint32_t *hash) {
+    uint32_t h = SEXP_HASH_INIT;
+    while (CHAR_IS(s[i], CC_SYM)) {
+        h = SEXP_HASH_STEP(h, s[i]);
+        i++;
+    }
+    *hash = h;
+    return i;
+}
+
+uint32_t sexp_hash(const char *name, int length) {
+    uint32_t h = SEXP_HASH_INIT;
+    for (int i = 0; i < length; i++) {
+        h = SEXP_HASH_STEP(h, name[i]);
     }
+    return h;
+}
+
+/// PARSER IMPLEMENTATION
+// Only the offset is tracked while parsing; line and column are worked
+// out from the input when an error is reported.
+
+static inline void parser_advance(SexpParser *p) {
     p->current = p->input[p->pos++];
 }
 
+// Move to offset i of the input
+static inline void parser_seek(SexpParser *p, int i) {
+    p->current = p->input[i];
+    p->pos = i + 1;
+}
+
+// Count lines from the last known position up to offset
+static void parser_locate(SexpParser *p, int offset, int *line, int *column) {
+    const char *s = p->input;
+    int i = p->line_base;
+    int lines = 0;
+
+    while (i < offset && !word_aligned(s + i)) {
+        lines += s[i++] == '\n';
+    }
+    for (; i + 4 <= offset; i += 4) {
+        // One bit per newline byte, summed into the top byte
+        uint32_t hits = swar_eq(*(const sexp_word*)(s + i), '\n') >> 7;
+        lines += (hits * SWAR_ONES) >> 24;
+    }
+    for (; i < offset; i++) {
+        lines += s[i] == '\n';
+    }
+
+    // The column only depends on the distance to the last newline
+    int last = offset;
+    while (last > p->line_base && s[last - 1] != '\n') last--;
+
+    *line = p->line + lines;
+    *column = lines ? offset - last + 1 : p->column + (offset - p->line_base);
+}
+
 static void parser_set_error(SexpParser *p, SexpResult code, const char *msg) {
     p->error_code = code;
-    p->error_line = p->line;
-    p->error_column = p->column;
+    parser_locate(p, p->pos - 1, &p->error_line, &p->error_column);
 
     // Copy error message
     int i = 0;
@@ -67,31 +205,50 @@ void sexp_parser_init(SexpParser *parser, const char *input) {
     parser->pos = 1;
     parser->line = 1;
     parser->column = 1;
+    parser->line_base = 0;
     parser->current = input[0];
     parser->error_code = SEXP_OK;
     parser->error_msg[0] = '\0';
     parser->error_line = 0;
     parser->error_column = 0;
+    parser->buffer = NULL;
+    parser->capacity = 0;
+    parser->length = 0;
+    parser->start = 0;
+    parser->scanned = 0;
+    parser->datum_end = 0;
+    parser->depth = 0;
+    parser->quoted = 0;
+    parser->eof = 0;
+    parser->scan_state = SEXP_SCAN_BLANK;
+    parser->stack = NULL;
+    parser->stack_size = 0;
+    parser->stack_capacity = SEXP_STACK_INLINE;
+    parser->nodes = NULL;
+    parser->node_capacity = 0;
+    parser->node_count = 0;
+}
+
+void sexp_parser_init_stream(SexpParser *parser, char *buffer, int capacity) {
+    buffer[0] = '\0';
+    sexp_parser_init(parser, buffer);
+    parser->buffer = buffer;
+    parser->capacity = capacity;
 }
 
 void sexp_skip_whitespace(SexpParser *p) {
-    while (p->current != '\0') {
-        // Skip whitespace
-        if (sexp_isspace(p->current)) {
-            parser_advance(p);
-            continue;
-        }
+    // Most tokens are directly followed by a delimiter
+    if (!CHAR_IS(p->current, CC_SPACE) && p->current != ';') return;
 
-        // Skip comments (semicolon to end of line)
-        if (p->current == ';') {
-            while (p->current != '\0' && p->current != '\n') {
-                parser_advance(p);
-            }
-            continue;
-        }
+    int i = p->pos - 1;
+    for (;;) {
+        i = scan_spaces(p->input, i);
 
-        break;
+        // Skip comments (semicolon to end of line)
+        if (p->input[i] != ';') break;
+        i = scan_line_end(p->input, i);
     }
+    parser_seek(p, i);
 }
 
 int sexp_has_more(SexpParser *parser) {
@@ -99,253 +256,461 @@ int sexp_has_more(SexpParser *parser) {
     return parser->current != '\0';
 }
 
-// Forward declaration
-static void* parse_expr(SexpParser *p, const SexpAllocator *alloc);
+/// NUMBERS
+// One pass over the literal: optional sign, 0x/0o/0b prefix, digits, an
+// optional fraction and exponent (decimal only), an optional size suffix.
+// Floats are converted by strtod, which rounds correctly.
+
+typedef struct {
+    const char *name;
+    SexpNumType type;
+    int64_t min;
+    uint64_t max;
+} SexpSuffix;
+
+static const SexpSuffix number_suffixes[] = {
+    {"i8",  SEXP_NUM_I8,  -128,                       127},
+    {"i16", SEXP_NUM_I16, -32768,                     32767},
+    {"i32", SEXP_NUM_I32, -2147483647 - 1,            2147483647},
+    {"i64", SEXP_NUM_I64, -9223372036854775807LL - 1, 9223372036854775807ULL},
+    {"u8",  SEXP_NUM_U8,  0,                          255},
+    {"u16", SEXP_NUM_U16, 0,                          65535},
+    {"u32", SEXP_NUM_U32, 0,                          4294967295ULL},
+    {"u64", SEXP_NUM_U64, 0,                          18446744073709551615ULL},
+    {"f32", SEXP_NUM_F32, 0,                          0},
+    {"f64", SEXP_NUM_F64, 0,                          0},
+};
+
+#define SUFFIX_COUNT ((int)(sizeof(number_suffixes) / sizeof(number_suffixes[0])))
+
+// Largest magnitude that can take another digit without overflowing 64
+// bits, and the largest digit it can take then
+static const uint64_t digit_limit[17] = {
+    [2] = 0x7FFFFFFFFFFFFFFFULL, [8] = 0x1FFFFFFFFFFFFFFFULL,
+    [10] = 0x1999999999999999ULL, [16] = 0x0FFFFFFFFFFFFFFFULL,
+};
+static const uint8_t digit_last[17] = {[2] = 1, [8] = 7, [10] = 5, [16] = 15};
+
+static int digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 16;
+}
+
+static int is_float_type(SexpNumType type) {
+    return type == SEXP_NUM_FLOAT || type == SEXP_NUM_F32 || type == SEXP_NUM_F64;
+}
+
+// The number as a 32-bit integer, if it is one
+static int number_int32(const SexpNumber *num, int32_t *out) {
+    if (is_float_type(num->type) || num->type == SEXP_NUM_I64 || num->type == SEXP_NUM_U64 ||
+        num->value.integer < -2147483647 - 1 || num->value.integer > 2147483647) {
+        return 0;
+    }
+    *out = (int32_t)num->value.integer;
+    return 1;
+}
+
+static void* make_number(SexpParser *p, const SexpAllocator *alloc, const SexpNumber *num) {
+    int32_t small;
+    void *obj = NULL;
+
+    if (alloc->alloc_number) {
+        obj = alloc->alloc_number(num);
+    } else if (number_int32(num, &small)) {
+        obj = alloc->alloc_int(small);
+    }
+
+    if (!obj && p->error_code == SEXP_OK) {
+        parser_set_error(p, SEXP_ERROR_INVALID_NUMBER,
+                         is_float_type(num->type) ? "Float literals not supported" : "Number too large");
+    }
+    return obj;
+}
 
 static void* parse_number(SexpParser *p, const SexpAllocator *alloc) {
-    int32_t num = 0;
+    const char *s = p->input;
+    int start = p->pos - 1;
+    int i = start;
     int negative = 0;
-    int has_digits = 0;
 
-    // Handle negative sign
-    if (p->current == '-') {
-        negative = 1;
-        parser_advance(p);
-    } else if (p->current == '+') {
-        parser_advance(p);
+    if (s[i] == '-' || s[i] == '+') {
+        negative = s[i] == '-';
+        i++;
     }
 
-    // Parse digits
-    while (sexp_isdigit(p->current)) {
-        has_digits = 1;
+    // Fast path: up to nine decimal digits, which can't overflow
+    int first = i;
+    uint32_t small = 0;
+    while (CHAR_IS(s[i], CC_DIGIT) && i - first < 9) {
+        small = small * 10 + (uint32_t)(s[i] - '0');
+        i++;
+    }
+    if (i > first && CHAR_IS(s[i], CC_DELIM)) {
+        parser_seek(p, i);
+        return alloc->alloc_int(negative ? -(int32_t)small : (int32_t)small);
+    }
 
-        // Check for overflow (simple check)
-        if (num > 214748364) { // INT_MAX/10
-            parser_set_error(p, SEXP_ERROR_INVALID_NUMBER, "Number too large");
-            return NULL;
+    // General case, from the top
+    i = first;
+    int base = 10;
+    if (s[i] == '0' && (s[i + 1] == 'x' || s[i + 1] == 'X')) base = 16;
+    if (s[i] == '0' && (s[i + 1] == 'o' || s[i + 1] == 'O')) base = 8;
+    if (s[i] == '0' && (s[i + 1] == 'b' || s[i + 1] == 'B')) base = 2;
+    if (base != 10) i += 2;
+
+    uint64_t magnitude = 0;
+    int digits = 0;
+    int overflow = 0;
+    for (int d; (d = digit_value(s[i])) < base; i++) {
+        if (magnitude > digit_limit[base] ||
+            (magnitude == digit_limit[base] && d > digit_last[base])) {
+            overflow = 1;
         }
+        magnitude = magnitude * base + d;
+        digits++;
+    }
 
-        num = num * 10 + (p->current - '0');
-        parser_advance(p);
+    if (!digits) {
+        parser_seek(p, i);
+        parser_set_error(p, SEXP_ERROR_INVALID_NUMBER, "Invalid number format");
+        return NULL;
+    }
+
+    SexpNumber num;
+    num.type = SEXP_NUM_INT;
+
+    // A fraction or an exponent makes a decimal literal a float
+    int is_float = 0;
+    if (base == 10) {
+        int j = i;
+        if (s[j] == '.' && CHAR_IS(s[j + 1], CC_DIGIT)) {
+            j++;
+            while (CHAR_IS(s[j], CC_DIGIT)) j++;
+            is_float = 1;
+        }
+        if ((s[j] == 'e' || s[j] == 'E') &&
+            (CHAR_IS(s[j + 1], CC_DIGIT) ||
+             ((s[j + 1] == '-' || s[j + 1] == '+') && CHAR_IS(s[j + 2], CC_DIGIT)))) {
+            is_float = 1;
+        }
+        if (is_float) {
+            char *end;
+            num.type = SEXP_NUM_FLOAT;
+            num.value.real = strtod(s + start, &end);
+            i = (int)(end - s);
+        }
+    }
+
+    // Size suffix
+    const SexpSuffix *suffix = NULL;
+    if (CHAR_IS(s[i], CC_ALPHA)) {
+        for (int k = 0; k < SUFFIX_COUNT; k++) {
+            const char *name = number_suffixes[k].name;
+            int len = 0;
+            while (name[len] && s[i + len] == name[len]) len++;
+            if (!name[len] && CHAR_IS(s[i + len], CC_DELIM)) {
+                suffix = &number_suffixes[k];
+                i += len;
+                break;
+            }
+        }
     }
 
-    if (!has_digits) {
+    parser_seek(p, i);
+    if (!CHAR_IS(s[i], CC_DELIM)) {
         parser_set_error(p, SEXP_ERROR_INVALID_NUMBER, "Invalid number format");
         return NULL;
     }
 
-    return alloc->alloc_int(negative ? -num : num);
+    if (suffix && is_float_type(suffix->type)) {
+        // Float suffixes only go on decimal literals
+        if (base != 10) {
+            parser_set_error(p, SEXP_ERROR_INVALID_NUMBER, "Invalid number format");
+            return NULL;
+        }
+        if (!is_float) {
+            num.value.real = strtod(s + start, NULL);
+        }
+        num.type = suffix->type;
+        if (num.type == SEXP_NUM_F32) {
+            num.value.real = (float)num.value.real;
+        }
+    } else if (is_float) {
+        if (suffix) {
+            parser_set_error(p, SEXP_ERROR_INVALID_NUMBER, "Integer suffix on a float");
+            return NULL;
+        }
+    } else {
+        uint64_t max;
+        if (suffix) {
+            num.type = suffix->type;
+            max = negative ? 0 - (uint64_t)suffix->min : suffix->max;
+        } else if (base != 10 && !negative && magnitude <= 0xFFFFFFFFULL) {
+            // Unsuffixed hex, octal and binary literals up to 32 bits are
+            // bit patterns, so 0xFFFFFFFF is -1. With a sign they are
+            // values like any other, so -0xFFFFFFFF is -4294967295.
+            num.value.integer = (int32_t)(uint32_t)magnitude;
+            return make_number(p, alloc, &num);
+        } else {
+            max = negative ? 0x8000000000000000ULL : 0x7FFFFFFFFFFFFFFFULL;
+        }
+
+        if (overflow || magnitude > max) {
+            parser_set_error(p, SEXP_ERROR_INVALID_NUMBER,
+                             suffix ? "Number out of range for its type" : "Number too large");
+            return NULL;
+        }
+        num.value.integer = (int64_t)(negative ? 0 - magnitude : magnitude);
+    }
+
+    return make_number(p, alloc, &num);
 }
 
-static void* parse_symbol(SexpParser *p, const SexpAllocator *alloc) {
+// SEXP_HASH of the literal keywords and of quote
+#define HASH_NIL   0x0da3f8ecu
+#define HASH_TRUE  0x4bc8e392u
+#define HASH_FALSE 0x59c8f99cu
+#define HASH_QUOTE 0xb2887bd7u
+
+static int span_equal(const char *span, int len, const char *name) {
+    for (int i = 0; i < len; i++) {
+        if (span[i] != name[i]) return 0;
+    }
+    return name[len] == '\0';
+}
+
+static void* make_symbol(const SexpAllocator *alloc, const char *name, int len, uint32_t hash) {
     static char symbol_buf[SEXP_MAX_SYMBOL_LENGTH];
-    int i = 0;
 
+    if (alloc->alloc_symbol_span) {
+        return alloc->alloc_symbol_span(name, len, hash);
+    }
+
+    // Allocators without spans get a NUL-terminated copy
+    for (int i = 0; i < len; i++) {
+        symbol_buf[i] = name[i];
+    }
+    symbol_buf[len] = '\0';
+    return alloc->alloc_symbol(symbol_buf);
+}
+
+static void* parse_symbol(SexpParser *p, const SexpAllocator *alloc) {
     // First character must be valid symbol start
-    if (!sexp_issymbol_start(p->current)) {
+    if (!CHAR_IS(p->current, CC_SYM_START)) {
         parser_set_error(p, SEXP_ERROR_UNEXPECTED_CHAR, "Invalid symbol start");
         return NULL;
     }
 
-    // Collect symbol characters
-    while (sexp_issymbol_char(p->current) && i < SEXP_MAX_SYMBOL_LENGTH - 1) {
-        symbol_buf[i++] = p->current;
-        parser_advance(p);
-    }
+    uint32_t hash;
+    int start = p->pos - 1;
+    int end = scan_symbol(p->input, start, &hash);
+    int len = end - start;
+    const char *name = p->input + start;
 
-    if (i >= SEXP_MAX_SYMBOL_LENGTH - 1 && sexp_issymbol_char(p->current)) {
+    if (len > SEXP_MAX_SYMBOL_LENGTH - 1) {
+        parser_seek(p, start + SEXP_MAX_SYMBOL_LENGTH - 1);
         parser_set_error(p, SEXP_ERROR_SYMBOL_TOO_LONG, "Symbol exceeds maximum length");
         return NULL;
     }
 
-    symbol_buf[i] = '\0';
+    parser_seek(p, end);
 
-    // Check for special literals
-    if (symbol_buf[0] == 'n' && symbol_buf[1] == 'i' &&
-        symbol_buf[2] == 'l' && symbol_buf[3] == '\0') {
+    // Check for special literals, the bytes only on a hash match
+    if (hash == HASH_NIL && span_equal(name, len, "nil")) {
         return alloc->alloc_nil();
     }
-
-    if (symbol_buf[0] == '#') {
-        if (symbol_buf[1] == 't' && symbol_buf[2] == '\0') {
-            return alloc->alloc_bool(1);
-        }
-        if (symbol_buf[1] == 'f' && symbol_buf[2] == '\0') {
-            return alloc->alloc_bool(0);
-        }
+    if (hash == HASH_TRUE && span_equal(name, len, "#t")) {
+        return alloc->alloc_bool(1);
+    }
+    if (hash == HASH_FALSE && span_equal(name, len, "#f")) {
+        return alloc->alloc_bool(0);
     }
 
-    return alloc->alloc_symbol(symbol_buf);
+    return make_symbol(alloc, name, len, hash);
 }
 
-static void* parse_list(SexpParser *p, const SexpAllocator *alloc) {
-    parser_advance(p); // Skip '('
-    sexp_skip_whitespace(p);
+/// TOKENS
+// The same classes the parser uses, one token at a time and bounded by a
+// length instead of a NUL, for highlighting input while it is edited.
 
-    // Empty list
-    if (p->current == ')') {
-        parser_advance(p);
-        return alloc->alloc_nil();
+int sexp_lex(const char *text, int length, int pos, SexpTokenType *type) {
+    char c = text[pos];
+    int end = pos + 1;
+
+    if (c == '\n') {
+        *type = TOKEN_NEWLINE;
+        return end;
+    }
+    if (CHAR_IS(c, CC_SPACE)) {
+        while (end < length && CHAR_IS(text[end], CC_SPACE) && text[end] != '\n') end++;
+        *type = TOKEN_SPACE;
+        return end;
     }
 
-    // Parse list elements
-    void *head = NULL;
-    void *tail = NULL;
+    switch (c) {
+    case '(':  *type = TOKEN_LPAREN; return end;
+    case ')':  *type = TOKEN_RPAREN; return end;
+    case '\'': *type = TOKEN_QUOTE; return end;
+    case ';':
+        while (end < length && text[end] != '\n') end++;
+        *type = TOKEN_COMMENT;
+        return end;
+    }
 
-    while (p->current != ')' && p->current != '\0') {
-        void *expr = parse_expr(p, alloc);
-        if (!expr) {
-            return NULL; // Error already set
-        }
+    // An atom runs to the next delimiter, whatever it turns out to be
+    int symbolic = CHAR_IS(c, CC_SYM) != 0;
+    while (end < length && !CHAR_IS(text[end], CC_DELIM)) {
+        symbolic &= CHAR_IS(text[end], CC_SYM) != 0;
+        end++;
+    }
 
-        void *new_cons = alloc->alloc_cons(expr, alloc->alloc_nil());
-        if (!new_cons) {
-            parser_set_error(p, SEXP_ERROR_ALLOC_FAILED, "Allocation failed");
-            return NULL;
-        }
+    if (CHAR_IS(c, CC_DIGIT) ||
+        ((c == '-' || c == '+') && end > pos + 1 && CHAR_IS(text[pos + 1], CC_DIGIT))) {
+        *type = TOKEN_NUMBER;
+    } else if (!CHAR_IS(c, CC_SYM_START) || !symbolic || end - pos > SEXP_MAX_SYMBOL_LENGTH - 1) {
+        *type = TOKEN_ERROR;
+    } else if (span_equal(text + pos, end - pos, "nil")) {
+        *type = TOKEN_NIL;
+    } else if (span_equal(text + pos, end - pos, "#t")) {
+        *type = TOKEN_TRUE;
+    } else if (span_equal(text + pos, end - pos, "#f")) {
+        *type = TOKEN_FALSE;
+    } else {
+        *type = TOKEN_SYMBOL;
+    }
+    return end;
+}
 
-        if (head == NULL) {
-            head = new_cons;
-            tail = new_cons;
-        } else {
-            // Update the cdr of the tail to point to new_cons
-            // This requires the allocator to expose a way to modify cons cells
-            // For now, we'll build the list properly
-            tail = alloc->alloc_cons(expr, alloc->alloc_nil());
-            if (!tail) {
-                parser_set_error(p, SEXP_ERROR_ALLOC_FAILED, "Allocation failed");
-                return NULL;
-            }
-        }
+/// FLAT OUTPUT
+// In flat mode atoms are made by the callbacks below, which append nodes
+// instead of allocating objects; list nodes are appended when the list
+// opens and get their size when it closes.
 
-        sexp_skip_whitespace(p);
+static SexpParser *flat_parser;
+static const SexpAllocator *flat_alloc;
 
-        // Check for improper list (dotted pair)
-        if (p->current == '.') {
-            parser_advance(p);
-            sexp_skip_whitespace(p);
+static SexpNode* flat_emit(SexpParser *p, SexpNodeTag tag) {
+    if (p->node_count == p->node_capacity) {
+        parser_set_error(p, SEXP_ERROR_BUFFER_FULL, "Node buffer full");
+        return NULL;
+    }
+    SexpNode *node = &p->nodes[p->node_count++];
+    node->tag = tag;
+    node->size = 1;
+    node->value.integer = 0;
+    return node;
+}
 
-            void *cdr_expr = parse_expr(p, alloc);
-            if (!cdr_expr) {
-                return NULL;
-            }
+static void flat_close(SexpParser *p, SexpNode *node) {
+    node->size = (uint32_t)(p->nodes + p->node_count - node);
+}
 
-            // Create improper list
-            void *result = alloc->alloc_cons(expr, cdr_expr);
-            if (!result) {
-                parser_set_error(p, SEXP_ERROR_ALLOC_FAILED, "Allocation failed");
-                return NULL;
-            }
+static void* flat_nil(void) {
+    return flat_emit(flat_parser, SEXP_NODE_NIL);
+}
 
-            sexp_skip_whitespace(p);
-            if (p->current != ')') {
-                parser_set_error(p, SEXP_ERROR_UNMATCHED_PAREN, "Expected ')' after dotted pair");
-                return NULL;
-            }
-            parser_advance(p);
-            return result;
-        }
-    }
+static void* flat_bool(int value) {
+    return flat_emit(flat_parser, value ? SEXP_NODE_TRUE : SEXP_NODE_FALSE);
+}
+
+static void* flat_int(int32_t value) {
+    SexpNode *node = flat_emit(flat_parser, SEXP_NODE_INT);
+    if (node) node->value.integer = value;
+    return node;
+}
 
-    if (p->current != ')') {
-        parser_set_error(p, SEXP_ERROR_UNMATCHED_PAREN, "Unmatched '('");
+static void* flat_symbol_span(const char *name, int len, uint32_t hash) {
+    void *symbol = make_symbol(flat_alloc, name, len, hash);
+    if (!symbol) {
+        parser_set_error(flat_parser, SEXP_ERROR_ALLOC_FAILED, "Allocation failed");
         return NULL;
     }
-
-    parser_advance(p);
-    return head ? head : alloc->alloc_nil();
+    SexpNode *node = flat_emit(flat_parser, SEXP_NODE_SYMBOL);
+    if (node) node->value.symbol = symbol;
+    return node;
 }
 
-static void* parse_list_proper(SexpParser *p, const SexpAllocator *alloc) {
-    parser_advance(p); // Skip '('
-    sexp_skip_whitespace(p);
+static void* flat_number(const SexpNumber *num) {
+    int32_t small;
 
-    // Empty list
-    if (p->current == ')') {
-        parser_advance(p);
-        return alloc->alloc_nil();
+    if (flat_alloc->alloc_number) {
+        void *number = flat_alloc->alloc_number(num);
+        if (!number) return NULL;
+        SexpNode *node = flat_emit(flat_parser, SEXP_NODE_NUMBER);
+        if (node) node->value.number = number;
+        return node;
     }
 
-    // Build list in reverse, then reverse it (or use recursive approach)
-    // For efficiency, we'll collect elements in an array first
-    #define MAX_LIST_ELEMENTS 256
-    void *elements[MAX_LIST_ELEMENTS];
-    int count = 0;
-
-    while (p->current != ')' && p->current != '\0') {
-        if (count >= MAX_LIST_ELEMENTS) {
-            parser_set_error(p, SEXP_ERROR_ALLOC_FAILED, "List too long");
-            return NULL;
-        }
+    if (!number_int32(num, &small)) return NULL;
+    return flat_int(small);
+}
 
-        void *expr = parse_expr(p, alloc);
-        if (!expr) {
-            return NULL;
-        }
+static void* flat_grow_stack(void *stack, uint32_t bytes) {
+    return flat_alloc->grow_stack ? flat_alloc->grow_stack(stack, bytes) : NULL;
+}
 
-        elements[count++] = expr;
-        sexp_skip_whitespace(p);
+static const SexpAllocator flat_allocator = {
+    flat_nil, flat_bool, flat_int, NULL, NULL, NULL, flat_grow_stack, flat_symbol_span,
+    flat_number
+};
 
-        // Check for dotted pair
-        if (p->current == '.') {
-            parser_advance(p);
-            sexp_skip_whitespace(p);
+int sexp_parse_flat(SexpParser *parser, const SexpAllocator *allocator,
+                    SexpNode *nodes, int capacity) {
+    parser->nodes = nodes;
+    parser->node_capacity = capacity;
+    parser->node_count = 0;
+    flat_parser = parser;
+    flat_alloc = allocator;
 
-            void *cdr_expr = parse_expr(p, alloc);
-            if (!cdr_expr) {
-                return NULL;
-            }
+    void *root = sexp_parse(parser, &flat_allocator);
 
-            sexp_skip_whitespace(p);
-            if (p->current != ')') {
-                parser_set_error(p, SEXP_ERROR_UNMATCHED_PAREN, "Expected ')' after dotted pair");
-                return NULL;
-            }
-            parser_advance(p);
+    parser->nodes = NULL;
+    return root ? parser->node_count : -1;
+}
 
-            // Build improper list from right to left
-            void *result = cdr_expr;
-            for (int i = count - 1; i >= 0; i--) {
-                result = alloc->alloc_cons(elements[i], result);
-                if (!result) {
-                    parser_set_error(p, SEXP_ERROR_ALLOC_FAILED, "Allocation failed");
-                    return NULL;
-                }
-            }
-            return result;
-        }
-    }
+/// PARSE STACK
+// Nesting is kept on an explicit stack of frames rather than the C stack,
+// so the depth of the input is bounded by memory, not by the kernel stack.
 
-    if (p->current != ')') {
-        parser_set_error(p, SEXP_ERROR_UNMATCHED_PAREN, "Unmatched '('");
-        return NULL;
-    }
-    parser_advance(p);
+static SexpFrame* parser_frames(SexpParser *p) {
+    return p->stack ? p->stack : p->stack_inline;
+}
 
-    // Build proper list from right to left
-    void *result = alloc->alloc_nil();
-    for (int i = count - 1; i >= 0; i--) {
-        result = alloc->alloc_cons(elements[i], result);
-        if (!result) {
-            parser_set_error(p, SEXP_ERROR_ALLOC_FAILED, "Allocation failed");
+static SexpFrame* parser_push(SexpParser *p, const SexpAllocator *alloc, SexpFrameKind kind) {
+    if (p->stack_size == p->stack_capacity) {
+        int capacity = p->stack_capacity * 2;
+        SexpFrame *grown = alloc->grow_stack
+            ? (SexpFrame*)alloc->grow_stack(p->stack, capacity * sizeof(SexpFrame))
+            : NULL;
+        if (!grown) {
+            parser_set_error(p, SEXP_ERROR_TOO_DEEP, "Nesting too deep");
             return NULL;
         }
+
+        // The first growth moves the frames out of the parser itself
+        if (!p->stack) {
+            for (int i = 0; i < p->stack_size; i++) {
+                grown[i] = p->stack_inline[i];
+            }
+        }
+        p->stack = grown;
+        p->stack_capacity = capacity;
     }
 
-    return result;
+    SexpFrame *frame = &parser_frames(p)[p->stack_size++];
+    frame->head = NULL;
+    frame->tail = NULL;
+    frame->kind = kind;
+    return frame;
 }
 
-static void* parse_quote(SexpParser *p, const SexpAllocator *alloc) {
-    parser_advance(p); // Skip '
+/// EXPRESSIONS
 
-    void *expr = parse_expr(p, alloc);
-    if (!expr) {
-        // If nothing after quote, quote nil
-        expr = alloc->alloc_nil();
-    }
-
-    // Build (quote expr)
-    void *quote_sym = alloc->alloc_symbol("quote");
+// Build (quote expr)
+static void* make_quote(SexpParser *p, const SexpAllocator *alloc, void *expr) {
+    void *quote_sym = make_symbol(alloc, "quote", 5, HASH_QUOTE);
     if (!quote_sym) {
         parser_set_error(p, SEXP_ERROR_ALLOC_FAILED, "Allocation failed");
         return NULL;
@@ -366,8 +731,11 @@ static void* parse_quote(SexpParser *p, const SexpAllocator *alloc) {
     return result;
 }
 
-static void* parse_expr(SexpParser *p, const SexpAllocator *alloc) {
+// Read one atom, or open a list or quote by pushing a frame. Returns the
+// atom, NULL with *opened set for a new frame, or NULL on error.
+static void* parse_token(SexpParser *p, const SexpAllocator *alloc, int *opened) {
     sexp_skip_whitespace(p);
+    *opened = 0;
 
     if (p->current == '\0') {
         parser_set_error(p, SEXP_ERROR_UNEXPECTED_EOF, "Unexpected end of input");
@@ -376,27 +744,58 @@ static void* parse_expr(SexpParser *p, const SexpAllocator *alloc) {
 
     // List
     if (p->current == '(') {
-        return parse_list_proper(p, alloc);
+        parser_advance(p); // Skip '('
+        sexp_skip_whitespace(p);
+
+        // Empty list
+        if (p->current == ')') {
+            parser_advance(p);
+            return alloc->alloc_nil();
+        }
+        if (p->current == '\0') {
+            parser_set_error(p, SEXP_ERROR_UNMATCHED_PAREN, "Unmatched '('");
+            return NULL;
+        }
+
+        SexpNode *node = NULL;
+        if (p->nodes && !(node = flat_emit(p, SEXP_NODE_LIST))) return NULL;
+
+        SexpFrame *frame = parser_push(p, alloc, SEXP_FRAME_LIST);
+        if (frame) frame->head = node;
+        *opened = frame != NULL;
+        return NULL;
     }
 
     // Quote
     if (p->current == '\'') {
-        return parse_quote(p, alloc);
+        parser_advance(p); // Skip '
+
+        // Flat output spells out (quote datum) up front
+        SexpNode *node = NULL;
+        if (p->nodes) {
+            if (!(node = flat_emit(p, SEXP_NODE_LIST))) return NULL;
+            if (!make_symbol(alloc, "quote", 5, HASH_QUOTE)) return NULL;
+        }
+
+        SexpFrame *frame = parser_push(p, alloc, SEXP_FRAME_QUOTE);
+        if (frame) frame->head = node;
+        *opened = frame != NULL;
+        return NULL;
     }
 
     // Number (including negative)
-    if (sexp_isdigit(p->current) ||
-        (p->current == '-' && sexp_isdigit(p->input[p->pos]))) {
+    if (CHAR_IS(p->current, CC_DIGIT) ||
+        (p->current == '-' && CHAR_IS(p->input[p->pos], CC_DIGIT))) {
         return parse_number(p, alloc);
     }
 
     // Plus sign followed by digit is also a number
-    if (p->current == '+' && sexp_isdigit(p->input[p->pos])) {
+    if (p->current == '+' && CHAR_IS(p->input[p->pos], CC_DIGIT)) {
         return parse_number(p, alloc);
     }
 
     // Symbol
-    if (sexp_issymbol_start(p->current)) {
+    if (CHAR_IS(p->current, CC_SYM_START)) {
         return parse_symbol(p, alloc);
     }
 
@@ -405,7 +804,239 @@ static void* parse_expr(SexpParser *p, const SexpAllocator *alloc) {
     return NULL;
 }
 
+// Hand a finished datum to the innermost open frame, closing frames it
+// completes. Returns 1 with the result in *value once the outermost frame
+// is closed, 0 if the next token is needed, -1 on error.
+static int parse_reduce(SexpParser *p, const SexpAllocator *alloc, void **value) {
+    while (p->stack_size > 0) {
+        SexpFrame *frame = &parser_frames(p)[p->stack_size - 1];
+
+        if (frame->kind == SEXP_FRAME_QUOTE) {
+            p->stack_size--;
+            if (p->nodes) {
+                flat_close(p, frame->head);
+                *value = frame->head;
+                continue;
+            }
+            *value = make_quote(p, alloc, *value);
+            if (!*value) return -1;
+            continue;
+        }
+
+        if (frame->kind == SEXP_FRAME_DOTTED) {
+            if (p->nodes) {
+                ((SexpNode*)frame->head)->tag = SEXP_NODE_DOTTED;
+            } else {
+                alloc->set_cdr(frame->tail, *value);
+            }
+
+            sexp_skip_whitespace(p);
+            if (p->current != ')') {
+                parser_set_error(p, SEXP_ERROR_UNMATCHED_PAREN, "Expected ')' after dotted pair");
+                return -1;
+            }
+            parser_advance(p);
+            if (p->nodes) flat_close(p, frame->head);
+            *value = frame->head;
+            p->stack_size--;
+            continue;
+        }
+
+        // Cells are linked in order through set_cdr as elements are parsed,
+        // so there is no limit on length and no buffering of elements.
+        // Flat output already holds the element after the list's node.
+        if (!p->nodes) {
+            void *cell = alloc->alloc_cons(*value, alloc->alloc_nil());
+            if (!cell) {
+                parser_set_error(p, SEXP_ERROR_ALLOC_FAILED, "Allocation failed");
+                return -1;
+            }
+
+            if (frame->head == NULL) {
+                frame->head = cell;
+            } else {
+                alloc->set_cdr(frame->tail, cell);
+            }
+            frame->tail = cell;
+        }
+
+        sexp_skip_whitespace(p);
+
+        // Check for improper list (dotted pair)
+        if (p->current == '.') {
+            parser_advance(p);
+            frame->kind = SEXP_FRAME_DOTTED;
+            return 0;
+        }
+
+        if (p->current == '\0') {
+            parser_set_error(p, SEXP_ERROR_UNMATCHED_PAREN, "Unmatched '('");
+            return -1;
+        }
+
+        if (p->current != ')') {
+            return 0; // Next element
+        }
+
+        parser_advance(p);
+        if (p->nodes) flat_close(p, frame->head);
+        *value = frame->head;
+        p->stack_size--;
+    }
+
+    return 1;
+}
+
+static void* parse_expr(SexpParser *p, const SexpAllocator *alloc) {
+    p->stack_size = 0;
+
+    for (;;) {
+        int opened;
+        void *value = parse_token(p, alloc, &opened);
+        if (opened) continue;
+        if (!value) return NULL; // Error already set
+
+        int done = parse_reduce(p, alloc, &value);
+        if (done < 0) return NULL;
+        if (done) return value;
+    }
+}
+
+/// STREAMING
+
+// Classify buffered bytes until the end of the next datum is found.
+// Every byte is looked at once; the scan resumes where it stopped.
+static int stream_scan(SexpParser *p) {
+    const char *s = p->buffer;
+    int i = p->scanned;
+
+    while (!p->datum_end && i < p->length) {
+        if (p->scan_state == SEXP_SCAN_COMMENT) {
+            i = scan_line_end(s, i);
+            if (i < p->length) {
+                p->scan_state = SEXP_SCAN_BLANK;
+                i++;
+            }
+            continue;
+        }
+
+        if (p->scan_state == SEXP_SCAN_ATOM) {
+            while (!CHAR_IS(s[i], CC_DELIM)) i++;
+            if (i == p->length) break;
+
+            // The delimiter is classified on the next round
+            p->scan_state = SEXP_SCAN_BLANK;
+            if (p->depth == 0) {
+                p->datum_end = i;
+                p->quoted = 0;
+            }
+            continue;
+        }
+
+        i = scan_spaces(s, i);
+        if (i == p->length) break;
+
+        char c = s[i++];
+        if (c == ';') {
+            p->scan_state = SEXP_SCAN_COMMENT;
+        } else if (c == '(') {
+            p->depth++;
+        } else if (c == ')') {
+            // A stray ')' completes too, so the parser can report it
+            if (p->depth > 0) p->depth--;
+            if (p->depth == 0) {
+                p->datum_end = i;
+                p->quoted = 0;
+            }
+        } else if (c == '\'') {
+            if (p->depth == 0) p->quoted = 1;
+        } else {
+            p->scan_state = SEXP_SCAN_ATOM;
+        }
+    }
+    p->scanned = i;
+
+    if (!p->datum_end && p->eof && p->scan_state == SEXP_SCAN_ATOM && p->depth == 0) {
+        p->scan_state = SEXP_SCAN_BLANK;
+        p->datum_end = p->scanned;
+        p->quoted = 0;
+    }
+
+    return p->datum_end != 0;
+}
+
+SexpResult sexp_feed(SexpParser *p, const char *chunk, int length) {
+    // Make room by dropping what the parser already consumed, keeping
+    // count of the lines in it for error positions
+    if (p->length + length >= p->capacity && p->start > 0) {
+        parser_locate(p, p->start, &p->line, &p->column);
+        p->line_base = 0;
+
+        int keep = p->length - p->start;
+        for (int i = 0; i < keep; i++) {
+            p->buffer[i] = p->buffer[p->start + i];
+        }
+        p->scanned -= p->start;
+        if (p->datum_end) p->datum_end -= p->start;
+        p->length = keep;
+        p->start = 0;
+        p->buffer[p->length] = '\0';
+    }
+
+    if (p->length + length >= p->capacity) {
+        parser_set_error(p, SEXP_ERROR_BUFFER_FULL, "Input buffer full");
+        return SEXP_ERROR_BUFFER_FULL;
+    }
+
+    for (int i = 0; i < length; i++) {
+        p->buffer[p->length++] = chunk[i];
+    }
+    p->buffer[p->length] = '\0';
+
+    return stream_scan(p) ? SEXP_OK : SEXP_NEED_MORE;
+}
+
+void sexp_finish(SexpParser *p) {
+    p->eof = 1;
+}
+
+int sexp_pending(SexpParser *p) {
+    stream_scan(p);
+    return p->depth > 0 || p->quoted || p->scan_state == SEXP_SCAN_ATOM;
+}
+
+static void* stream_parse(SexpParser *p, const SexpAllocator *alloc) {
+    if (p->error_code == SEXP_NEED_MORE) {
+        p->error_code = SEXP_OK;
+    }
+
+    if (!stream_scan(p) && (!p->eof || (p->depth == 0 && !p->quoted))) {
+        // Not an error, so no position is worked out for it
+        p->error_code = SEXP_NEED_MORE;
+        return NULL;
+    }
+
+    // The scanner guarantees the whole datum is in the buffer, so the
+    // ordinary parser runs over it without hitting a chunk boundary. If
+    // the input ended inside one, the parser runs into the end and
+    // reports it just as it would reading the whole string.
+    p->input = p->buffer;
+    parser_seek(p, p->start);
+
+    void *result = parse_expr(p, alloc);
+
+    p->start = p->pos - 1;
+    p->datum_end = 0;
+    if (p->start > p->scanned) {
+        p->scanned = p->start;
+    }
+    return result;
+}
+
 void* sexp_parse(SexpParser *parser, const SexpAllocator *allocator) {
+    if (parser->buffer) {
+        return stream_parse(parser, allocator);
+    }
     return parse_expr(parser, allocator);
 }
 
@@ -416,6 +1047,10 @@ const char* sexp_get_error(SexpParser *parser) {
         return "No error";
     }
 
+    if (parser->error_code == SEXP_NEED_MORE) {
+        return "Incomplete input";
+    }
+
     // Format error with line and column
     char *buf = error_buffer;
     int i = 0;
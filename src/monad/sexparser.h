@@ -1,6 +1,6 @@
 /*
  * @file sexparser.h
- * @version 1.0.0
+ * @version 1.0.1
  * S-Expression Parser - Fast, zero-allocation parser for LNL
  *
  * Features:
@@ -8,19 +8,35 @@
  * - Zero heap allocations (uses provided allocator callbacks)
  * - Proper error reporting with line/column tracking
  * - Support for quoted expressions, numbers, symbols, lists
- * - Tail-call optimized for deeply nested structures
+ * - Number literals: 0x/0o/0b integers, correctly rounded floats, and
+ *   type suffixes (255u8, -1i64, 1.5f32)
+ * - Iterative, with an explicit parse stack for deeply nested structures
  */
 
 #ifndef SEXPARSER_H
 #define SEXPARSER_H
 
-// Type definitions for kernel compatibility
+// Type definitions for kernel compatibility; hosted builds (mkimage,
+// mkfasl, the benchmarks) take them from the C library, whose 64-bit
+// types may be long rather than long long
+#if __STDC_HOSTED__
+#include <stdint.h>
+#else
 typedef unsigned char uint8_t;
+typedef unsigned int uint32_t;
 typedef signed int int32_t;
+typedef unsigned long long uint64_t;
+typedef signed long long int64_t;
+#endif
 
 // Configuration
 #define SEXP_MAX_SYMBOL_LENGTH 64
 #define SEXP_MAX_ERROR_LENGTH 128
+#define SEXP_STACK_INLINE 32    // Open lists/quotes before the stack must grow
+
+// Symbol hash (32-bit FNV-1a), computed by the lexer as it scans a symbol
+#define SEXP_HASH_INIT 2166136261u
+#define SEXP_HASH_STEP(h, c) (((h) ^ (uint8_t)(c)) * 16777619u)
 
 /// Parser Result Codes
 
@@ -32,16 +48,73 @@ typedef enum {
     SEXP_ERROR_SYMBOL_TOO_LONG,
     SEXP_ERROR_UNMATCHED_PAREN,
     SEXP_ERROR_ALLOC_FAILED,
-    SEXP_ERROR_EMPTY_INPUT
+    SEXP_ERROR_EMPTY_INPUT,
+    SEXP_ERROR_BUFFER_FULL,
+    SEXP_ERROR_TOO_DEEP,    // Parse stack could not grow
+    SEXP_NEED_MORE          // Streaming: no complete datum buffered yet
 } SexpResult;
 
+/// Streaming Scanner States
+
+typedef enum {
+    SEXP_SCAN_BLANK,        // Between tokens
+    SEXP_SCAN_ATOM,         // Inside a number or symbol
+    SEXP_SCAN_COMMENT       // Inside a ';' comment
+} SexpScanState;
+
+/// Parse Stack
+// One frame per list or quote that is open at the current position
+
+typedef enum {
+    SEXP_FRAME_LIST,        // Reading list elements
+    SEXP_FRAME_DOTTED,      // Read '.', waiting for the tail
+    SEXP_FRAME_QUOTE        // Read ', waiting for the quoted datum
+} SexpFrameKind;
+
+typedef struct {
+    void *head;             // First cell of the list, NULL while empty;
+                            // the list's SexpNode in flat output
+    void *tail;             // Last cell, where the next one is linked
+    SexpFrameKind kind;
+} SexpFrame;
+
+/// Flat Output
+// sexp_parse_flat lays a datum out as an array of nodes in preorder: a
+// list node is followed by the nodes of its elements, and its size counts
+// every node of the subtree, so the next sibling is at node + size. Only
+// symbols go through the allocator; everything else is stored inline.
+
+typedef enum {
+    SEXP_NODE_NIL,
+    SEXP_NODE_TRUE,
+    SEXP_NODE_FALSE,
+    SEXP_NODE_INT,          // value.integer
+    SEXP_NODE_SYMBOL,       // value.symbol, from the allocator
+    SEXP_NODE_NUMBER,       // value.number, from alloc_number
+    SEXP_NODE_LIST,         // Proper list, elements follow
+    SEXP_NODE_DOTTED        // Improper list, the last child is the tail
+} SexpNodeTag;
+
+typedef struct {
+    uint32_t tag : 8;       // SexpNodeTag
+    uint32_t size : 24;     // Nodes in this subtree, this one included
+    union {
+        int32_t integer;
+        void *symbol;
+        void *number;
+    } value;
+} SexpNode;
+
+#define SEXP_NODE_NEXT(node) ((node) + (node)->size)
+
 /// Parser State
 
 typedef struct {
     const char *input;      // Input string
     int pos;                // Current position
-    int line;               // Current line (1-indexed)
-    int column;             // Current column (1-indexed)
+    int line;               // Line at line_base (1-indexed)
+    int column;             // Column at line_base (1-indexed)
+    int line_base;          // Offset line/column refer to, errors count on
     char current;           // Current character
 
     // Error information
@@ -49,9 +122,35 @@ typedef struct {
     char error_msg[SEXP_MAX_ERROR_LENGTH];
     int error_line;
     int error_column;
+
+    // Streaming state (sexp_parser_init_stream), buffer is NULL otherwise.
+    // Bytes are classified once by the scanner as they arrive; a datum is
+    // only handed to the parser when the scanner has seen all of it.
+    char *buffer;           // Caller-owned storage for unconsumed input
+    int capacity;           // Size of buffer
+    int length;             // Bytes buffered
+    int start;              // First byte not consumed by the parser
+    int scanned;            // First byte not classified by the scanner
+    int datum_end;          // End of the next complete datum, 0 if none
+    int depth;              // Open lists at the scan position
+    int quoted;             // A top-level ' is waiting for its datum
+    int eof;                // No more chunks will arrive
+    SexpScanState scan_state;
+
+    // Parse stack, in stack_inline until it outgrows it. A grown stack
+    // comes from the allocator's grow_stack and is kept for later parses.
+    SexpFrame *stack;       // Grown stack, NULL while using stack_inline
+    int stack_size;         // Frames in use
+    int stack_capacity;     // Frames available
+    SexpFrame stack_inline[SEXP_STACK_INLINE];
+
+    // Flat output (sexp_parse_flat), nodes is NULL when building cons trees
+    SexpNode *nodes;
+    int node_capacity;
+    int node_count;
 } SexpParser;
 
-/// Token Types (for debugging/introspection)
+/// Token Types (for sexp_lex, debugging/introspection)
 
 typedef enum {
     TOKEN_EOF,
@@ -62,9 +161,41 @@ typedef enum {
     TOKEN_SYMBOL,
     TOKEN_TRUE,
     TOKEN_FALSE,
-    TOKEN_NIL
+    TOKEN_NIL,
+    TOKEN_SPACE,            // Run of whitespace within a line
+    TOKEN_NEWLINE,          // A '\n' on its own
+    TOKEN_COMMENT,          // ';' to the end of the line
+    TOKEN_ERROR             // Atom the reader would reject
 } SexpTokenType;
 
+/// Number Literals
+// Integers that fit 32 bits go to alloc_int. Everything else the reader
+// accepts (floats, sized literals such as 255u8 or 1.5f32, 64-bit values)
+// goes to alloc_number, and is rejected if the allocator has none.
+
+typedef enum {
+    SEXP_NUM_INT,           // Unsuffixed integer
+    SEXP_NUM_FLOAT,         // Unsuffixed float
+    SEXP_NUM_I8,
+    SEXP_NUM_I16,
+    SEXP_NUM_I32,
+    SEXP_NUM_I64,
+    SEXP_NUM_U8,
+    SEXP_NUM_U16,
+    SEXP_NUM_U32,
+    SEXP_NUM_U64,
+    SEXP_NUM_F32,
+    SEXP_NUM_F64
+} SexpNumType;
+
+typedef struct {
+    SexpNumType type;
+    union {
+        int64_t integer;    // Range checked for type; U64 above INT64_MAX wraps
+        double real;        // Float types, F32 already rounded to float
+    } value;
+} SexpNumber;
+
 /// Allocator Callbacks
 // These callbacks allow the parser to create objects without knowing
 // the internal representation. The parser calls these to construct
@@ -74,7 +205,11 @@ typedef void* (*SexpAllocNilFn)(void);
 typedef void* (*SexpAllocBoolFn)(int value);
 typedef void* (*SexpAllocIntFn)(int32_t value);
 typedef void* (*SexpAllocSymbolFn)(const char *name);
+typedef void* (*SexpAllocSymbolSpanFn)(const char *name, int length, uint32_t hash);
+typedef void* (*SexpAllocNumberFn)(const SexpNumber *number);
 typedef void* (*SexpAllocConsFn)(void *car, void *cdr);
+typedef void  (*SexpSetCdrFn)(void *cons, void *cdr);
+typedef void* (*SexpGrowStackFn)(void *stack, uint32_t bytes);
 
 typedef struct {
     SexpAllocNilFn alloc_nil;
@@ -82,6 +217,13 @@ typedef struct {
     SexpAllocIntFn alloc_int;
     SexpAllocSymbolFn alloc_symbol;
     SexpAllocConsFn alloc_cons;
+    SexpSetCdrFn set_cdr;     // Links a list's cells in order as they are read
+    SexpGrowStackFn grow_stack; // Optional, realloc-style: resize the parse
+                                // stack (NULL the first time), NULL on failure
+    SexpAllocSymbolSpanFn alloc_symbol_span; // Optional: symbol straight from
+                                // the input (not NUL-terminated) with its
+                                // SEXP_HASH, instead of a copy to alloc_symbol
+    SexpAllocNumberFn alloc_number; // Optional: literals alloc_int can't take
 } SexpAllocator;
 
 /// API Functions
@@ -93,14 +235,77 @@ typedef struct {
  */
 void sexp_parser_init(SexpParser *parser, const char *input);
 
+/**
+ * Initialize parser for input that arrives in chunks
+ * @param parser Parser state to initialize
+ * @param buffer Storage for input not consumed yet, such as a partial datum
+ * @param capacity Size of buffer in bytes
+ */
+void sexp_parser_init_stream(SexpParser *parser, char *buffer, int capacity);
+
+/**
+ * Append a chunk of input to a streaming parser
+ * @param parser Parser state
+ * @param chunk Input bytes (need not be NUL-terminated)
+ * @param length Number of bytes in chunk
+ * @return SEXP_OK if a complete datum is buffered, SEXP_NEED_MORE if not,
+ *         SEXP_ERROR_BUFFER_FULL if the chunk does not fit
+ */
+SexpResult sexp_feed(SexpParser *parser, const char *chunk, int length);
+
+/**
+ * Mark the end of streaming input, completing a trailing atom
+ * @param parser Parser state
+ */
+void sexp_finish(SexpParser *parser);
+
+/**
+ * Check if a streaming parser holds the start of an unfinished datum
+ * @param parser Parser state
+ * @return 1 if more input is needed to complete it, 0 otherwise
+ */
+int sexp_pending(SexpParser *parser);
+
 /**
  * Parse a single S-expression from the input
  * @param parser Parser state
  * @param allocator Allocator callbacks for creating objects
- * @return Parsed object or NULL on error (check parser->error_code)
+ * @return Parsed object or NULL on error (check parser->error_code).
+ *         A streaming parser sets SEXP_NEED_MORE until a datum is complete.
  */
 void* sexp_parse(SexpParser *parser, const SexpAllocator *allocator);
 
+/**
+ * Parse a single S-expression into a flat array of nodes
+ * @param parser Parser state
+ * @param allocator Allocator; only symbols and grow_stack are used
+ * @param nodes Output, the datum's root ends up in nodes[0]
+ * @param capacity Number of nodes available
+ * @return Number of nodes written, or -1 on error (check parser->error_code)
+ */
+int sexp_parse_flat(SexpParser *parser, const SexpAllocator *allocator,
+                    SexpNode *nodes, int capacity);
+
+/**
+ * Lex one token, without parsing or allocating (for editors)
+ * @param text Characters, need not be NUL terminated
+ * @param length Number of characters
+ * @param pos Where the token starts, below length
+ * @param type Set to the token's type
+ * @return Offset just past the token. Every byte belongs to exactly one
+ *         token, and a token only depends on the bytes from its start,
+ *         so relexing can start at any token boundary.
+ */
+int sexp_lex(const char *text, int length, int pos, SexpTokenType *type);
+
+/**
+ * Hash a symbol name the way the lexer does
+ * @param name Symbol characters
+ * @param length Number of characters
+ * @return SEXP_HASH of the name
+ */
+uint32_t sexp_hash(const char *name, int length);
+
 /**
  * Get human-readable error message
  * @param parser Parser state
@@ -0,0 +1,458 @@
+/*
+ * @file test_sexparser.c
+ * @version 0.0.3
+ * Reader tests (hosted)
+ *
+ * Number literals are read on their own and checked against the value
+ * the allocator was handed, or that the reader refused them. Streaming
+ * input is fed in every chunk size from one byte up, into a roomy buffer
+ * and a tight one that has to be compacted, and must read as the same
+ * datums, or fail with the same error at the same place, as the whole
+ * string read at once. Flat parses are checked node by node: tags,
+ * subtree sizes and the layout SEXP_NODE_NEXT walks, and overflow of the
+ * node array.
+ *
+ * Usage: test-sexparser
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sexparser.h"
+
+static int failed = 0;
+static int checked = 0;
+
+/// OBJECTS
+// A minimal tree for the allocator to build, written back out as text to
+// compare what two reads produced
+
+typedef enum {
+    OBJ_NIL,
+    OBJ_TRUE,
+    OBJ_FALSE,
+    OBJ_INT,
+    OBJ_REAL,
+    OBJ_SYMBOL,
+    OBJ_CONS
+} ObjKind;
+
+typedef struct Obj {
+    ObjKind kind;
+    int64_t integer;
+    double real;
+    char name[SEXP_MAX_SYMBOL_LENGTH];
+    struct Obj *car;
+    struct Obj *cdr;
+} Obj;
+
+#define POOL_SIZE 4096
+
+static Obj pool[POOL_SIZE];
+static int pool_used = 0;
+
+static Obj* obj_new(ObjKind kind) {
+    if (pool_used == POOL_SIZE) return NULL;
+    Obj *o = &pool[pool_used++];
+    memset(o, 0, sizeof(*o));
+    o->kind = kind;
+    return o;
+}
+
+static void* cb_nil(void)   { return obj_new(OBJ_NIL); }
+static void* cb_bool(int v) { return obj_new(v ? OBJ_TRUE : OBJ_FALSE); }
+
+static void* cb_int(int32_t v) {
+    Obj *o = obj_new(OBJ_INT);
+    if (o) o->integer = v;
+    return o;
+}
+
+static void* cb_number(const SexpNumber *n) {
+    int real = n->type == SEXP_NUM_FLOAT || n->type == SEXP_NUM_F32 || n->type == SEXP_NUM_F64;
+    Obj *o = obj_new(real ? OBJ_REAL : OBJ_INT);
+    if (o && real) o->real = n->value.real;
+    if (o && !real) o->integer = n->value.integer;
+    return o;
+}
+
+static void* cb_sym(const char *name) {
+    Obj *o = obj_new(OBJ_SYMBOL);
+    if (o) strncpy(o->name, name, sizeof(o->name) - 1);
+    return o;
+}
+
+// Straight from the input, which for a stream is the parser's buffer
+static void* cb_sym_span(const char *name, int len, uint32_t hash) {
+    if (hash != sexp_hash(name, len)) return NULL;
+    Obj *o = obj_new(OBJ_SYMBOL);
+    if (o) memcpy(o->name, name, len);
+    return o;
+}
+
+static void* cb_cons(void *car, void *cdr) {
+    Obj *o = obj_new(OBJ_CONS);
+    if (o) {
+        o->car = car;
+        o->cdr = cdr;
+    }
+    return o;
+}
+
+static void cb_set_cdr(void *cons, void *cdr) {
+    ((Obj*)cons)->cdr = cdr;
+}
+
+static const SexpAllocator allocator = {
+    cb_nil, cb_bool, cb_int, cb_sym, cb_cons, cb_set_cdr, NULL, cb_sym_span, cb_number
+};
+
+static void append(char *out, int size, const char *text) {
+    int len = (int)strlen(out);
+    snprintf(out + len, size - len, "%s", text);
+}
+
+static void write_obj(const Obj *o, char *out, int size) {
+    char atom[64];
+    switch (o->kind) {
+    case OBJ_NIL:    append(out, size, "nil"); return;
+    case OBJ_TRUE:   append(out, size, "#t"); return;
+    case OBJ_FALSE:  append(out, size, "#f"); return;
+    case OBJ_SYMBOL: append(out, size, o->name); return;
+    case OBJ_INT:
+        snprintf(atom, sizeof(atom), "%lld", (long long)o->integer);
+        append(out, size, atom);
+        return;
+    case OBJ_REAL:
+        snprintf(atom, sizeof(atom), "%g", o->real);
+        append(out, size, atom);
+        return;
+    case OBJ_CONS:
+        break;
+    }
+
+    append(out, size, "(");
+    for (;;) {
+        write_obj(o->car, out, size);
+        o = o->cdr;
+        if (!o || o->kind == OBJ_NIL) break;
+        if (o->kind != OBJ_CONS) {
+            append(out, size, " . ");
+            write_obj(o, out, size);
+            break;
+        }
+        append(out, size, " ");
+    }
+    append(out, size, ")");
+}
+
+static void expect(int ok, const char *what, const char *input) {
+    checked++;
+    if (!ok) {
+        printf("FAIL %s: \"%s\"\n", what, input);
+        failed++;
+    }
+}
+
+/// NUMBER LITERALS
+
+typedef struct {
+    const char *input;
+    int valid;
+    int64_t value;
+} NumberCase;
+
+static const NumberCase number_cases[] = {
+    { "42",                  1, 42 },
+    { "-42",                 1, -42 },
+    { "0xFF",                1, 255 },
+    { "0b1010",              1, 10 },
+    { "0o17",                1, 15 },
+
+    // Unsigned radix literals up to 32 bits are bit patterns...
+    { "0xFFFFFFFF",          1, -1 },
+    { "0x80000000",          1, -2147483647 - 1 },
+    { "0x100000000",         1, 4294967296LL },
+
+    // ...but a sign makes them plain values
+    { "-0x10",               1, -16 },
+    { "-0b101",              1, -5 },
+    { "-0xFFFFFFFF",         1, -4294967295LL },
+    { "-0x80000000",         1, -2147483647 - 1 },
+    { "-0x8000000000000000", 1, -9223372036854775807LL - 1 },
+    { "-0x8000000000000001", 0, 0 },
+
+    { "255u8",               1, 255 },
+    { "256u8",               0, 0 },
+    { "-1i64",               1, -1 },
+};
+
+#define NUMBER_CASES ((int)(sizeof(number_cases) / sizeof(number_cases[0])))
+
+static void test_numbers(void) {
+    for (int i = 0; i < NUMBER_CASES; i++) {
+        const NumberCase *c = &number_cases[i];
+        SexpParser parser;
+        sexp_parser_init(&parser, c->input);
+        pool_used = 0;
+        Obj *o = sexp_parse(&parser, &allocator);
+
+        int valid = parser.error_code == SEXP_OK;
+        if (valid != c->valid || (valid && (o->kind != OBJ_INT || o->integer != c->value))) {
+            if (valid) {
+                printf("%s: read %lld, expected ", c->input, (long long)o->integer);
+            } else {
+                printf("%s: %s, expected ", c->input, sexp_get_error(&parser));
+            }
+            if (c->valid) {
+                printf("%lld\n", (long long)c->value);
+            } else {
+                printf("an error\n");
+            }
+            failed++;
+        }
+        checked++;
+    }
+}
+
+/// STREAMING
+
+#define TRANSCRIPT_SIZE 4096
+#define ROOMY_CAPACITY  1024
+#define TIGHT_CAPACITY  48     // More than any datum below plus a small chunk
+#define TIGHT_CHUNKS    8      // Largest chunk fed to the tight buffer
+
+// Every datum fits in TIGHT_CAPACITY with a chunk to spare; the inputs as
+// a whole don't, so the tight buffer gets compacted along the way
+static const char *stream_cases[] = {
+    "(a b c)",
+    "(define (f x) (+ x 1))\n(f 41)",
+    "'a '(1 2) ''b",
+    "(a . b) (1 2 . 3) (x . (y))",
+    "; comment\n(a ; inner\n b)\n; trailing",
+    "  \n\n  42   -7 0x1F 2.5 255u8  ",
+    "foo bar-baz nil #t #f",
+    "(a (b (c (d (e)))))",
+    "abc\ndef",
+    "(1 2)\n(3 4)\n(5 6)\n(7 8)\n(9 10)\n(11 12)\n(13 14)",
+
+    // Errors, late enough that the tight buffer has dropped earlier lines
+    "(1 2)\n(3 4)\n(5 6)\n(7 8)\n(9 10)\n(11 12 13abc)",
+    "(a b)\n(c d)\n(e f)\n(g h)\n(i j)\n  (k . )",
+    "(a b)\n(c d)\n(e f)\n(g h)\n(i j)\n(k . l m)",
+    "(a b\n c",
+    "x\ny\n'",
+    "12abc",
+    ")",
+    "a b )",
+};
+
+#define STREAM_CASES ((int)(sizeof(stream_cases) / sizeof(stream_cases[0])))
+
+static void record_datum(char *out, const Obj *o) {
+    write_obj(o, out, TRANSCRIPT_SIZE);
+    append(out, TRANSCRIPT_SIZE, "\n");
+}
+
+static void record_error(char *out, const SexpParser *p) {
+    char line[64];
+    snprintf(line, sizeof(line), "error %d at %d:%d\n", p->error_code, p->error_line, p->error_column);
+    append(out, TRANSCRIPT_SIZE, line);
+}
+
+// The whole input at once
+static void read_string(const char *input, char *out) {
+    SexpParser parser;
+    sexp_parser_init(&parser, input);
+    out[0] = '\0';
+    pool_used = 0;
+
+    while (sexp_has_more(&parser)) {
+        Obj *o = sexp_parse(&parser, &allocator);
+        if (parser.error_code != SEXP_OK) {
+            record_error(out, &parser);
+            return;
+        }
+        record_datum(out, o);
+    }
+}
+
+// In chunks of chunk bytes; 0 if the buffer filled up
+static int read_stream(const char *input, int chunk, int capacity, char *out) {
+    static char buffer[ROOMY_CAPACITY];
+    SexpParser parser;
+    sexp_parser_init_stream(&parser, buffer, capacity);
+    out[0] = '\0';
+    pool_used = 0;
+
+    int length = (int)strlen(input);
+    for (int off = 0; ; off += chunk) {
+        if (off < length) {
+            int n = length - off < chunk ? length - off : chunk;
+            if (sexp_feed(&parser, input + off, n) == SEXP_ERROR_BUFFER_FULL) {
+                return 0;
+            }
+        } else {
+            sexp_finish(&parser);
+        }
+
+        for (;;) {
+            Obj *o = sexp_parse(&parser, &allocator);
+            if (parser.error_code == SEXP_NEED_MORE) break;
+            if (parser.error_code != SEXP_OK) {
+                record_error(out, &parser);
+                return 1;
+            }
+            record_datum(out, o);
+        }
+
+        if (off >= length) break;
+    }
+    return 1;
+}
+
+static void test_stream(void) {
+    static char expected[TRANSCRIPT_SIZE];
+    static char actual[TRANSCRIPT_SIZE];
+
+    for (int i = 0; i < STREAM_CASES; i++) {
+        const char *input = stream_cases[i];
+        int length = (int)strlen(input);
+        read_string(input, expected);
+
+        for (int chunk = 1; chunk <= length; chunk++) {
+            int fits = read_stream(input, chunk, ROOMY_CAPACITY, actual);
+            expect(fits && strcmp(actual, expected) == 0, "stream read differs", input);
+            if (fits && strcmp(actual, expected) != 0) {
+                printf("  chunk %d:\n%s  whole:\n%s", chunk, actual, expected);
+            }
+
+            if (chunk <= TIGHT_CHUNKS) {
+                fits = read_stream(input, chunk, TIGHT_CAPACITY, actual);
+                expect(fits && strcmp(actual, expected) == 0, "compacted stream read differs", input);
+            }
+        }
+    }
+
+    // A datum the buffer can't hold, whether it comes in one chunk or many
+    static char buffer[16];
+    const char *long_datum = "(a b c d e f g h i j)";
+    SexpParser parser;
+
+    sexp_parser_init_stream(&parser, buffer, sizeof(buffer));
+    expect(sexp_feed(&parser, long_datum, (int)strlen(long_datum)) == SEXP_ERROR_BUFFER_FULL &&
+           parser.error_code == SEXP_ERROR_BUFFER_FULL,
+           "one chunk past the buffer is not reported", long_datum);
+
+    sexp_parser_init_stream(&parser, buffer, sizeof(buffer));
+    SexpResult result = SEXP_NEED_MORE;
+    for (int i = 0; long_datum[i] && result != SEXP_ERROR_BUFFER_FULL; i++) {
+        result = sexp_feed(&parser, long_datum + i, 1);
+    }
+    expect(result == SEXP_ERROR_BUFFER_FULL, "bytes past the buffer are not reported", long_datum);
+}
+
+/// FLAT OUTPUT
+
+typedef struct {
+    const char *input;
+    const char *layout;     // Nodes in preorder; lists as L or D and their size
+} FlatCase;
+
+static const FlatCase flat_cases[] = {
+    { "42",                 "42" },
+    { "foo",                "foo" },
+    { "()",                 "nil" },
+    { "(a b c)",            "L4 a b c" },
+    { "(a (b c) d)",        "L6 a L3 b c d" },
+    { "((()))",             "L3 L2 nil" },
+    { "(#t #f nil -7)",     "L5 #t #f nil -7" },
+    { "(a . b)",            "D3 a b" },
+    { "(1 (2 . 3) . 4)",    "D6 1 D3 2 3 4" },
+    { "(a b . (c d))",      "D6 a b L3 c d" },
+    { "'x",                 "L3 quote x" },
+    { "'(a 'b)",            "L7 quote L5 a L3 quote b" },
+    { "(f '(1 . 2) ''())",  "L12 f L5 quote D3 1 2 L5 quote L3 quote nil" },
+};
+
+#define FLAT_CASES ((int)(sizeof(flat_cases) / sizeof(flat_cases[0])))
+#define FLAT_NODES 64
+
+static void write_node(const SexpNode *node, char *out) {
+    char atom[64];
+    switch (node->tag) {
+    case SEXP_NODE_NIL:    append(out, TRANSCRIPT_SIZE, "nil"); return;
+    case SEXP_NODE_TRUE:   append(out, TRANSCRIPT_SIZE, "#t"); return;
+    case SEXP_NODE_FALSE:  append(out, TRANSCRIPT_SIZE, "#f"); return;
+    case SEXP_NODE_SYMBOL: append(out, TRANSCRIPT_SIZE, ((Obj*)node->value.symbol)->name); return;
+    case SEXP_NODE_NUMBER: write_obj(node->value.number, out, TRANSCRIPT_SIZE); return;
+    case SEXP_NODE_INT:    snprintf(atom, sizeof(atom), "%d", (int)node->value.integer); break;
+    case SEXP_NODE_LIST:   snprintf(atom, sizeof(atom), "L%u", (unsigned)node->size); break;
+    case SEXP_NODE_DOTTED: snprintf(atom, sizeof(atom), "D%u", (unsigned)node->size); break;
+    }
+    append(out, TRANSCRIPT_SIZE, atom);
+}
+
+// Walking a list's children with SEXP_NODE_NEXT must land exactly on its
+// end; atoms are size 1, and a dotted list has a head and a tail at least
+static int flat_consistent(const SexpNode *node) {
+    if (node->tag != SEXP_NODE_LIST && node->tag != SEXP_NODE_DOTTED) {
+        return node->size == 1;
+    }
+
+    const SexpNode *end = SEXP_NODE_NEXT(node);
+    const SexpNode *child = node + 1;
+    int children = 0;
+    while (child < end) {
+        if (child->size == 0 || !flat_consistent(child)) return 0;
+        child = SEXP_NODE_NEXT(child);
+        children++;
+    }
+    return child == end && children >= (node->tag == SEXP_NODE_DOTTED ? 2 : 1);
+}
+
+static void test_flat(void) {
+    static SexpNode nodes[FLAT_NODES];
+    static char layout[TRANSCRIPT_SIZE];
+
+    for (int i = 0; i < FLAT_CASES; i++) {
+        const FlatCase *c = &flat_cases[i];
+        SexpParser parser;
+        sexp_parser_init(&parser, c->input);
+        pool_used = 0;
+        int count = sexp_parse_flat(&parser, &allocator, nodes, FLAT_NODES);
+        if (count < 0) {
+            expect(0, "flat parse failed", c->input);
+            continue;
+        }
+
+        layout[0] = '\0';
+        for (int n = 0; n < count; n++) {
+            if (n) append(layout, TRANSCRIPT_SIZE, " ");
+            write_node(&nodes[n], layout);
+        }
+        expect(strcmp(layout, c->layout) == 0, "flat layout differs", c->input);
+        if (strcmp(layout, c->layout) != 0) {
+            printf("  got      %s\n  expected %s\n", layout, c->layout);
+        }
+        expect((int)nodes[0].size == count && flat_consistent(nodes), "flat sizes inconsistent", c->input);
+
+        // One node short fails cleanly, and all of them is enough
+        sexp_parser_init(&parser, c->input);
+        expect(sexp_parse_flat(&parser, &allocator, nodes, count - 1) == -1 &&
+               parser.error_code == SEXP_ERROR_BUFFER_FULL,
+               "flat overflow not reported", c->input);
+        sexp_parser_init(&parser, c->input);
+        expect(sexp_parse_flat(&parser, &allocator, nodes, count) == count,
+               "flat parse into exactly enough nodes failed", c->input);
+    }
+}
+
+int main(void) {
+    test_numbers();
+    test_stream();
+    test_flat();
+
+    printf("%d of %d checks passed\n", checked - failed, checked);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * @file paging.c
+ * @version 0.0.1
+ * Identity-mapped paging with 4MB pages and memory types
+ */
+
+#include "paging.h"
+
+typedef unsigned long long uint64_t;
+
+#define PAGE_SIZE_4M 0x400000
+
+// Page directory entry bits for 4MB pages
+#define PDE_PRESENT 0x001
+#define PDE_WRITE   0x002
+#define PDE_PWT     0x008
+#define PDE_PCD     0x010
+#define PDE_LARGE   0x080
+#define PDE_PAT     0x1000
+
+// With PAT, a 4MB page's type is entry (PAT << 2 | PCD << 1 | PWT)
+#define PDE_TYPE_MASK (PDE_PAT | PDE_PCD | PDE_PWT)
+#define PDE_TYPE_WB   0                      // Entry 0
+#define PDE_TYPE_UC   (PDE_PCD | PDE_PWT)    // Entry 3
+#define PDE_TYPE_WC   (PDE_PAT | PDE_PWT)    // Entry 5
+
+// Reset values (WB, WT, UC-, UC, WB, WT, UC-, UC), except entry 5 is WC
+#define PAT_VALUE 0x0007010600070406ull
+
+#define MSR_PAT          0x277
+#define MSR_MTRR_CAP     0x0FE
+#define MSR_MTRR_DEFTYPE 0x2FF
+#define MSR_MTRR_BASE(n) (0x200 + 2 * (n))
+#define MSR_MTRR_MASK(n) (0x201 + 2 * (n))
+
+#define MTRR_TYPE_WC    1
+#define MTRR_MASK_VALID 0x800
+
+// CPUID leaf 1, EDX
+#define CPUID_PSE  (1 << 3)
+#define CPUID_MTRR (1 << 12)
+#define CPUID_PAT  (1 << 16)
+
+static uint32_t page_directory[1024] __attribute__((aligned(4096)));
+static uint32_t cpu_features = 0;
+static int paging_enabled = 0;
+
+static inline void cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline uint32_t read_cr0(void) {
+    uint32_t v;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(uint32_t v) {
+    __asm__ volatile("mov %0, %%cr0" : : "r"(v) : "memory");
+}
+
+static inline void flush_tlb(void) {
+    uint32_t v;
+    __asm__ volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(v) : : "memory");
+}
+
+static void set_type(uint32_t addr, uint32_t size, uint32_t type) {
+    if (!size) return;
+    uint32_t first = addr >> 22;
+    uint32_t last = (uint32_t)(((uint64_t)addr + size - 1) >> 22);
+    for (uint32_t i = first; i <= last; i++) {
+        page_directory[i] = (page_directory[i] & ~PDE_TYPE_MASK) | type;
+    }
+    flush_tlb();
+}
+
+int paging_init(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    cpu_features = d;
+
+    if (!(cpu_features & CPUID_PSE)) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < 1024; i++) {
+        page_directory[i] = (i << 22) | PDE_LARGE | PDE_WRITE | PDE_PRESENT | PDE_TYPE_WB;
+    }
+
+    // IOAPIC, LAPIC and the BIOS ROM alias at the top of the address space
+    for (uint32_t i = 0xFEC00000 >> 22; i < 1024; i++) {
+        page_directory[i] |= PDE_TYPE_UC;
+    }
+
+    if (cpu_features & CPUID_PAT) {
+        wrmsr(MSR_PAT, PAT_VALUE);
+    }
+
+    // CR4.PSE, then CR3 and CR0.PG
+    __asm__ volatile(
+        "mov %%cr4, %%eax\n\t"
+        "or $0x10, %%eax\n\t"
+        "mov %%eax, %%cr4\n\t"
+        "mov %0, %%cr3\n\t"
+        "mov %%cr0, %%eax\n\t"
+        "or $0x80000000, %%eax\n\t"
+        "mov %%eax, %%cr0"
+        : : "r"(page_directory) : "eax", "memory");
+
+    paging_enabled = 1;
+    return 0;
+}
+
+// Variable MTRRs need a power-of-two size aligned to itself, and have to
+// be changed with the caches off (Intel SDM 11.11.7.2)
+static int mtrr_write_combining(uint32_t addr, uint32_t size) {
+    if (!(cpu_features & CPUID_MTRR)) return 0;
+
+    uint64_t cap = rdmsr(MSR_MTRR_CAP);
+    if (!(cap & (1 << 10))) return 0;  // No WC type
+
+    uint32_t span = 1;
+    while (span < size && span) span <<= 1;
+    if (!span || (addr & (span - 1))) return 0;
+
+    // Mask bits go up to the physical address width
+    uint32_t a, b, c, d;
+    uint32_t width = 36;
+    cpuid(0x80000000, &a, &b, &c, &d);
+    if (a >= 0x80000008) {
+        cpuid(0x80000008, &a, &b, &c, &d);
+        width = a & 0xFF;
+    }
+    uint64_t mask = (((1ull << width) - 1) & ~(uint64_t)(span - 1)) | MTRR_MASK_VALID;
+
+    uint32_t count = (uint32_t)cap & 0xFF;
+    for (uint32_t n = 0; n < count; n++) {
+        if (rdmsr(MSR_MTRR_MASK(n)) & MTRR_MASK_VALID) continue;
+
+        uint32_t flags;
+        __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+
+        uint32_t cr0 = read_cr0();
+        write_cr0((cr0 | 0x40000000) & ~0x20000000);  // CD on, NW off
+        __asm__ volatile("wbinvd" : : : "memory");
+        flush_tlb();
+
+        uint64_t deftype = rdmsr(MSR_MTRR_DEFTYPE);
+        wrmsr(MSR_MTRR_DEFTYPE, deftype & ~0x800ull);
+        wrmsr(MSR_MTRR_BASE(n), addr | MTRR_TYPE_WC);
+        wrmsr(MSR_MTRR_MASK(n), mask);
+        wrmsr(MSR_MTRR_DEFTYPE, deftype);
+
+        __asm__ volatile("wbinvd" : : : "memory");
+        flush_tlb();
+        write_cr0(cr0);
+
+        if (flags & 0x200) __asm__ volatile("sti" : : : "memory");
+        return 1;
+    }
+    return 0;
+}
+
+PagingWriteCombining paging_map_write_combining(uint32_t addr, uint32_t size) {
+    // The PAT type wins over an uncached MTRR for the range
+    if (paging_enabled && (cpu_features & CPUID_PAT)) {
+        set_type(addr, size, PDE_TYPE_WC);
+        return PAGING_WC_PAT;
+    }
+    if (mtrr_write_combining(addr, size)) {
+        return PAGING_WC_MTRR;
+    }
+    return PAGING_WC_NONE;
+}
+
+void paging_map_uncached(uint32_t addr, uint32_t size) {
+    if (paging_enabled) {
+        set_type(addr, size, PDE_TYPE_UC);
+    }
+}
@@ -0,0 +1,28 @@
+/*
+ * @file paging.h
+ * @version 0.0.1
+ * Identity-mapped paging with 4MB pages and memory types
+ *
+ * All 4GB are mapped onto themselves with 4MB pages, write-back by
+ * default, so the kernel and its heaps are cached as before. The point
+ * is the memory type: a framebuffer can be made write-combining through
+ * the PAT, or through a variable MTRR on CPUs without one.
+ */
+
+#ifndef PAGING_H
+#define PAGING_H
+
+typedef unsigned int uint32_t;
+
+// How paging_map_write_combining got its range
+typedef enum {
+    PAGING_WC_NONE,  // Left as it was (uncached for device memory)
+    PAGING_WC_PAT,
+    PAGING_WC_MTRR
+} PagingWriteCombining;
+
+int paging_init(void);  // 0, or -1 if the CPU has no 4MB pages
+PagingWriteCombining paging_map_write_combining(uint32_t addr, uint32_t size);
+void paging_map_uncached(uint32_t addr, uint32_t size);
+
+#endif // PAGING_H
@@ -1,30 +1,259 @@
 /*
  * @file timer.c
- * @version 0.0.1
- * PIT (Programmable Interval Timer) for cursor blinking
+ * @version 0.0.3
+ * Tickless one-shot timers on a deadline queue
  */
 
 #include "timer.h"
-#include "cursor.h"
+#include "apic.h"
+
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND  0x43
+
+// Channel 0, low then high byte, mode 0 (interrupt on terminal count).
+// Writing just this byte also stops the count until a new one arrives.
+#define PIT_ONESHOT0 0x30
+#define PIT_LATCH0   0x00
+
+// Longest one-shot the 16-bit count allows, a little short of 65535 ticks
+#define PIT_MAX_TICKS 65535
+#define PIT_MAX_NS    54900000
+
+// The timer's vector, IRQ0's under the 8259 and routed there by apic_init
+#define TIMER_VECTOR 0x20
+
+static TimerBackend backend = TIMER_PIT;
+
+// Binary min-heap of pending timers, earliest deadline first
+static Timer *queue[TIMER_MAX];
+static uint32_t queue_size = 0;
+static int dispatching = 0;  // In timer_handler, which reprograms at the end
+
+// Without a TSC, time is the PIT's own count: everything finished so far
+// plus what has gone by of the one-shot in flight
+static uint64_t pit_base_ns = 0;
+static uint32_t armed_ticks = 0;
 
 static inline void outb(unsigned short port, unsigned char val) {
     __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
 }
 
+static inline unsigned char inb(unsigned short port) {
+    unsigned char ret;
+    __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    if (flags & 0x200) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+/// PIT
+
+// 1193182 Hz is 838.095ns per tick
+static uint64_t ticks_to_ns(uint32_t ticks) {
+    return (uint64_t)ticks * 838 + ticks * 3 / 32;
+}
+
+// Rounded up, for ns up to PIT_MAX_NS; 5125 / 2^32 is a hair over
+// 1193182 / 10^9, so the interrupt never comes early
+static uint32_t ns_to_ticks(uint32_t ns) {
+    uint32_t ticks = (uint32_t)(((uint64_t)ns * 5125) >> 32) + 1;
+    return ticks > PIT_MAX_TICKS ? PIT_MAX_TICKS : ticks;
+}
+
+// Ticks gone by of the current one-shot. Past terminal count the counter
+// wraps around and keeps going, which reads as more than was armed.
+static uint32_t pit_elapsed(void) {
+    if (!armed_ticks) {
+        return 0;
+    }
+    outb(PIT_COMMAND, PIT_LATCH0);
+    uint32_t remaining = inb(PIT_CHANNEL0);
+    remaining |= (uint32_t)inb(PIT_CHANNEL0) << 8;
+    return remaining > armed_ticks ? armed_ticks : armed_ticks - remaining;
+}
+
+// Interrupt once, ticks from now; 0 stops the count
+static void pit_arm(uint32_t ticks) {
+    pit_base_ns += ticks_to_ns(pit_elapsed());
+    armed_ticks = ticks;
+
+    outb(PIT_COMMAND, PIT_ONESHOT0);
+    if (ticks) {
+        outb(PIT_CHANNEL0, ticks & 0xFF);
+        outb(PIT_CHANNEL0, (ticks >> 8) & 0xFF);
+    }
+}
+
+/// QUEUE
+
+static void queue_set(uint32_t i, Timer *timer) {
+    queue[i] = timer;
+    timer->slot = i + 1;
+}
+
+static void sift_up(uint32_t i) {
+    Timer *timer = queue[i];
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (queue[parent]->deadline <= timer->deadline) break;
+        queue_set(i, queue[parent]);
+        i = parent;
+    }
+    queue_set(i, timer);
+}
+
+static void sift_down(uint32_t i) {
+    Timer *timer = queue[i];
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= queue_size) break;
+        if (child + 1 < queue_size && queue[child + 1]->deadline < queue[child]->deadline) {
+            child++;
+        }
+        if (timer->deadline <= queue[child]->deadline) break;
+        queue_set(i, queue[child]);
+        i = child;
+    }
+    queue_set(i, timer);
+}
+
+static void queue_remove(Timer *timer) {
+    uint32_t i = timer->slot - 1;
+    timer->slot = 0;
+    queue_size--;
+    if (i == queue_size) {
+        return;
+    }
+
+    // The last timer fills the hole, then moves whichever way it must
+    Timer *last = queue[queue_size];
+    queue_set(i, last);
+    sift_down(i);
+    sift_up(last->slot - 1);
+}
+
+// Arm for the earliest deadline, or stop if there is none
+static void reprogram(void) {
+    if (!queue_size) {
+        if (backend == TIMER_LAPIC) {
+            apic_timer_oneshot(0);
+        } else {
+            pit_arm(0);
+        }
+        return;
+    }
+
+    uint64_t now = timer_now();
+    uint64_t deadline = queue[0]->deadline;
+    uint64_t delta = deadline > now ? deadline - now : 0;
+    if (backend == TIMER_LAPIC) {
+        // Never 0, which would stop it
+        uint32_t ns = delta > APIC_TIMER_MAX_NS ? APIC_TIMER_MAX_NS : (uint32_t)delta;
+        apic_timer_oneshot(ns ? ns : 1);
+    } else {
+        pit_arm(ns_to_ticks(delta > PIT_MAX_NS ? PIT_MAX_NS : (uint32_t)delta));
+    }
+}
+
+/// API
+
 void timer_init(void) {
-    // PIT frequency: 1193180 Hz
-    // Desired frequency: ~18.2 Hz (like BIOS timer)
-    // Divisor = 1193180 / 18.2 ≈ 65536 (0x10000, wraps to 0)
+    queue_size = 0;
+    pit_base_ns = 0;
+    armed_ticks = 0;
+
+    // Nothing pending, so channel 0 stays stopped; with a local APIC
+    // (calibrated against the TSC clock) it never starts at all
+    pit_arm(0);
+    backend = apic_timer_init(TIMER_VECTOR) == 0 ? TIMER_LAPIC : TIMER_PIT;
+}
+
+TimerBackend timer_backend(void) {
+    return backend;
+}
+
+uint64_t timer_now(void) {
+    if (clock_hz()) {
+        return clock_ns();
+    }
+
+    uint32_t flags = irq_save();
+    uint64_t now = pit_base_ns + ticks_to_ns(pit_elapsed());
+    irq_restore(flags);
+    return now;
+}
 
-    // Command byte: channel 0, mode 3 (square wave), binary
-    outb(0x43, 0x36);
+int timer_start(Timer *timer, uint64_t deadline, TimerCallback callback, void *data) {
+    uint32_t flags = irq_save();
+    if (timer->slot) {
+        queue_remove(timer);
+    } else if (queue_size == TIMER_MAX) {
+        irq_restore(flags);
+        return -1;
+    }
+
+    timer->deadline = deadline;
+    timer->callback = callback;
+    timer->data = data;
+    queue_size++;
+    queue_set(queue_size - 1, timer);
+    sift_up(queue_size - 1);
+
+    // Only a new earliest deadline changes what the PIT waits for. A later
+    // one at most costs an interrupt that finds nothing due.
+    if (timer->slot == 1 && !dispatching) {
+        reprogram();
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+int timer_after(Timer *timer, uint64_t delay_ns, TimerCallback callback, void *data) {
+    return timer_start(timer, timer_now() + delay_ns, callback, data);
+}
+
+void timer_cancel(Timer *timer) {
+    uint32_t flags = irq_save();
+    if (timer->slot) {
+        int first = timer->slot == 1;
+        queue_remove(timer);
+        if (first && !dispatching) {
+            reprogram();
+        }
+    }
+    irq_restore(flags);
+}
+
+int timer_pending(const Timer *timer) {
+    return timer->slot != 0;
+}
 
-    // Send divisor (0 = 65536)
-    outb(0x40, 0x00);
-    outb(0x40, 0x00);
+void timer_idle(void) {
+    // sti takes effect after the next instruction, so nothing can land
+    // between it and the hlt
+    __asm__ volatile("sti; hlt" : : : "memory");
 }
 
+// IRQ0: run everything due by the time of the interrupt, then arm once
+// for what is left
 void timer_handler(void) {
-    // Update cursor blink state
-    cursor_tick();
+    uint64_t now = timer_now();
+    dispatching = 1;
+    while (queue_size && queue[0]->deadline <= now) {
+        Timer *timer = queue[0];
+        queue_remove(timer);
+        timer->callback(timer->data);
+    }
+    dispatching = 0;
+    reprogram();
 }
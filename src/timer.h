@@ -1,16 +1,58 @@
 /*
  * @file timer.h
- * @version 0.0.1
- * PIT (Programmable Interval Timer) for cursor blinking
+ * @version 0.0.3
+ * Tickless one-shot timers on a deadline queue
+ *
+ * Pending timers sit in a min-heap ordered by deadline, in nanoseconds
+ * on the clock_ns timeline. One one-shot timer, the local APIC's when
+ * apic_init found one and the PIT's channel 0 otherwise, is only ever
+ * armed for the earliest deadline, so with nothing pending the timer
+ * vector stays quiet and hlt sleeps until a key arrives. Deadlines past
+ * its reach (55ms for the PIT) just take a few intermediate interrupts.
+ *
+ * Callbacks run in interrupt context and may start timers, including
+ * their own; that is how something periodic re-arms itself.
  */
 
 #ifndef TIMER_H
 #define TIMER_H
 
+#include "clock.h"
+
 typedef unsigned char uint8_t;
 
-void timer_init(void);
+#define TIMER_MAX 32  // Timers pending at once
+
+typedef enum {
+    TIMER_PIT,
+    TIMER_LAPIC
+} TimerBackend;
+
+typedef void (*TimerCallback)(void *data);
+
+// Owned by the caller; zero-initialized is a valid, idle timer
+typedef struct {
+    uint64_t deadline;
+    TimerCallback callback;
+    void *data;
+    uint32_t slot;  // Heap index plus one; 0 when not pending
+} Timer;
+
+void timer_init(void);  // After apic_init and clock_init
 void timer_handler(void);
+TimerBackend timer_backend(void);
+
+// clock_ns; without a TSC, PIT time, which only runs while a timer is
+// pending (enough for deadlines made relative to it)
+uint64_t timer_now(void);
+int timer_start(Timer *timer, uint64_t deadline, TimerCallback callback, void *data);
+int timer_after(Timer *timer, uint64_t delay_ns, TimerCallback callback, void *data);
+void timer_cancel(Timer *timer);
+int timer_pending(const Timer *timer);
+
+// Sleep until the next interrupt. Call with interrupts disabled, after
+// finding nothing to do, so that a wake-up can't slip in before the hlt.
+void timer_idle(void);
 
 extern void irq0_handler(void);
 
@@ -1,11 +1,32 @@
 /*
  * @file vesa.c
- * @version 0.0.1
+ * @version 0.0.2
  * VESA VBE mode setup
  */
 
 #include "vesa.h"
 
+// Port I/O
+static inline void outw(uint16_t port, uint16_t val) {
+    __asm__ volatile("outw %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint16_t inw(uint16_t port) {
+    uint16_t val;
+    __asm__ volatile("inw %1, %0" : "=a"(val) : "Nd"(port));
+    return val;
+}
+
+static inline void outl(uint16_t port, uint32_t val) {
+    __asm__ volatile("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t val;
+    __asm__ volatile("inl %1, %0" : "=a"(val) : "Nd"(port));
+    return val;
+}
+
 // Initialize framebuffer from VESA mode info
 // This is called after entering protected mode
 int vesa_init_framebuffer(struct vbe_mode_info *mode_info) {
@@ -23,3 +44,87 @@ int vesa_init_framebuffer(struct vbe_mode_info *mode_info) {
 
     return 0;
 }
+
+/// BOCHS DISPI
+
+static void dispi_write(uint16_t index, uint16_t value) {
+    outw(VBE_DISPI_IOPORT_INDEX, index);
+    outw(VBE_DISPI_IOPORT_DATA, value);
+}
+
+static uint16_t dispi_read(uint16_t index) {
+    outw(VBE_DISPI_IOPORT_INDEX, index);
+    return inw(VBE_DISPI_IOPORT_DATA);
+}
+
+int vesa_bochs_available(void) {
+    uint16_t id = dispi_read(VBE_DISPI_INDEX_ID);
+    return id >= VBE_DISPI_ID0 && id <= VBE_DISPI_ID5;
+}
+
+// BAR0 of the Bochs/QEMU display on bus 0, through configuration
+// mechanism #1; the linear framebuffer lives there
+static uint32_t bochs_lfb_address(void) {
+    for (uint32_t slot = 0; slot < 32; slot++) {
+        uint32_t address = 0x80000000 | (slot << 11);
+        outl(PCI_CONFIG_ADDRESS, address);
+        if (inl(PCI_CONFIG_DATA) != ((BOCHS_PCI_DEVICE << 16) | BOCHS_PCI_VENDOR)) {
+            continue;
+        }
+        outl(PCI_CONFIG_ADDRESS, address | 0x10);
+        uint32_t bar = inl(PCI_CONFIG_DATA) & ~0xFu;
+        if (bar) return bar;
+    }
+    return BOCHS_LFB_DEFAULT;
+}
+
+static void bochs_set_y_offset(uint32_t y) {
+    dispi_write(VBE_DISPI_INDEX_Y_OFFSET, (uint16_t)y);
+}
+
+int vesa_bochs_set_mode(uint32_t width, uint32_t height, uint32_t bpp) {
+    if (!vesa_bochs_available()) {
+        return -1;
+    }
+
+    // Registers only take effect through a disable/enable cycle; the
+    // virtual height asks for a second page below the visible one
+    dispi_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_DISABLED);
+    dispi_write(VBE_DISPI_INDEX_XRES, (uint16_t)width);
+    dispi_write(VBE_DISPI_INDEX_YRES, (uint16_t)height);
+    dispi_write(VBE_DISPI_INDEX_BPP, (uint16_t)bpp);
+    dispi_write(VBE_DISPI_INDEX_VIRT_WIDTH, (uint16_t)width);
+    dispi_write(VBE_DISPI_INDEX_VIRT_HEIGHT, (uint16_t)(height * 2));
+    dispi_write(VBE_DISPI_INDEX_X_OFFSET, 0);
+    dispi_write(VBE_DISPI_INDEX_Y_OFFSET, 0);
+    dispi_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED);
+
+    // The adapter clamps what does not fit its memory, so read back
+    if (dispi_read(VBE_DISPI_INDEX_XRES) != width ||
+        dispi_read(VBE_DISPI_INDEX_YRES) != height ||
+        dispi_read(VBE_DISPI_INDEX_BPP) != bpp) {
+        dispi_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_DISABLED);
+        return -1;
+    }
+
+    uint32_t virt_width = dispi_read(VBE_DISPI_INDEX_VIRT_WIDTH);
+    uint32_t virt_height = dispi_read(VBE_DISPI_INDEX_VIRT_HEIGHT);
+
+    FramebufferInfo *fb = framebuffer_get_info();
+    fb->base = (uint32_t*)bochs_lfb_address();
+    fb->buffer = fb->base;
+    fb->width = width;
+    fb->height = height;
+    fb->pitch = virt_width * (bpp / 8);
+    fb->bpp = bpp;
+    fb->pages = virt_height >= height * 2 ? 2 : 1;
+    fb->visible = 0;
+    fb->set_y_offset = fb->pages == 2 ? bochs_set_y_offset : 0;
+
+    // Draw into the page that is not on screen
+    if (fb->pages == 2) {
+        fb->buffer = fb->base + height * (fb->pitch / 4);
+    }
+
+    return 0;
+}
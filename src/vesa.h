@@ -1,7 +1,11 @@
 /*
  * @file vesa.h
- * @version 0.0.1
+ * @version 0.0.2
  * VESA VBE structures and functions
+ *
+ * Besides the BIOS structures, the Bochs/QEMU display adapter can be
+ * programmed directly from protected mode through its dispi registers,
+ * which is how the kernel sets its mode and flips pages.
  */
 
 #ifndef VESA_H
@@ -25,6 +29,35 @@
 #define VESA_MODE_1024x768x32  0x118
 #define VESA_MODE_1280x1024x32 0x11B
 
+// Bochs dispi interface
+#define VBE_DISPI_IOPORT_INDEX 0x01CE
+#define VBE_DISPI_IOPORT_DATA  0x01CF
+
+#define VBE_DISPI_INDEX_ID          0
+#define VBE_DISPI_INDEX_XRES        1
+#define VBE_DISPI_INDEX_YRES        2
+#define VBE_DISPI_INDEX_BPP         3
+#define VBE_DISPI_INDEX_ENABLE      4
+#define VBE_DISPI_INDEX_BANK        5
+#define VBE_DISPI_INDEX_VIRT_WIDTH  6
+#define VBE_DISPI_INDEX_VIRT_HEIGHT 7
+#define VBE_DISPI_INDEX_X_OFFSET    8
+#define VBE_DISPI_INDEX_Y_OFFSET    9
+
+#define VBE_DISPI_ID0 0xB0C0
+#define VBE_DISPI_ID5 0xB0C5
+
+#define VBE_DISPI_DISABLED    0x00
+#define VBE_DISPI_ENABLED     0x01
+#define VBE_DISPI_LFB_ENABLED 0x40
+
+// Where to find the linear framebuffer
+#define PCI_CONFIG_ADDRESS 0x0CF8
+#define PCI_CONFIG_DATA    0x0CFC
+#define BOCHS_PCI_VENDOR   0x1234
+#define BOCHS_PCI_DEVICE   0x1111
+#define BOCHS_LFB_DEFAULT  0xFD000000  // QEMU default
+
 // VESA info structures (must be in real mode accessible memory)
 struct vbe_info {
     char     signature[4]; // "VESA"
@@ -79,4 +112,15 @@ struct vbe_mode_info {
 
 int vesa_init_framebuffer(struct vbe_mode_info *mode_info);
 
+/*
+ * @brief vesa_bochs_set_mode(width, height, bpp)
+ * @details Sets the mode through the dispi registers with a virtual
+ *          height of two screens and fills in the framebuffer info.
+ *          When the adapter has the memory, pages is 2 and drawing
+ *          targets the hidden page. Returns -1 without the adapter or
+ *          if it refuses the mode.
+ */
+int vesa_bochs_available(void);
+int vesa_bochs_set_mode(uint32_t width, uint32_t height, uint32_t bpp);
+
 #endif // VESA_H